@@ -0,0 +1,252 @@
+#include "AirtimeMonitor.hh"
+
+#include "RawHci.hh"
+
+#include <gio/gio.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace asha;
+
+namespace
+{
+   // HCI packet types
+   constexpr uint8_t ACL_PKT = 0x02;
+   constexpr uint8_t EVENT_PKT = 0x04;
+
+   // Events
+   constexpr uint8_t EVT_DISCONNECTION_COMPLETE = 0x05;
+   constexpr uint8_t EVT_NUM_COMPLETED_PACKETS = 0x13;
+   constexpr uint8_t EVT_LE_META = 0x3e;
+   constexpr uint8_t LE_DATA_LENGTH_CHANGE = 0x07;
+   constexpr uint8_t LE_PHY_UPDATE_COMPLETE = 0x0c;
+
+   // Packet boundary flag for the rest of an L2CAP PDU.
+   constexpr uint8_t PB_CONTINUING = 0x01;
+
+   uint16_t Le16(const uint8_t* p) { return p[0] | p[1] << 8; }
+
+   // LL PDUs needed for an ACL packet.
+   size_t Pdus(const AirtimeMonitor::Link& link, size_t length)
+   {
+      size_t octets = std::max<size_t>(link.tx_octets, 27);
+      return std::max<size_t>(1, (length + octets - 1) / octets);
+   }
+
+   // µs on air for an ACL packet.
+   uint64_t AclTime(const AirtimeMonitor::Link& link, size_t length)
+   {
+      size_t octets = std::max<size_t>(link.tx_octets, 27);
+      uint64_t time = 0;
+      for (; length > octets; length -= octets)
+         time += AirtimeMonitor::PduTime(link.phy, octets);
+      return time + AirtimeMonitor::PduTime(link.phy, length);
+   }
+}
+
+
+struct AirtimeMonitor::Controller
+{
+   AirtimeMonitor* monitor;
+   uint16_t index;
+   std::shared_ptr<GSocket> sock;
+   std::shared_ptr<GSource> source;
+
+   ~Controller()
+   {
+      if (source)
+         g_source_destroy(source.get());
+   }
+};
+
+
+AirtimeMonitor::AirtimeMonitor()
+{
+   for (uint16_t index: RawHci::DeviceIds())
+      Open(index);
+}
+
+
+AirtimeMonitor::~AirtimeMonitor()
+{
+}
+
+
+void AirtimeMonitor::AddController(uint16_t index)
+{
+   if (!m_controllers.count(index))
+      Open(index);
+}
+
+
+const AirtimeMonitor::Link* AirtimeMonitor::Get(uint16_t index, uint16_t handle) const
+{
+   auto it = m_links.find({index, handle});
+   return it == m_links.end() ? nullptr : &it->second;
+}
+
+
+void AirtimeMonitor::Open(uint16_t index)
+{
+   // Only try once per controller, whatever happens.
+   auto& controller = m_controllers[index];
+   int sock = RawHci::OpenTrafficSocket(index, {
+      EVT_DISCONNECTION_COMPLETE,
+      EVT_NUM_COMPLETED_PACKETS,
+      EVT_LE_META
+   });
+   if (sock < 0)
+   {
+      g_info("Not following airtime on hci%u, that needs CAP_NET_RAW", (unsigned)index);
+      return;
+   }
+
+   controller.reset(new Controller{this, index, nullptr, nullptr});
+   controller->sock.reset(g_socket_new_from_fd(sock, nullptr), g_object_unref);
+   if (!controller->sock)
+   {
+      close(sock);
+      controller.reset();
+      return;
+   }
+   controller->source.reset(g_socket_create_source(controller->sock.get(), G_IO_IN, nullptr), g_source_unref);
+   GSocketSourceFunc callback = [](GSocket*, GIOCondition, gpointer data) {
+      auto* c = (Controller*)data;
+      c->monitor->Read(*c);
+      return (gboolean)G_SOURCE_CONTINUE;
+   };
+   g_source_set_callback(controller->source.get(), G_SOURCE_FUNC(callback), controller.get(), nullptr);
+   g_source_attach(controller->source.get(), nullptr);
+}
+
+
+void AirtimeMonitor::Read(Controller& controller)
+{
+   int fd = g_socket_get_fd(controller.sock.get());
+   uint8_t buffer[HCI_MAX_FRAME_SIZE];
+   bool incoming;
+   int64_t stamp;
+   ssize_t size;
+   while ((size = RawHci::ReadTraffic(fd, buffer, sizeof(buffer), &incoming, &stamp)) > 0)
+      Packet(controller.index, buffer, size, incoming, stamp ? stamp : g_get_real_time());
+}
+
+
+void AirtimeMonitor::Packet(uint16_t index, const uint8_t* data, size_t size, bool incoming, int64_t stamp)
+{
+   if (size < 1)
+      return;
+   uint8_t type = data[0];
+   ++data;
+   --size;
+
+   if (type == ACL_PKT && !incoming && size >= 4)
+   {
+      // handle and flags, length
+      auto& link = m_links[{index, (uint16_t)(Le16(data) & 0x0fff)}];
+      uint16_t length = Le16(data + 2);
+      if ((Le16(data) >> 12 & 0x3) != PB_CONTINUING)
+         ++link.sdus;
+      ++link.fragments;
+      link.pdus += Pdus(link, length);
+      if (link.synced)
+         link.in_flight.emplace_back(stamp, length);
+      else
+         ++link.untracked;
+   }
+   else if (type == EVENT_PKT && size >= 2)
+   {
+      uint8_t event = data[0];
+      const uint8_t* p = data + 2;
+      size_t plen = std::min<size_t>(data[1], size - 2);
+
+      if (event == EVT_NUM_COMPLETED_PACKETS && plen >= 1)
+      {
+         // count, then (handle, completed) for each
+         size_t count = std::min<size_t>(p[0], (plen - 1) / 4);
+         for (size_t i = 0; i < count; ++i)
+         {
+            auto it = m_links.find({index, (uint16_t)(Le16(p + 1 + i * 4) & 0x0fff)});
+            if (it != m_links.end())
+               Completed(it->second, Le16(p + 3 + i * 4), stamp);
+         }
+      }
+      else if (event == EVT_DISCONNECTION_COMPLETE && plen >= 4 && p[0] == 0)
+      {
+         // The controller will reuse the handle.
+         m_links.erase({index, (uint16_t)(Le16(p + 1) & 0x0fff)});
+      }
+      else if (event == EVT_LE_META && plen >= 1)
+      {
+         if (p[0] == LE_DATA_LENGTH_CHANGE && plen >= 11)
+         {
+            // handle, tx octets, tx time, rx octets, rx time
+            auto& link = m_links[{index, (uint16_t)(Le16(p + 1) & 0x0fff)}];
+            link.tx_octets = Le16(p + 3);
+            link.tx_time = Le16(p + 5);
+         }
+         else if (p[0] == LE_PHY_UPDATE_COMPLETE && plen >= 6 && p[1] == 0)
+         {
+            // status, handle, tx phy, rx phy
+            m_links[{index, (uint16_t)(Le16(p + 2) & 0x0fff)}].phy = p[4];
+         }
+      }
+   }
+}
+
+
+void AirtimeMonitor::Completed(Link& link, size_t count, int64_t stamp)
+{
+   link.completed += count;
+   if (!link.synced)
+   {
+      // These may be for packets we never saw, so nothing lines up until
+      // the controller has sent everything we did see.
+      link.untracked -= std::min(count, link.untracked);
+      link.synced = link.untracked == 0;
+      return;
+   }
+   for (; count && !link.in_flight.empty(); --count)
+   {
+      auto [sent, length] = link.in_flight.front();
+      link.in_flight.pop_front();
+      link.latency.Add(std::max<int64_t>(stamp - sent, 0));
+      link.airtime += AclTime(link, length);
+   }
+}
+
+
+void AirtimeMonitor::Tick(int64_t now)
+{
+   int64_t elapsed = now - m_last_tick;
+   for (auto& kv: m_links)
+   {
+      auto& link = kv.second;
+      if (m_last_tick && elapsed > 0)
+         link.utilization = (double)(link.airtime - link.last_airtime) / elapsed;
+      link.last_airtime = link.airtime;
+   }
+   m_last_tick = now;
+}
+
+
+uint32_t AirtimeMonitor::PduTime(uint8_t phy, size_t bytes)
+{
+   // On the uncoded PHYs: preamble, access address, header, payload, MIC and
+   // CRC, with a one byte longer preamble on 2M. The empty PDU back has no
+   // payload or MIC.
+   constexpr uint32_t IFS = 150;
+   switch (phy)
+   {
+   case 2:
+      return (2 + 4 + 2 + bytes + 4 + 3) * 4 + IFS + (2 + 4 + 2 + 3) * 4 + IFS;
+   case 3:
+      // Coded S=8: 80µs preamble, 256µs access address, 16µs CI and 24µs
+      // TERM1, then 64µs a byte, and 24µs TERM2.
+      return 400 + (2 + bytes + 4 + 3) * 64 + IFS + 400 + (2 + 3) * 64 + IFS;
+   default:
+      return (1 + 4 + 2 + bytes + 4 + 3) * 8 + IFS + (1 + 4 + 2 + 3) * 8 + IFS;
+   }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Histogram.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace asha
+{
+
+// Follows what the controller does with the audio we hand it. A writable
+// socket only says the kernel took a frame; the controller's Number Of
+// Completed Packets events say when it actually went out, and the LE Data
+// Length Change and PHY Update events say how it was packed on air. From
+// those we work out, for each connection:
+//
+//   * how long packets wait in the controller before they are completed,
+//   * how many HCI ACL packets and LL PDUs each L2CAP PDU (one audio frame)
+//     is split into,
+//   * roughly how much of the time the radio spends sending our audio.
+//
+// Which is what tells whether 2M PHY or DLE is worth pushing for on a
+// given adapter.
+//
+// The PHY and data length are usually settled as the connection comes up,
+// before we know which connections are ours, so every controller is followed
+// from the start, and every connection on it. A connection that was up
+// before that is taken to be on 1M PHY with 27 byte PDUs, until an event
+// says otherwise. It may also have packets in flight that we never saw sent,
+// so nothing is timed on a connection until a completion leaves none of the
+// packets we saw outstanding. Needs CAP_NET_RAW to see the traffic. (main
+// thread)
+class AirtimeMonitor final
+{
+public:
+   struct Link
+   {
+      uint8_t phy = 1;           // 1 for 1M, 2 for 2M, 3 for coded.
+      uint16_t tx_octets = 27;   // Largest LL PDU payload we may send.
+      uint16_t tx_time = 328;    // And how long it may take, in µs.
+
+      size_t sdus = 0;           // L2CAP PDUs sent to the controller.
+      size_t fragments = 0;      // The HCI ACL packets they were sent in.
+      size_t pdus = 0;           // The LL PDUs those are split into on air.
+      size_t completed = 0;      // ACL packets the controller has sent.
+      uint64_t airtime = 0;      // Estimated µs on air for those.
+      double utilization = 0;    // Fraction of time on air since the last Tick().
+      Histogram latency;         // µs from the kernel handing over an ACL
+                                 // packet until it is reported completed.
+
+      double FragmentsPerSdu() const { return sdus ? (double)fragments / sdus : 0; }
+      double PdusPerSdu() const { return sdus ? (double)pdus / sdus : 0; }
+
+      // Sent packets the controller hasn't completed yet: when, and how big.
+      std::deque<std::pair<int64_t, uint16_t>> in_flight;
+      // Packets sent and not yet completed while we aren't synced, which
+      // can't be told apart from ones sent before we started looking.
+      size_t untracked = 0;
+      bool synced = false;
+      uint64_t last_airtime = 0;
+   };
+
+   AirtimeMonitor();
+   ~AirtimeMonitor();
+
+   // Follow a controller that came up after we started. Does nothing if we
+   // already have it, or already failed to open it.
+   void AddController(uint16_t index);
+   // nullptr if nothing has been seen for the connection.
+   const Link* Get(uint16_t index, uint16_t handle) const;
+
+   // Work out the utilization since the last call. now is monotonic µs.
+   void Tick(int64_t now);
+
+   // Take one packet from a controller, starting with its HCI packet type.
+   void Packet(uint16_t index, const uint8_t* data, size_t size, bool incoming, int64_t stamp);
+
+   // µs on air to send an encrypted LL data PDU with this much payload, and
+   // get the empty PDU back, including both inter frame spaces.
+   static uint32_t PduTime(uint8_t phy, size_t bytes);
+
+private:
+   struct Controller;
+
+   void Open(uint16_t index);
+   void Read(Controller& controller);
+   void Completed(Link& link, size_t count, int64_t stamp);
+
+   std::map<std::pair<uint16_t, uint16_t>, Link> m_links;
+   std::map<uint16_t, std::unique_ptr<Controller>> m_controllers;
+   int64_t m_last_tick = 0;
+};
+
+}
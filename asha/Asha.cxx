@@ -5,6 +5,7 @@
 #include "Side.hh"
 #include "../pw/Stream.hh"
 
+#include <algorithm>
 #include <cassert>
 #include <glib.h>
 #include <set>
@@ -57,57 +58,58 @@ Asha::~Asha()
 }
 
 
-size_t Asha::Occupancy() const
+BufferStats::Snapshot Asha::Stats() const
 {
-   size_t ret = 0;
+   BufferStats::Snapshot ret = m_removed_stats;
    for (auto& kv: m_devices)
-      ret += kv.second.buffer->Occupancy();
+      ret += kv.second.buffer->Stats();
    return ret;
 }
 
 
-size_t Asha::OccupancyHigh() const
+size_t Asha::DeviceQueued() const
 {
    size_t ret = 0;
    for (auto& kv: m_devices)
-   {
-      if (ret < kv.second.buffer->OccupancyHigh())
-         ret = kv.second.buffer->OccupancyHigh();
-   }
+      ret = std::max(ret, kv.second.buffer->DeviceQueued());
    return ret;
 }
 
 
-size_t Asha::RingDropped() const
+FrameTiming Asha::Timing() const
 {
-   size_t ret = 0;
+   FrameTiming ret;
    for (auto& kv: m_devices)
-      ret += kv.second.buffer->RingDropped();
+      ret.Merge(kv.second.device->Timing());
    return ret;
 }
 
 
-size_t Asha::FailedWrites() const
+uint64_t Asha::EarLatency(double fraction) const
 {
-   size_t ret = 0;
+   uint64_t ret = 0;
    for (auto& kv: m_devices)
-      ret += kv.second.buffer->FailedWrites();
+      ret = std::max(ret, kv.second.device->EarLatency(fraction));
    return ret;
 }
 
 
-size_t Asha::Silence() const
+uint64_t Asha::EarLatency(const Histogram& total, double fraction) const
 {
-   // Summing these together has the side effect that if we remove a side, then
-   // when we add them together as if they were a single counter, then we get
-   // a counter value that appears to have gone backwards, and can print
-   // garbage to the screen.
-   size_t ret = 0;
+   uint64_t ret = 0;
    for (auto& kv: m_devices)
-      ret += kv.second.buffer->Silence();
+      ret = std::max(ret, kv.second.device->EarLatency(total, fraction));
    return ret;
 }
 
+
+void Asha::ForEachDevice(const std::function<void(uint64_t, Device&, const Buffer&)>& fn) const
+{
+   for (auto& kv: m_devices)
+      fn(kv.first, *kv.second.device, *kv.second.buffer);
+}
+
+
 int16_t Asha::LeftRssi() const
 {
    for (auto& kv: m_devices)
@@ -137,6 +139,45 @@ int16_t Asha::RightRssi() const
 }
 
 
+Histogram Asha::LeftQueue() const
+{
+   // The audio thread is still adding, so read the counts one at a time.
+   Histogram ret;
+   for (auto& kv: m_devices)
+   {
+      if (kv.second.device)
+      {
+         auto side = kv.second.device->Left();
+         if (side)
+         {
+            ret.Merge(side->QueueDepth());
+            break;
+         }
+      }
+   }
+   return ret;
+}
+
+Histogram Asha::RightQueue() const
+{
+   // The audio thread is still adding, so read the counts one at a time.
+   Histogram ret;
+   for (auto& kv: m_devices)
+   {
+      if (kv.second.device)
+      {
+         auto side = kv.second.device->Right();
+         if (side)
+         {
+            ret.Merge(side->QueueDepth());
+            break;
+         }
+      }
+   }
+   return ret;
+}
+
+
 
 const Device* Asha::GetDevice(uint64_t id) const
 {
@@ -189,6 +230,11 @@ void Asha::OnRemoveDevice(const std::string& path)
             g_info("Removing Sink %lu %s", it->first, it->second.device->Name().c_str());
             if (m_device_removed)
                m_device_removed(it->first);
+
+            // Keep its counts, but it isn't holding any audio anymore.
+            auto stats = it->second.buffer->Stats();
+            stats.occupancy = 0;
+            m_removed_stats += stats;
             m_devices.erase(it);
          }
          else
@@ -244,16 +290,7 @@ void Asha::SideReady(const std::string& path, const std::shared_ptr<Side>& side)
          [buffer]() { /* device->OnDisconnect(); */ }, // disconnect
          [buffer]() { buffer->StreamStart(); }, // start
          [buffer]() { buffer->StreamStop(); }, // stop
-         [buffer](const RawS16& samples) {
-            // TODO: redesign this api so that we can retrieve the pointer and
-            //       have the pipewire stream fill it in.
-            auto p = buffer->NextBuffer();
-            if (p)
-            {
-               *p = samples;
-               buffer->SendBuffer();
-            }
-         }
+         buffer
       );
       it = m_devices.emplace(props.hi_sync_id, Pipeline{device, buffer, stream}).first;
       g_info("Adding Sink %lu %s", it->first, side->Name().c_str());
@@ -261,6 +298,11 @@ void Asha::SideReady(const std::string& path, const std::shared_ptr<Side>& side)
 
    it->second.device->AddSide(path, side);
 
+   // Report the latency to pipewire so that players can keep video in
+   // sync.
+   uint16_t render_delay = it->second.device->RenderDelay();
+   it->second.stream->SetLatency(render_delay * 1000000ull + it->second.buffer->Latency());
+
    if (added)
    {
       if (m_device_added)
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "Bluetooth.hh"
+#include "BufferStats.hh"
 #include "Device.hh"
+#include "Histogram.hh"
 
 #include <cstdint>
 #include <map>
@@ -24,14 +26,23 @@ public:
    Asha();
    ~Asha();
 
-   size_t Occupancy() const;
-   size_t OccupancyHigh() const;
-   size_t RingDropped() const;
-   size_t FailedWrites() const;
-   size_t Silence() const;
+   // All the buffers together, including the ones that have gone away, so
+   // that the counters never go backwards.
+   BufferStats::Snapshot Stats() const;
+   size_t DeviceQueued() const;
+   // Every device's frame timing together, and the worst device's estimate
+   // of how long it takes to hear a sample, in ns. The estimate is over the
+   // whole run, or over the given total, such as one interval of Timing().
+   FrameTiming Timing() const;
+   uint64_t EarLatency(double fraction) const;
+   uint64_t EarLatency(const Histogram& total, double fraction) const;
+   // Call fn with every device and its buffer. (main thread)
+   void ForEachDevice(const std::function<void(uint64_t, Device&, const Buffer&)>& fn) const;
 
    int16_t LeftRssi() const;
    int16_t RightRssi() const;
+   Histogram LeftQueue() const;
+   Histogram RightQueue() const;
 
    bool HasDevice() const { return !m_devices.empty(); }
 
@@ -60,6 +71,7 @@ private:
       std::shared_ptr<pw::Stream> stream;    // Pipewire stream to produce audio.
    };
    std::map<uint64_t, Pipeline> m_devices;
+   BufferStats::Snapshot m_removed_stats; // From the devices that are gone.
 
    std::function<void(uint64_t, Device&)> m_device_added;
    std::function<void(uint64_t, Device&)> m_device_updated;
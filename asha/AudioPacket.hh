@@ -16,4 +16,32 @@ struct RawS16
    static constexpr size_t SAMPLE_COUNT = 320;
    int16_t l[SAMPLE_COUNT];
    int16_t r[SAMPLE_COUNT];
+   // When the first sample came out of pipewire, from Now(), so that the
+   // frame can be traced to the sockets. 0 if it isn't traced. seq counts
+   // every frame, including the ones the buffer had no room for.
+   uint64_t stamp;
+   uint32_t seq;
+
+   // Mix the two channels together for a single device.
+   void Downmix(int16_t mono[SAMPLE_COUNT]) const
+   {
+      for (size_t i = 0; i < SAMPLE_COUNT; ++i)
+         mono[i] = ((int32_t)l[i] + (int32_t)r[i]) / 2;
+   }
+
+   // True if no sample on either channel is further than level from zero.
+   // Shifting by level turns the range check into a single unsigned
+   // compare, so the loop is a max reduction the compiler can vectorize.
+   bool IsSilent(uint16_t level = 0) const
+   {
+      uint16_t peak = 0;
+      for (size_t i = 0; i < SAMPLE_COUNT; ++i)
+      {
+         uint16_t a = l[i] + level;
+         uint16_t b = r[i] + level;
+         peak = a > peak ? a : peak;
+         peak = b > peak ? b : peak;
+      }
+      return peak <= 2 * level;
+   }
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "Buffer.hh"
 
 #include "Config.hh"
+#include "BufferCredit.hh"
 #include "BufferNone.hh"
 #include "BufferThreaded.hh"
 #include "BufferPoll.hh"
@@ -14,26 +15,50 @@
 using namespace asha;
 
 // Create the appropriate derived class based on the user config.
-std::shared_ptr<Buffer> Buffer::Create(const std::shared_ptr<DeviceInterface>& d)
+std::shared_ptr<Buffer> Buffer::Create(const std::shared_ptr<DeviceInterface>& d, Clock& clock)
 {
+   auto Depth = [](size_t fallback) -> size_t {
+      return Config::RingDepth() ? Config::RingDepth() : fallback;
+   };
    switch (Config::BufferAlgorithm())
    {
    case Config::NONE:
       g_info("Buffer Algorithm: NONE");
-      return std::make_shared<BufferNone>(d);
+      return std::make_shared<BufferNone>(d, clock);
    case Config::THREADED:
-      g_info("Buffer algorithm: THREADED");
-      return std::make_shared<BufferThreaded>(d);
+      g_info("Buffer algorithm: THREADED (%zu frames)", Depth(BufferThreaded::DEFAULT_DEPTH));
+      return std::make_shared<BufferThreaded>(d, Depth(BufferThreaded::DEFAULT_DEPTH), clock);
    case Config::POLL4:
-      g_info("Buffer algorithm: POLL4");
-      return std::make_shared<BufferPoll<4>>(d);
+      g_info("Buffer algorithm: POLL4 (%zu frames)", Depth(4));
+      return std::make_shared<BufferPoll>(d, Depth(4), clock);
    case Config::POLL8:
-      g_info("Buffer algorithm: POLL8");
-      return std::make_shared<BufferPoll<8>>(d);
+      g_info("Buffer algorithm: POLL8 (%zu frames)", Depth(8));
+      return std::make_shared<BufferPoll>(d, Depth(8), clock);
    case Config::TIMED:
       g_info("Buffer algorithm: TIMED");
-      return std::make_shared<BufferTimed>(d);
+      return std::make_shared<BufferTimed>(d, clock);
+   case Config::CREDIT:
+      g_info("Buffer algorithm: CREDIT (%u frames)", (unsigned)Config::CreditDepth());
+      return std::make_shared<BufferCredit>(d, Config::CreditDepth(), clock);
    default:
       throw std::logic_error("Missing buffer algorithm from factory.");
    }
+}
+
+
+void Buffer::OnMainLoop(unsigned interval_ms, std::function<bool(Buffer&)> fn)
+{
+   struct Callback
+   {
+      std::weak_ptr<Buffer> buffer;
+      std::function<bool(Buffer&)> fn;
+   };
+   g_timeout_add_full(G_PRIORITY_DEFAULT, interval_ms, [](gpointer data) -> gboolean {
+         auto* cb = (Callback*)data;
+         auto buffer = cb->buffer.lock();
+         return buffer && cb->fn(*buffer) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+      },
+      new Callback{weak_from_this(), std::move(fn)},
+      [](gpointer data) { delete (Callback*)data; }
+   );
 }
\ No newline at end of file
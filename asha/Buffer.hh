@@ -2,12 +2,15 @@
 
 
 #include "AudioPacket.hh"
+#include "BufferInterface.hh"
+#include "BufferStats.hh"
+#include "Clock.hh"
+#include "DeviceInterface.hh"
+#include "Ring.hh"
 
 #include <functional>
 #include <memory>
 
-class DeviceInterface;
-
 namespace asha
 {
 
@@ -15,34 +18,55 @@ namespace asha
 // The tested ASHA-enabled devices don't all respond equally well to the same
 // buffering algorithm. This is an abstract interface that allows us to
 // implement multiple algorithms under the hood.
-class Buffer
+class Buffer: public BufferInterface, public std::enable_shared_from_this<Buffer>
 {
 public:
    // Create a the appropriate derived class based on the user config.
-   static std::shared_ptr<Buffer> Create(const std::shared_ptr<DeviceInterface>& d);
+   static std::shared_ptr<Buffer> Create(const std::shared_ptr<DeviceInterface>& d, Clock& clock = Clock::System());
    virtual ~Buffer() { }
 
-   virtual RawS16* NextBuffer() = 0;
-   virtual void SendBuffer() = 0;
+   virtual RawS16* NextBuffer() override = 0;
+   virtual void SendBuffer() override = 0;
+   // A start that arrives while a stop is still draining cancels the stop.
    virtual void StreamStart() = 0;
    virtual void StreamStop() = 0;
+   // Roughly how much audio, in ns, this algorithm keeps queued ahead of
+   // the hearing devices.
+   virtual uint64_t Latency() const = 0;
 
-   size_t Occupancy() const { return m_occupancy; }
-   size_t OccupancyHigh() const { return m_high_occupancy; }
-   size_t RingDropped() const { return m_buffer_full; }
-   size_t FailedWrites() const { return m_failed_writes; }
-   size_t Silence() const { return m_silence; }
+   // Frames past the ring, waiting in the kernel for the slower side.
+   size_t DeviceQueued() const
+   {
+      auto device = m_device.lock();
+      return device ? device->QueuedFrames() : 0;
+   }
+   // Safe to call from any thread. The lateness is how late a paced
+   // delivery thread woke up for each packet, and is empty for algorithms
+   // that send from the pipewire thread.
+   BufferStats::Snapshot Stats() const { return m_stats.Read(); }
 
 protected:
-   Buffer(const std::shared_ptr<DeviceInterface>& d):m_device{d} {}
+   // depth is how many frames the ring holds between pipewire and the
+   // device. Algorithms that send straight away only need 1.
+   Buffer(const std::shared_ptr<DeviceInterface>& d, size_t depth, Clock& clock):
+      m_device{d}, m_clock{clock}, m_ring{depth} {}
+
+   // Frames of silence sent after the last of the audio when draining a
+   // stop, so the hearing devices don't cut off the end of it.
+   static constexpr size_t DRAIN_SILENCE = 3;
+
+   // Call fn from the glib main loop after interval_ms, and again every
+   // interval_ms for as long as it returns true. Dropped if the buffer goes
+   // away first. Safe to call from any thread.
+   void OnMainLoop(unsigned interval_ms, std::function<bool(Buffer&)> fn);
 
    std::weak_ptr<DeviceInterface> m_device;
+   Clock& m_clock;
+   // Pipewire's thread is the producer. The consumer is whatever sends to
+   // the device.
+   Ring<RawS16> m_ring;
 
-   size_t m_failed_writes = 0;
-   size_t m_occupancy = 0;
-   size_t m_high_occupancy = 0;
-   size_t m_silence = 0;
-   size_t m_buffer_full = 0;
+   BufferStats m_stats;
 };
 
 }
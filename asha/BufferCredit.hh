@@ -0,0 +1,176 @@
+#pragma once
+
+#include "AudioPacket.hh"
+#include "Buffer.hh"
+#include "DeviceInterface.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace asha
+{
+
+// Keeps the hearing device's own buffer at a target depth, instead of
+// relying on it holding the full ASHA_STREAM_DEPTH.
+//
+// The device takes one frame every 20ms, and gives back an L2CAP credit for
+// each one, so the depth can be estimated from what we sent and how long it
+// has been. The estimate is checked against the kernel send queue: frames
+// still waiting there a while after the last send mean the device ran out
+// of credits, so it is full.
+//
+// Frames are sent as they arrive from pipewire. If the estimate runs too far
+// ahead of the target, or the device is out of credits, the frame is
+// dropped. If it runs dry, silence is added to bring it back to the target.
+// Slow drift is left to pipewire's rate matching, which steers to the same
+// target. The estimate leans towards the device playing fast, so that any
+// drift ends with it full, where the send queue catches it, rather than
+// quietly running dry.
+class BufferCredit: public Buffer
+{
+public:
+   BufferCredit(const std::shared_ptr<DeviceInterface>& d, size_t target, Clock& clock = Clock::System()):
+      Buffer(d, 1, clock),
+      m_target{target}
+   {
+   }
+   virtual ~BufferCredit() override {}
+
+   virtual RawS16* NextBuffer() override { return m_ring.Claim(); }
+
+   virtual void SendBuffer() override
+   {
+      m_ring.Commit();
+      Deliver(m_ring.Peek());
+      m_ring.Pop();
+   }
+
+   virtual void StreamStart() override
+   {
+      auto device = m_device.lock();
+      if (device)
+         device->StreamStart();
+   }
+
+   virtual void StreamStop() override
+   {
+      auto device = m_device.lock();
+      if (device)
+         device->StreamStop();
+   }
+
+   virtual uint64_t Latency() const override { return m_target * ASHA_PACKET_TIME; }
+
+   // Steer the estimated depth on the device to the target.
+   virtual size_t Queued() const override
+   {
+      int64_t depth = Depth(m_clock.Now());
+      return depth > 0 ? depth : 0;
+   }
+   virtual size_t QueueTarget() const override { return m_target; }
+
+private:
+   // How far past the target the estimate may get before frames are
+   // dropped. A 1024 sample quantum at 48kHz delivers three frames at once.
+   static constexpr size_t SLACK = 3;
+   // A frame sent less than this long ago may still be on its way to the
+   // controller, even with credits to spare.
+   static constexpr uint64_t SETTLE = ASHA_PACKET_TIME / 4;
+   // The estimate assumes the device plays this much fast, 1/5000 or 200
+   // ppm, more than its clock should be off by. A device that is slower than
+   // that fills up, which the send queue shows. One that is faster would
+   // drain below the estimate, and nothing would show it until it ran dry.
+   static constexpr uint64_t FAST = 5000;
+
+   // Send, pad or drop one frame from pipewire.
+   void Deliver(const RawS16& samples)
+   {
+      static const RawS16 SILENCE{};
+      auto device = m_device.lock();
+      if (!device)
+         return;
+
+      // After a gap the device has played out everything we gave it.
+      uint64_t now = m_clock.Now();
+      if (m_stamp == 0 || now - m_stamp > ASHA_STREAM_DEPTH)
+         Anchor(now, 0);
+      m_stamp = now;
+
+      int64_t depth = Depth(now);
+      if (depth < 0)
+      {
+         // It ran dry. Start counting from empty again.
+         Anchor(now, 0);
+         depth = 0;
+      }
+      // Look at the queue now, rather than as it was right after the last
+      // send. That is the only time it is sampled otherwise, and a dropped
+      // frame doesn't send.
+      size_t queued = now - m_last_send >= SETTLE ? device->SampleQueuedFrames() : 0;
+      if (queued > 0)
+      {
+         // Out of credits, so the device is full and the rest is waiting in
+         // the kernel. Our clock has drifted from the device's, so trust this
+         // instead.
+         depth = ASHA_STREAM_DEPTH / ASHA_PACKET_TIME + queued;
+         Anchor(now, depth);
+      }
+      m_stats.Occupancy(depth > 0 ? depth : 0);
+
+      if (depth >= (int64_t)(m_target + SLACK))
+      {
+         // Too far ahead. One frame less brings the latency back down.
+         m_stats.RingDropped();
+         return;
+      }
+
+      if (depth < 1)
+      {
+         // About to run dry, so pad back up to the target. This frame makes
+         // up the last one.
+         for (int64_t i = depth + 1; i < (int64_t)m_target; ++i)
+         {
+            if (!Send(*device, SILENCE))
+               return;
+            m_stats.Silence();
+         }
+      }
+      Send(*device, samples);
+   }
+
+   void Anchor(uint64_t now, int64_t depth)
+   {
+      m_anchor = now;
+      m_anchor_depth = depth;
+      m_sent = 0;
+   }
+
+   // Frames the device still has to play, by our clock.
+   int64_t Depth(uint64_t now) const
+   {
+      uint64_t elapsed = now - m_anchor;
+      elapsed += elapsed / FAST;
+      return m_anchor_depth + (int64_t)m_sent - (int64_t)(elapsed / ASHA_PACKET_TIME);
+   }
+
+   bool Send(DeviceInterface& device, const RawS16& samples)
+   {
+      if (!device.SendAudio(samples))
+      {
+         m_stats.FailedWrite();
+         return false;
+      }
+      ++m_sent;
+      m_last_send = m_clock.Now();
+      return true;
+   }
+
+   const size_t m_target;
+   uint64_t m_stamp = 0;
+   uint64_t m_anchor = 0;
+   int64_t m_anchor_depth = 0;
+   size_t m_sent = 0;
+   uint64_t m_last_send = 0;
+};
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "AudioPacket.hh"
+
+// Bare interface to Buffer that can be used by the pipewire stream to write
+// audio straight into the buffer's storage.
+class BufferInterface
+{
+public:
+   virtual ~BufferInterface() = default;
+   // Claim the next free slot, or nullptr if there isn't one. The slot
+   // belongs to the caller until it calls SendBuffer().
+   virtual RawS16* NextBuffer() = 0;
+   // Commit the slot from NextBuffer().
+   virtual void SendBuffer() = 0;
+
+   // Frames committed but not yet sent, and the level the stream should
+   // steer that towards by rate matching. A target of 0 turns rate matching
+   // off. Both are called from the pipewire thread.
+   virtual size_t Queued() const { return 0; }
+   virtual size_t QueueTarget() const { return 0; }
+};
@@ -15,20 +15,24 @@ namespace asha
 class BufferNone: public Buffer
 {
 public:
-   BufferNone(const std::shared_ptr<DeviceInterface>& d):Buffer(d) {}
+   BufferNone(const std::shared_ptr<DeviceInterface>& d, Clock& clock = Clock::System()):Buffer(d, 1, clock) {}
    virtual ~BufferNone() override {}
 
-   virtual RawS16* NextBuffer() override { return &m_buffer; }
+   virtual RawS16* NextBuffer() override { return m_ring.Claim(); }
    virtual void SendBuffer() override
    {
+      m_ring.Commit();
       auto device = m_device.lock();
       if (device)
       {
-         if (!device->SendAudio(m_buffer))
-            ++m_failed_writes;
+         if (!device->SendAudio(m_ring.Peek()))
+            m_stats.FailedWrite();
       }
+      m_ring.Pop();
    }
 
+   virtual uint64_t Latency() const override { return 0; }
+
    virtual void StreamStart() override
    {
       auto device = m_device.lock();
@@ -46,9 +50,6 @@ public:
          device->StreamStop();
       }
    };
-
-private:
-   RawS16 m_buffer;
 };
 
 }
@@ -3,12 +3,14 @@
 
 #include "AudioPacket.hh"
 #include "Buffer.hh"
-#include "Now.hh"
 #include "DeviceInterface.hh"
 
 #include <cstddef>
 #include <cassert>
 #include <iostream>
+#include <mutex>
+
+#include <glib.h>
 
 namespace asha
 {
@@ -17,40 +19,44 @@ namespace asha
 // sending traffic until epoll says that there are no more slots ready.
 // This will rely on the socket's epoll to tell us if the sockets are in
 // sync, but it requires us to intentionally keep the audio latency high.
-template <size_t RING_SIZE>
+//
+// Pipewire stops calling us as soon as the stream stops, so a stop drains
+// what is left from a 20ms timer on the main loop before stopping the device.
+// Both the timer and pipewire's thread take the ring's consumer side then,
+// so each holds m_state_mutex around it. It is uncontended the rest of the
+// time.
 class BufferPoll: public Buffer
 {
 public:
-   static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
-   static_assert(RING_SIZE > 1, "RING_SIZE must be at least 2");
-
-   BufferPoll(const std::shared_ptr<DeviceInterface>& d): Buffer(d) {}
+   BufferPoll(const std::shared_ptr<DeviceInterface>& d, size_t depth, Clock& clock = Clock::System()):
+      Buffer(d, depth > 1 ? depth : 2, clock) {}
    virtual ~BufferPoll() override {}
 
    virtual RawS16* NextBuffer() override
    {
       if (!m_startup)
+      {
+         std::lock_guard<std::mutex> lock(m_state_mutex);
          Flush();
+      }
 
-      if (m_write - m_read >= RING_SIZE)
+      RawS16* slot = m_ring.Claim();
+      if (!slot)
       {
          assert(!m_startup);
-         ++m_buffer_full;
-         return nullptr;
+         m_stats.RingDropped();
       }
-      return &m_buffer[m_write & (RING_SIZE-1)];
+      return slot;
    }
 
    virtual void SendBuffer() override
    {
-      assert(m_write >= m_read);
-      assert(m_write < m_read + RING_SIZE);
       static const RawS16 SILENCE{};
-      ++m_write;
+      m_ring.Commit();
 
       // If we don't deliver any traffic for a while, kick back into startup
       // mode.
-      uint64_t t = Now();
+      uint64_t t = m_clock.Now();
       if (t - m_stamp > ASHA_STREAM_DEPTH)
          m_startup = true;
       m_stamp = t;
@@ -58,12 +64,13 @@ public:
       if (m_startup)
       {
          // Wait until the ring is full.
-         if (m_write - m_read < RING_SIZE)
+         if (m_ring.Size() < m_ring.Capacity())
             return;
 
          m_startup = false;
 
          // Now that the ring is full, flush 6 packets of silence.
+         std::lock_guard<std::mutex> lock(m_state_mutex);
          for (size_t i = 0; i < 6; ++i)
          {
             auto device = m_device.lock();
@@ -74,17 +81,24 @@ public:
             }
             else
                return;
-            ++m_silence;
+            m_stats.Silence();
          }
       }
    }
 
+   // The full ring, plus the silence sent at startup.
+   virtual uint64_t Latency() const override { return (m_ring.Capacity() + 6) * ASHA_PACKET_TIME; }
+
    virtual void StreamStart() override
    {
-      // TODO: If we have a pending stop waiting on buffered silence, maybe
-      //       clear out the silence, set m_startup = true, and cancel the
-      //       stop call?
-      if (!m_started)
+      std::lock_guard<std::mutex> lock(m_state_mutex);
+      if (m_draining)
+      {
+         // The device never stopped, so just carry on.
+         g_info("Stream restarted while draining");
+         m_draining = false;
+      }
+      else if (!m_started)
       {
          auto device = m_device.lock();
          if (device)
@@ -97,38 +111,87 @@ public:
 
    virtual void StreamStop() override
    {
-      // TODO: Put half a second of silence on the buffer, then don't actually
-      //       callstop until the buffer is empty? This implies that we have a
-      //       way to insert packets when Send/Next aren't getting called.
-      //       perhaps a new idle() method that gets called when there is no
-      //       traffic available?
-      if (m_started)
+      std::lock_guard<std::mutex> lock(m_state_mutex);
+      if (m_started && !m_draining)
       {
-         auto device = m_device.lock();
-         if (device)
+         g_info("Draining buffer before stopping");
+         m_draining = true;
+         m_drain_silence = 0;
+         m_drain_ticks = 0;
+         // A timer from a drain that was cancelled by StreamStart() may not
+         // have seen it yet. It carries on with this one.
+         if (!m_drain_scheduled)
          {
-            m_started = false;
-            device->StreamStop();
+            m_drain_scheduled = true;
+            OnMainLoop(ASHA_PACKET_TIME / 1000000, [](Buffer& b) {
+               return static_cast<BufferPoll&>(b).DrainTick();
+            });
          }
       }
    };
 
 private:
+   // Give up on a drain after a second. The device isn't taking audio, and
+   // it still needs to be stopped.
+   static constexpr size_t DRAIN_TICKS = 50;
+
+   // Send whatever the devices will take, then the silence, then stop.
+   // Returns false once there is nothing left to do.
+   bool DrainTick()
+   {
+      static const RawS16 SILENCE{};
+      std::lock_guard<std::mutex> lock(m_state_mutex);
+      if (!m_draining)
+      {
+         m_drain_scheduled = false;
+         return false;
+      }
+
+      auto device = m_device.lock();
+      if (!device)
+      {
+         m_draining = false;
+         m_drain_scheduled = false;
+         return false;
+      }
+
+      Flush();
+      while (m_ring.Available() == 0 && m_drain_silence < DRAIN_SILENCE)
+      {
+         if (!device->SendAudio(SILENCE))
+            break;
+         m_stats.Silence();
+         ++m_drain_silence;
+      }
+      bool done = m_ring.Available() == 0 && m_drain_silence >= DRAIN_SILENCE;
+      if (!done && ++m_drain_ticks < DRAIN_TICKS)
+         return true;
+      if (!done)
+      {
+         g_warning("Stopping without draining %zu frames, the device isn't taking them", m_ring.Available());
+         m_ring.Pop(m_ring.Available());
+      }
+
+      m_draining = false;
+      m_drain_scheduled = false;
+      m_started = false;
+      device->StreamStop();
+      return false;
+   }
+
    void Flush()
    {
-      m_occupancy = m_write - m_read;
-      if (m_occupancy > m_high_occupancy)
-         m_high_occupancy = m_occupancy;
+      m_stats.Occupancy(m_ring.Size());
 
       // Write however much traffic it lets you each time.
       auto device = m_device.lock();
       if (device)
       {
-         while (m_write > m_read)
+         while (m_ring.Available() > 0)
          {
-            if (!device->SendAudio(m_buffer[m_read & (RING_SIZE - 1)]))
+            if (!device->SendAudio(m_ring.Peek()))
                break;
-            ++m_read;
+            m_ring.Pop();
          }
       }
    }
@@ -138,9 +201,14 @@ private:
    bool m_started = true;
    uint64_t m_stamp = 0;
 
-   size_t m_read{};
-   size_t m_write{};
-   RawS16 m_buffer[RING_SIZE];
+   // Serializes start, stop, the drain timer, and sending from pipewire's
+   // thread.
+   std::mutex m_state_mutex;
+   bool m_draining = false;
+   // DrainTick() is on the main loop, whether or not it is still draining.
+   bool m_drain_scheduled = false;
+   size_t m_drain_silence = 0;
+   size_t m_drain_ticks = 0;
 };
 
 }
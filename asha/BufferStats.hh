@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Histogram.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace asha
+{
+
+// Counters kept by each buffer. Pipewire's thread and the delivery thread
+// update them on every frame while the main loop reads them, so everything
+// is a relaxed atomic. The counters only ever count up, and a reader gets
+// them all at once from Read().
+//
+// Aligned to its own cache lines, so that updating these doesn't pull the
+// ring indices away from the other thread.
+class alignas(64) BufferStats
+{
+public:
+   struct Snapshot
+   {
+      size_t occupancy = 0;      // Frames in the ring at the last look.
+      size_t high_occupancy = 0;
+      size_t ring_dropped = 0;   // Frames pipewire had no room for.
+      size_t failed_writes = 0;  // Frames the adapter wouldn't take.
+      size_t silence = 0;        // Frames of silence sent in place of audio.
+      Histogram occupancy_depth; // The occupancy at every look.
+      Histogram lateness;        // In microseconds.
+
+      // Combines two devices. The occupancy adds up, since both rings are
+      // holding audio, but the high water mark is the worst of the two.
+      Snapshot& operator+=(const Snapshot& other)
+      {
+         occupancy += other.occupancy;
+         high_occupancy = std::max(high_occupancy, other.high_occupancy);
+         ring_dropped += other.ring_dropped;
+         failed_writes += other.failed_writes;
+         silence += other.silence;
+         occupancy_depth.Merge(other.occupancy_depth);
+         lateness.Merge(other.lateness);
+         return *this;
+      }
+   };
+
+   // Call once per frame with the ring level.
+   void Occupancy(size_t frames)
+   {
+      m_occupancy.store(frames, std::memory_order_relaxed);
+      if (frames > m_high_occupancy.load(std::memory_order_relaxed))
+         m_high_occupancy.store(frames, std::memory_order_relaxed);
+      m_occupancy_depth.Add(frames);
+   }
+   void RingDropped(size_t frames = 1) { m_ring_dropped.fetch_add(frames, std::memory_order_relaxed); }
+   void FailedWrite() { m_failed_writes.fetch_add(1, std::memory_order_relaxed); }
+   void Silence(size_t frames = 1) { m_silence.fetch_add(frames, std::memory_order_relaxed); }
+   void Late(uint64_t us) { m_lateness.Add(us); }
+
+   Snapshot Read() const
+   {
+      Snapshot s;
+      s.occupancy = m_occupancy.load(std::memory_order_relaxed);
+      s.high_occupancy = m_high_occupancy.load(std::memory_order_relaxed);
+      s.ring_dropped = m_ring_dropped.load(std::memory_order_relaxed);
+      s.failed_writes = m_failed_writes.load(std::memory_order_relaxed);
+      s.silence = m_silence.load(std::memory_order_relaxed);
+      s.occupancy_depth.Merge(m_occupancy_depth);
+      s.lateness.Merge(m_lateness);
+      return s;
+   }
+
+private:
+   // Only the consumer side of the ring sets the occupancy.
+   std::atomic<size_t> m_occupancy{0};
+   std::atomic<size_t> m_high_occupancy{0};
+   // Both sides can drop frames.
+   std::atomic<size_t> m_ring_dropped{0};
+   std::atomic<size_t> m_failed_writes{0};
+   std::atomic<size_t> m_silence{0};
+   Histogram m_occupancy_depth;
+   Histogram m_lateness;
+};
+
+}
@@ -1,14 +1,23 @@
 #include "BufferThreaded.hh"
 
 #include "AudioPacket.hh"
+#include "Config.hh"
 #include "DeviceInterface.hh"
+#include "RtLog.hh"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <functional>
 #include <thread>
 
+#include <gio/gio.h>
 #include <glib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 using namespace asha;
 
@@ -16,16 +25,81 @@ namespace
 {
    const RawS16 SILENCE = {};
 
-   uint64_t Now()
+   // rtkit's default ceiling.
+   constexpr int RT_PRIORITY = 20;
+
+   // Samples this close to zero still count as silence, so that dither
+   // doesn't keep the stream running.
+   constexpr uint16_t SILENCE_LEVEL = 8;
+   // How long to hold the pre-roll for the device to restart.
+   constexpr uint64_t RESUME_TIMEOUT = 1000000000;
+   // Once it has, how long to wait for silence to skip before dropping
+   // audio to get back down to the depth.
+   constexpr uint64_t CATCH_UP_TIMEOUT = 10000000000;
+
+   // Room for the depth, and for the audio that arrives while the device
+   // restarts when it can be stopped for being idle.
+   size_t RingSize(size_t depth)
+   {
+      return Config::IdleTimeout() ? depth + RESUME_TIMEOUT / ASHA_PACKET_TIME : depth;
+   }
+
+   // Put the calling thread under SCHED_FIFO. Try it ourselves first, which
+   // works with CAP_SYS_NICE or an rtprio limit, then ask rtkit the way
+   // pipewire does.
+   void MakeRealtime()
    {
-      struct timespec ts;
-      clock_gettime(CLOCK_MONOTONIC, &ts);
-      return ts.tv_sec * 1000000000 + ts.tv_nsec;
+      sched_param param{};
+      param.sched_priority = RT_PRIORITY;
+      if (0 == pthread_setschedparam(pthread_self(), SCHED_FIFO | SCHED_RESET_ON_FORK, &param))
+      {
+         RtLog::Info("Delivery thread running with SCHED_FIFO");
+         return;
+      }
+
+      // rtkit won't help a process that could spin forever at realtime
+      // priority, so it needs a cpu time limit. 200ms is what pipewire uses.
+      rlimit limit{};
+      if (0 == getrlimit(RLIMIT_RTTIME, &limit) && (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > 200000))
+      {
+         limit.rlim_cur = limit.rlim_max = 200000;
+         setrlimit(RLIMIT_RTTIME, &limit);
+      }
+
+      GError* err = nullptr;
+      GDBusConnection* bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &err);
+      if (bus)
+      {
+         GVariant* ret = g_dbus_connection_call_sync(bus,
+            "org.freedesktop.RealtimeKit1",
+            "/org/freedesktop/RealtimeKit1",
+            "org.freedesktop.RealtimeKit1",
+            "MakeThreadRealtime",
+            g_variant_new("(tu)", (guint64)syscall(SYS_gettid), (guint32)RT_PRIORITY),
+            nullptr,
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            nullptr,
+            &err
+         );
+         if (ret)
+            g_variant_unref(ret);
+         g_object_unref(bus);
+      }
+
+      if (err)
+      {
+         RtLog::Warning("Unable to get realtime priority for the delivery thread: %s", err->message);
+         g_error_free(err);
+      }
+      else
+         RtLog::Info("Delivery thread running with SCHED_FIFO from rtkit");
    }
 }
 
-BufferThreaded::BufferThreaded(const std::shared_ptr<DeviceInterface>& d):
-   Buffer(d)
+BufferThreaded::BufferThreaded(const std::shared_ptr<DeviceInterface>& d, size_t depth, Clock& clock):
+   Buffer(d, RingSize(depth > 1 ? depth : 2), clock),
+   m_depth{depth > 1 ? depth : 2}
 {
 }
 
@@ -42,6 +116,7 @@ BufferThreaded::~BufferThreaded()
 
 void BufferThreaded::StreamStart()
 {
+   std::lock_guard<std::mutex> lock(m_state_mutex);
    if (!m_running)
    {
       auto device = m_device.lock();
@@ -51,11 +126,69 @@ void BufferThreaded::StreamStart()
          Start();
       }
    }
+   else if (m_drain.exchange(STREAMING) != STREAMING)
+      g_info("Stream restarted while draining");
 }
 
 void BufferThreaded::StreamStop()
 {
-   // Ignore. We only stop the stream when we quit.
+   // Let the delivery thread send what is left, then stop.
+   std::lock_guard<std::mutex> lock(m_state_mutex);
+   if (m_running)
+   {
+      g_info("Draining buffer before stopping");
+      m_drain = DRAINING;
+   }
+}
+
+void BufferThreaded::Drained()
+{
+   std::lock_guard<std::mutex> lock(m_state_mutex);
+   if (m_drain != DRAINED)
+      return; // Restarted in the meantime.
+   Stop();
+   m_drain = STREAMING;
+   auto device = m_device.lock();
+   if (device && !m_device_stopped)
+      device->StreamStop();
+   m_device_stopped = false;
+}
+
+void BufferThreaded::Idle()
+{
+   std::lock_guard<std::mutex> lock(m_state_mutex);
+   if (!m_running || m_device_stopped || m_drain != STREAMING)
+      return;
+   auto device = m_device.lock();
+   if (device)
+   {
+      device->StreamStop();
+      m_device_stopped = true;
+   }
+}
+
+void BufferThreaded::Wake()
+{
+   std::lock_guard<std::mutex> lock(m_state_mutex);
+   if (!m_device_stopped)
+      return;
+   m_device_stopped = false;
+   auto device = m_device.lock();
+   if (device)
+      device->StreamStart();
+}
+
+// From the delivery thread, once everything has been sent.
+void BufferThreaded::FinishDrain()
+{
+   int expected = DRAINING;
+   if (m_drain.compare_exchange_strong(expected, DRAINED))
+   {
+      OnMainLoop(0, [](Buffer& b) {
+         static_cast<BufferThreaded&>(b).Drained();
+         return false;
+      });
+   }
 }
 
 void BufferThreaded::Start()
@@ -64,6 +197,12 @@ void BufferThreaded::Start()
    {
       g_info("Starting asynchronous buffer thread");
       m_startup = true;
+      m_drain = STREAMING;
+      m_idle = false;
+      m_silent_frames = 0;
+      m_resume = 0;
+      m_catch_up = 0;
+      m_idle_frames = Config::IdleTimeout() * 1000000000ull / ASHA_PACKET_TIME;
       m_running = true;
       m_thread = std::thread(&BufferThreaded::DeliveryThread, this);
       pthread_setname_np(m_thread.native_handle(), "buffer_encode");
@@ -85,121 +224,204 @@ void BufferThreaded::Stop()
 
 RawS16* BufferThreaded::NextBuffer()
 {
-   // ...RxxW...
-   size_t idx = m_write.load(std::memory_order_relaxed);
-   size_t read = m_read.load(std::memory_order_acquire);
-
-   if (idx - read >= RING_SIZE)
-   {
-      __atomic_fetch_add(&m_buffer_full, 1, __ATOMIC_RELAXED);
-      return nullptr;
-   }
-   return &m_buffer[idx & (RING_SIZE-1)];
+   RawS16* slot = m_ring.Claim();
+   if (!slot)
+      m_stats.RingDropped();
+   return slot;
 }
 
 void BufferThreaded::SendBuffer()
 {
-   assert(m_write >= m_read);
-   assert(m_write < m_read + RING_SIZE);
-   ++m_write;
+   m_ring.Commit();
 }
 
 
 void BufferThreaded::DeliveryThread()
 {
-   // Need to deliver a packet every 20 ms. Wake up every 5 ms and check for
-   // one.
-   static const struct timespec SLEEP_INTERVAL{0, 5000000};
-   static constexpr uint64_t INTERVAL = 20000000;
-   uint64_t next = Now() + INTERVAL;
+   if (Config::Realtime())
+      MakeRealtime();
+
+   // Need to deliver a packet every 20 ms. Sleep until an absolute deadline
+   // so that the spacing doesn't drift with how long each send takes.
+   // While starting up, check every 5 ms for the ring to fill.
+   static constexpr uint64_t INTERVAL = ASHA_PACKET_TIME;
+   static constexpr uint64_t STARTUP_INTERVAL = ASHA_PACKET_TIME / 4;
+   uint64_t next = m_clock.Now() + INTERVAL;
    while (m_running)
    {
-      uint64_t now = Now();
+      m_clock.SleepUntil(next);
+      if (!m_running)
+         break;
+
+      // If we fell behind, the loop runs back to back until it catches up,
+      // so each late packet is counted.
+      uint64_t now = m_clock.Now();
       if (now > next)
+         m_stats.Late((now - next) / 1000);
+      bool draining = m_drain.load(std::memory_order_relaxed) == DRAINING;
+
+      size_t available = m_ring.Available();
+      m_stats.Occupancy(available);
+
+      if (m_idle)
+      {
+         // The device is stopped. Throw the silence away as it arrives, and
+         // wake up on the first frame that isn't.
+         while (available > 0 && m_ring.Peek().IsSilent(SILENCE_LEVEL))
+         {
+            m_ring.Pop();
+            --available;
+         }
+         if (draining)
+            FinishDrain(); // There is nothing to send, and the device is already stopped.
+         if (draining || available == 0)
+         {
+            next += INTERVAL;
+            continue;
+         }
+
+         RtLog::Info("Audio resumed, restarting the stream");
+         m_idle = false;
+         m_silent_frames = 0;
+         m_startup = true;
+         m_resume = now;
+         OnMainLoop(0, [](Buffer& b) {
+            static_cast<BufferThreaded&>(b).Wake();
+            return false;
+         });
+         next = now + STARTUP_INTERVAL;
+         continue;
+      }
+
+      bool silent = true;
+      if (available > 0)
       {
-         // ...RxxW...
-         size_t idx = m_read.load(std::memory_order_relaxed);
-         size_t write = m_write.load(std::memory_order_acquire);
-         m_occupancy = write - idx;
-         if (m_occupancy > m_high_occupancy)
-            m_high_occupancy = m_occupancy;
-         if (write > idx)
+         // Make sure we fill up our ring before starting, so that we can
+         // fill the buffers on the hearing devices. When draining, send
+         // whatever made it in.
+         if (m_startup)
          {
-            // Make sure we fill up our ring at least halfway before
-            // starting, so that we can fill the buffers on the hearing
-            // devices.
-            if (m_startup)
+            if (available < m_depth && !draining)
+            {
+               next = now + STARTUP_INTERVAL;
+               continue;
+            }
+            m_startup = false;
+            silent = false;
+            // Flush up to the depth to start up. Anything past it is left
+            // to catch up on below.
+            auto device = m_device.lock();
+            size_t preroll = std::min(available, m_depth);
+            size_t sent = 0;
+            if (device)
             {
-               if (m_occupancy < RING_SIZE)
-                  continue;
-               m_startup = false;
-               // Flush all available packets to start up.
-               auto device = m_device.lock();
-               if (device)
+               for (; sent < preroll; ++sent)
                {
-                  for (; idx < write; ++idx)
+                  if (!device->SendAudio(m_ring.Peek(sent)))
                   {
-                     auto& buffer = m_buffer[idx & (RING_SIZE-1)];
-                     
-                     if (device->SendAudio(buffer))
+                     // Coming back from idle, the device takes a moment to
+                     // start. Hold on to the pre-roll until it does.
+                     if (m_resume && sent == 0 && now - m_resume < RESUME_TIMEOUT)
                      {
-                        ++m_failed_writes;
-                        if (write > idx + 1)
-                           __atomic_fetch_add(&m_buffer_full, 1, __ATOMIC_RELAXED);
+                        m_startup = true;
                         break;
                      }
+                     m_stats.FailedWrite();
+                     if (available > sent + 1)
+                        m_stats.RingDropped();
+                     break;
                   }
                }
-               m_read = idx;
             }
-            else
+            m_ring.Pop(sent);
+            if (!m_startup && m_resume)
             {
-               auto device = m_device.lock();
-               if (device)
-               {
-                  auto& buffer = m_buffer[idx & (RING_SIZE-1)];
-                  if (!device->SendAudio(buffer))
-                  {
-                     ++m_failed_writes;
-                     // If we failed to send a packet, drop an extra from input
-                     if (write > idx + 1)
-                     {
-                        ++m_read;
-                        __atomic_fetch_add(&m_buffer_full, 1, __ATOMIC_RELAXED);
-                     }
-                  }
-                  ++m_read;
-               }
+               m_resume = 0;
+               m_catch_up = now + CATCH_UP_TIMEOUT;
             }
+            // Start the 20ms cadence from the flush.
+            next = now;
          }
          else
          {
-            // Buffer was empty. This isn't necessarily unexpected, as
-            // pipewire will stop streaming data if nobody is producing it.
-            // TODO: should we continue to stream silence? My hearing aids
-            //       tend to shut off one side for some reason if there is
-            //       no more data, and then it takes it about a second to
-            //       start playing data again when it arrives, leaving gaps
-            //       in the audio. Its also possible that we have somehow
-            //       overtaken pipewire, and it may be better to just skip
-            //       the packet to allow the hearing devices to drain their
-            //       buffers and catch up.
+            // Past the depth is what built up while the device restarted.
+            // Skip the silence in it, so that nothing is lost that can be
+            // heard. If there isn't any for a while, drop the oldest.
+            if (available > m_depth)
+            {
+               size_t skip = 0;
+               if (now < m_catch_up)
+               {
+                  while (available - skip > m_depth && m_ring.Peek(skip).IsSilent(SILENCE_LEVEL))
+                     ++skip;
+               }
+               else
+               {
+                  skip = available - m_depth;
+                  m_stats.RingDropped(skip);
+               }
+               m_ring.Pop(skip);
+               available -= skip;
+            }
+            else
+               m_catch_up = 0;
+
             auto device = m_device.lock();
             if (device)
             {
-               if (!device->SendAudio(SILENCE))
-                  ++m_failed_writes;
-               ++m_silence;
+               auto& buffer = m_ring.Peek();
+               silent = buffer.IsSilent(SILENCE_LEVEL);
+               size_t used = 1;
+               if (!device->SendAudio(buffer))
+               {
+                  m_stats.FailedWrite();
+                  // If we failed to send a packet, drop an extra from input
+                  if (available > 1)
+                  {
+                     ++used;
+                     m_stats.RingDropped();
+                  }
+               }
+               m_ring.Pop(used);
             }
          }
-         next += INTERVAL;
       }
       else
       {
-         // Try and sleep until the next packet is needed. If this sleep
-         // isn't reliable enough, we can switch to sleeping for 5ms or so.
-         struct timespec sleep_interval {0, (uint32_t)(next - now)};
-         nanosleep(&SLEEP_INTERVAL, nullptr);
+         // Buffer was empty. This isn't necessarily unexpected, as
+         // pipewire will stop streaming data if nobody is producing it.
+         // Keep the stream running with silence, since my hearing aids
+         // tend to shut off one side if there is no more data, and then
+         // take about a second to start playing again.
+         auto device = m_device.lock();
+         if (device)
+         {
+            if (!device->SendAudio(SILENCE))
+               m_stats.FailedWrite();
+            m_stats.Silence();
+         }
+
+         // Once a drain has sent everything, and the silence after it,
+         // hand the stop over to the main loop.
+         if (draining && ++m_drain_silence >= DRAIN_SILENCE)
+            FinishDrain();
+      }
+      if (!draining)
+         m_drain_silence = 0;
+
+      // Nobody is listening to silence, so stop the device until there is
+      // something to hear.
+      if (!silent)
+         m_silent_frames = 0;
+      else if (m_idle_frames && !draining && ++m_silent_frames >= m_idle_frames)
+      {
+         RtLog::Info("Nothing but silence for %u seconds, stopping the stream", (unsigned)Config::IdleTimeout());
+         m_idle = true;
+         OnMainLoop(0, [](Buffer& b) {
+            static_cast<BufferThreaded&>(b).Idle();
+            return false;
+         });
       }
+      next += INTERVAL;
    }
 }
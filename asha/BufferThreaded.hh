@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <cassert>
+#include <mutex>
 #include <thread>
 
 namespace asha
@@ -18,10 +19,23 @@ namespace asha
 // write a packet, then we will drop a frame from both sides to try and let it
 // catch up. If there is no packet ready, then we will write silence to keep
 // the stream running.
+//
+// Stopping drains the ring on the same 20ms cadence, followed by a little
+// silence, before the device is stopped from the main loop. Starting again
+// before then just carries on.
+//
+// After Config::IdleTimeout() seconds of nothing but silence, the device is
+// stopped to save the hearing devices' batteries, while this keeps watching
+// the ring. The first frame with sound in it starts the device again, and is
+// held in the ring until the device takes it. The ring has room for a
+// second of audio past the depth for that, and once the device is playing
+// again, silence is skipped to get back down to the depth.
 class BufferThreaded: public Buffer
 {
 public:
-   BufferThreaded(const std::shared_ptr<DeviceInterface>& d);
+   static constexpr size_t DEFAULT_DEPTH = 4;
+
+   BufferThreaded(const std::shared_ptr<DeviceInterface>& d, size_t depth = DEFAULT_DEPTH, Clock& clock = Clock::System());
    virtual ~BufferThreaded() override;
 
    void Start();
@@ -30,26 +44,44 @@ public:
    virtual void SendBuffer() override;
    virtual void StreamStart() override;
    virtual void StreamStop() override;
+   // The ring is filled to the depth before delivery starts.
+   virtual uint64_t Latency() const override { return m_depth * ASHA_PACKET_TIME; }
+   // The delivery thread runs on its own 20ms timer, so the ring level is
+   // the drift between it and the pipewire graph. Keep it half full.
+   virtual size_t Queued() const override { return m_ring.Size(); }
+   virtual size_t QueueTarget() const override { return m_depth / 2; }
 
 protected:
    void DeliveryThread();
 
 private:
+   enum DrainState { STREAMING, DRAINING, DRAINED };
+
+   // Called on the main loop once the drain has finished.
+   void Drained();
+   // Called on the main loop to stop and restart the device when idle.
+   void Idle();
+   void Wake();
+   void FinishDrain();
+
+   // Frames kept ahead of the device. The ring can hold more, for a resume.
+   const size_t m_depth;
+
+   std::mutex m_state_mutex; // Serializes start, stop and Drained().
+   std::atomic<int> m_drain{STREAMING};
+   size_t m_drain_silence = 0;
+   bool m_device_stopped = false; // By Idle(), under m_state_mutex.
+
+   // Only used by the delivery thread.
+   bool m_idle = false;
+   size_t m_idle_frames = 0;
+   size_t m_silent_frames = 0;
+   uint64_t m_resume = 0;
+   uint64_t m_catch_up = 0; // Skip silence past the depth until then.
+
    bool m_startup = true;
    volatile bool m_running = false;
    std::thread m_thread;
-
-   // Use padding to force reader/writer vars to be on their own cache lines.
-   uint8_t m_padding0[64 - 4 * sizeof(std::atomic<size_t>)];
-   std::atomic<size_t> m_read{};
-   uint8_t m_padding1[64 - 2 * sizeof(std::atomic<size_t>)];
-   std::atomic<size_t> m_write{};
-   uint8_t m_padding2[64];
-
-   static constexpr size_t RING_SIZE = 4;
-   static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
-   static_assert(RING_SIZE > 1, "RING_SIZE must be at least 2");
-   RawS16 m_buffer[RING_SIZE];
 };
 
 }
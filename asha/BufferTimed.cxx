@@ -1,5 +1,4 @@
 #include "BufferTimed.hh"
-#include "Now.hh"
 #include "DeviceInterface.hh"
 
 using namespace asha;
@@ -11,7 +10,14 @@ namespace
 
 void BufferTimed::SendBuffer()
 {
-   uint64_t t = Now();
+   m_ring.Commit();
+   Send(m_ring.Peek());
+   m_ring.Pop();
+}
+
+void BufferTimed::Send(const RawS16& samples)
+{
+   uint64_t t = m_clock.Now();
    auto device = m_device.lock();
    if (device)
    {
@@ -22,15 +28,15 @@ void BufferTimed::SendBuffer()
          for (size_t i = 0; i < 6; ++i)
          {
             if (device->SendAudio(SILENCE))
-               ++m_silence;
+               m_stats.Silence();
             else
                break;
          }
       }
       m_stamp = t;
 
-      if (!device->SendAudio(m_buffer))
-         ++m_failed_writes;
+      if (!device->SendAudio(samples))
+         m_stats.FailedWrite();
    }
 }
 
@@ -15,16 +15,19 @@ namespace asha
 class BufferTimed: public Buffer
 {
 public:
-   BufferTimed(const std::shared_ptr<DeviceInterface>& d):Buffer(d) {}
+   BufferTimed(const std::shared_ptr<DeviceInterface>& d, Clock& clock = Clock::System()):Buffer(d, 1, clock) {}
    virtual ~BufferTimed() override {}
 
-   virtual RawS16* NextBuffer() override { return &m_buffer; }
+   virtual RawS16* NextBuffer() override { return m_ring.Claim(); }
    virtual void SendBuffer() override;
    virtual void StreamStart() override;
    virtual void StreamStop() override;
+   // The silence sent whenever the stream restarts.
+   virtual uint64_t Latency() const override { return 6 * ASHA_PACKET_TIME; }
 
 private:
-   RawS16 m_buffer;
+   void Send(const RawS16& samples);
+
    uint64_t m_stamp = 0;
 };
 
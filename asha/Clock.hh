@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Now.hh"
+
+#include <cerrno>
+#include <cstdint>
+#include <time.h>
+
+namespace asha
+{
+
+// Where the buffers get the time from, and how a delivery thread waits for
+// its next deadline. Normally the monotonic clock, but buffer_sim swaps in a
+// simulated one so the algorithms can be run faster than real time.
+class Clock
+{
+public:
+   virtual ~Clock() = default;
+
+   // Nanoseconds, on the same base as ::Now().
+   virtual uint64_t Now() const { return ::Now(); }
+
+   // Block until Now() reaches the deadline.
+   virtual void SleepUntil(uint64_t deadline) const
+   {
+      struct timespec ts{(time_t)(deadline / 1000000000), (long)(deadline % 1000000000)};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+         ;
+   }
+
+   static Clock& System()
+   {
+      static Clock s_clock;
+      return s_clock;
+   }
+};
+
+}
@@ -10,6 +10,12 @@ using namespace asha;
 // Default values defined here.
 std::string Config::s_prog_name = "asha_pipewire_sink";
 Config::BufferAlgorithmEnum Config::s_buffer_algorithm = Config::THREADED;
+uint8_t Config::s_credit_depth = 3;  // Frames kept on the device by the credit buffer
+uint8_t Config::s_ring_depth = 0;    // Frames in the poll and threaded rings, 0 for the algorithm's own
+uint16_t Config::s_idle_timeout = 30; // Seconds of silence before the stream stops, 0 to never stop
+uint16_t Config::s_metrics_interval = 1000; // ms between metrics updates on dbus, 0 to not publish them
+uint16_t Config::s_flight_recorder = 0;        // KB of HCI traffic to keep for dumps, 0 to not record
+uint16_t Config::s_flight_recorder_drops = 5;  // Dropped frames in a second that trigger a dump
 uint16_t Config::s_interval = 16;   // Units of 1.25 ms
 uint16_t Config::s_timeout = 100;   // Units of 10 ms
 uint16_t Config::s_celength = 12;   // Units of 0.625ms
@@ -20,6 +26,9 @@ uint8_t Config::s_right_microphone = 0;
 bool Config::s_phy1m = false;
 bool Config::s_phy2m = false;
 bool Config::s_reconnect = false;
+bool Config::s_realtime = false;
+bool Config::s_io_uring = false;
+bool Config::s_airtime = false;
 bool Config::s_modified = false;
 int16_t Config::s_rssi_paired = 0;
 int16_t Config::s_rssi_unpaired = 0;
@@ -28,7 +37,7 @@ int16_t Config::s_rssi_unpaired = 0;
 std::string Config::s_description = "Implementation of ASHA streaming protocol for pipewire.";
 std::map<std::string, Config::ExtraOption> Config::s_extra;
 
-static const char* BUFFER_ALGORITHM_ENUM_STR[] = {"none", "threaded", "poll4", "poll8", "timed"};
+static const char* BUFFER_ALGORITHM_ENUM_STR[] = {"none", "threaded", "poll4", "poll8", "timed", "credit"};
 static_assert(sizeof(BUFFER_ALGORITHM_ENUM_STR) / sizeof(*BUFFER_ALGORITHM_ENUM_STR) == Config::BufferAlgorithmEnum::BUFFER_ALGORITHM_ENUM_SIZE);
 
 
@@ -69,6 +78,12 @@ void Config::Write(std::ostream& out)
    {
       out << "buffer_algorithm " << BUFFER_ALGORITHM_ENUM_STR[s_buffer_algorithm] << '\n';
    }
+   out << "credit_depth " << (unsigned)s_credit_depth << '\n';
+   out << "ring_depth " << (unsigned)s_ring_depth << '\n';
+   out << "idle_timeout " << s_idle_timeout << '\n';
+   out << "metrics_interval " << s_metrics_interval << '\n';
+   out << "flight_recorder " << s_flight_recorder << '\n';
+   out << "flight_recorder_drops " << s_flight_recorder_drops << '\n';
    out << "left_volume " << (int)s_left_volume << '\n';
    out << "right_volume " << (int)s_right_volume << '\n';
    out << "left_microphone " << (unsigned)s_left_microphone << '\n';
@@ -82,6 +97,12 @@ void Config::Write(std::ostream& out)
       out << "phy1m\n";
    if (s_reconnect)
       out << "reconnect\n";
+   if (s_realtime)
+      out << "realtime\n";
+   if (s_io_uring)
+      out << "io_uring\n";
+   if (s_airtime)
+      out << "airtime\n";
    out << "rssi_paired " << s_rssi_paired << '\n';
    out << "rssi_unpaired " << s_rssi_unpaired << '\n';
    for (auto& kv: s_extra)
@@ -137,13 +158,27 @@ void Config::HelpAndExit(const std::string& error)
    std::cout << s_description << '\n'
              << "Usage: " << s_prog_name << " [options]\n"
              << "Options:\n"
-             << "  --buffer_algorithm   One of (none, threaded, poll4, poll8, timed)\n"
+             << "  --buffer_algorithm   One of (none, threaded, poll4, poll8, timed, credit)\n"
              << "                       [Default: threaded]\n"
+             << "  --credit_depth       Frames the credit buffer keeps queued on the device,\n"
+             << "                       from 1 to 8 [Default: 3]\n"
+             << "  --ring_depth         Frames held by the poll and threaded buffers, up to\n"
+             << "                       64, or 0 for the algorithm's own [Default: 0]\n"
+             << "  --idle_timeout       Seconds of silence before the threaded buffer stops\n"
+             << "                       the stream to save battery, 0 to keep it running\n"
+             << "                       [Default: 30]\n"
+             << "  --metrics_interval   Milliseconds between updates of the metrics published\n"
+             << "                       on the session bus, 0 to not publish them\n"
+             << "                       [Default: 1000]\n"
              << "  --volume             Stream volume from -128 to 0 [Default: -64]\n"
              // This doesn't work right.
              // << "  --reconnect          Enable the auto-reconnection mechanism. This uses the\n"
              // << "                       bluez gatt profile registration to auto-reconnect, which\n"
              // << "                       may require a bluetoothd restart to disable.\n"
+             << "  --realtime           Run the threaded buffer's delivery thread with SCHED_FIFO,\n"
+             << "                       asking rtkit if we aren't allowed to do it ourselves.\n"
+             << "  --io_uring           Send each frame to both sides with one io_uring\n"
+             << "                       submission, if the kernel allows it.\n"
              << "  --rssi_paired        Minimum rssi from (-127 to -1, 0 to disable) which will\n"
              << "                       trigger a reconnection for a previously paired asha\n"
              << "                       device. A value around -80 should work for normal use.\n"
@@ -181,6 +216,17 @@ void Config::HelpAndExit(const std::string& error)
              << "  --phy2m              Request 2M PHY. Better battery life, shorter bursts work\n"
              << "                       better in busy bluetooth environments. [Default enabled\n"
              << "                       for kernel 6.8 or newer if the peripheral supports it]\n"
+             << "  --flight_recorder    KB of recent HCI traffic to keep in memory. When frames\n"
+             << "                       are dropped, a write fails or a side disconnects, it is\n"
+             << "                       written as a btsnoop file to ~/.cache/asha. Streaming\n"
+             << "                       takes about 20 KB a second. 0 to not record. [Default 0]\n"
+             << "  --flight_recorder_drops\n"
+             << "                       Frames dropped within a second that trigger a dump.\n"
+             << "                       Frames held back for a full socket still play, so\n"
+             << "                       they don't count. 0 to ignore drops. [Default 5]\n"
+             << "  --airtime            Follow every connection's traffic on each controller, to\n"
+             << "                       publish the airtime metrics. This puts the controllers'\n"
+             << "                       raw sockets in promiscuous mode. [Default disabled]\n"
              ;
 
    std::exit(1);
@@ -229,14 +275,16 @@ bool Config::SetConfigItem(const std::string& key, const std::string& value)
 bool Config::SetConfigItem(const std::string& key, const BufferAlgorithmEnum& value)
 {
    if (value < BUFFER_ALGORITHM_ENUM_SIZE)
-      return SetConfigItem(key, BUFFER_ALGORITHM_ENUM_STR[value]);
+      return SetConfigItem(key, std::string(BUFFER_ALGORITHM_ENUM_STR[value]));
 
    return false;
 }
 
 bool Config::SetConfigItem(const std::string& key, bool value)
 {
-   return SetConfigItem(key, value ? "true" : "false");
+   // Without the std::string, the literal converts to bool and this calls
+   // itself.
+   return SetConfigItem(key, std::string(value ? "true" : "false"));
 }
 
 void Config::ParseConfigItem(const std::string& key, const std::string& value)
@@ -291,9 +339,23 @@ void Config::ParseConfigItem(const std::string& key, const std::string& value)
          s_buffer_algorithm = POLL8;
       else if (value == "timed")
          s_buffer_algorithm = TIMED;
+      else if (value == "credit")
+         s_buffer_algorithm = CREDIT;
       else
          throw std::runtime_error("Unknown buffer algorithm");
    }
+   else if (key == "credit_depth")
+      s_credit_depth = ReadInt(1, 8);
+   else if (key == "ring_depth")
+      s_ring_depth = ReadInt(0, 64);
+   else if (key == "idle_timeout")
+      s_idle_timeout = ReadInt(0, 3600);
+   else if (key == "metrics_interval")
+      s_metrics_interval = ReadInt(0, 60000);
+   else if (key == "flight_recorder")
+      s_flight_recorder = ReadInt(0, 16384);
+   else if (key == "flight_recorder_drops")
+      s_flight_recorder_drops = ReadInt(0, 1000);
    else if (key == "volume")
       s_left_volume = s_right_volume = ReadInt(-128, 0);
    else if (key == "left_volume")
@@ -316,6 +378,12 @@ void Config::ParseConfigItem(const std::string& key, const std::string& value)
       s_phy1m = ReadBool();
    else if (key == "reconnect")
       s_reconnect = ReadBool();
+   else if (key == "realtime")
+      s_realtime = ReadBool();
+   else if (key == "io_uring")
+      s_io_uring = ReadBool();
+   else if (key == "airtime")
+      s_airtime = ReadBool();
    else if (key == "rssi_paired")
       s_rssi_paired = ReadInt(-127, 0);
    else if (key == "rssi_unpaired")
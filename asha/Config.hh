@@ -21,8 +21,14 @@ public:
    static void AddExtraFlagOption(const std::string& name, const std::string& description);
    static void SetHelpDescription(const std::string& s) { s_description = s; }
 
-   enum BufferAlgorithmEnum { NONE, THREADED, POLL4, POLL8, TIMED, BUFFER_ALGORITHM_ENUM_SIZE };
+   enum BufferAlgorithmEnum { NONE, THREADED, POLL4, POLL8, TIMED, CREDIT, BUFFER_ALGORITHM_ENUM_SIZE };
    static BufferAlgorithmEnum BufferAlgorithm() { return s_buffer_algorithm; }
+   static uint8_t CreditDepth() { return s_credit_depth; }
+   static uint8_t RingDepth() { return s_ring_depth; }
+   static uint16_t IdleTimeout() { return s_idle_timeout; }
+   static uint16_t MetricsInterval() { return s_metrics_interval; }
+   static uint16_t FlightRecorderSize() { return s_flight_recorder; }
+   static uint16_t FlightRecorderDrops() { return s_flight_recorder_drops; }
    static uint16_t Interval() { return s_interval; }
    static uint16_t Timeout() { return s_timeout; }
    static uint16_t Celength() { return s_celength; }
@@ -31,6 +37,9 @@ public:
    static bool Phy1m() { return s_phy1m; }
    static bool Phy2m() { return s_phy2m; }
    static bool Reconnect() { return s_reconnect; }
+   static bool Realtime() { return s_realtime; }
+   static bool IoUring() { return s_io_uring; }
+   static bool Airtime() { return s_airtime; }
    static int16_t RssiPaired() { return s_rssi_paired; }
    static int16_t RssiUnpaired() { return s_rssi_unpaired; }
 
@@ -52,6 +61,12 @@ private:
 
    static std::string s_prog_name;
    static BufferAlgorithmEnum s_buffer_algorithm;
+   static uint8_t s_credit_depth;
+   static uint8_t s_ring_depth;
+   static uint16_t s_idle_timeout;
+   static uint16_t s_metrics_interval;
+   static uint16_t s_flight_recorder;
+   static uint16_t s_flight_recorder_drops;
    static uint16_t s_interval;
    static uint16_t s_timeout;
    static uint16_t s_celength;
@@ -62,6 +77,9 @@ private:
    static bool s_phy1m;
    static bool s_phy2m;
    static bool s_reconnect;
+   static bool s_realtime;
+   static bool s_io_uring;
+   static bool s_airtime;
    static int16_t s_rssi_paired;
    static int16_t s_rssi_unpaired;
 
@@ -2,25 +2,114 @@
 
 #include "Buffer.hh"
 #include "Buffer.hh"
+#include "Config.hh"
+#include "Now.hh"
+#include "RtLog.hh"
 #include "Side.hh"
+#include "Uring.hh"
 
+#include <algorithm>
 #include <cassert>
-#include <poll.h>
+#include <cstring>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 #include <glib.h>
 
 using namespace asha;
 
+namespace
+{
+   // Holding a ReadGuard keeps the published side list, and the sides in it,
+   // alive.
+   struct ReadGuard
+   {
+      ReadGuard(std::atomic<size_t>& readers): m_readers{readers} { ++m_readers; }
+      ~ReadGuard() { --m_readers; }
+      std::atomic<size_t>& m_readers;
+   };
+
+   // Re-arm a side's EPOLLOUT once its socket fills. Edge triggered epoll
+   // keeps the edge from EPOLL_CTL_ADD, and from every drain since, until
+   // someone waits, so without this the first wait after a full socket
+   // could report space that was already used up.
+   void Rearm(int epoll, const Side& side, uint32_t index)
+   {
+      epoll_event event{};
+      event.events = EPOLLOUT | EPOLLET;
+      event.data.u32 = index;
+      if (epoll >= 0 && side.Sock() >= 0)
+         epoll_ctl(epoll, EPOLL_CTL_MOD, side.Sock(), &event);
+   }
+
+   // Count the outcome of a write, and note if the socket filled up.
+   // Returns true if the side got the frame. This is on the audio thread,
+   // so it goes to RtLog, which logs the counts once a second.
+   bool Written(Side::WriteStatus status, const Side& side, bool& blocked, int epoll, uint32_t index)
+   {
+      switch(status)
+      {
+      case Side::WRITE_OK:
+         return true;
+      case Side::DISCONNECTED:
+         RtLog::Count(RtLog::DISCONNECTED, side.Right());
+         // Kick to stopping state, and retry?
+         break;
+      case Side::BUFFER_FULL:
+         RtLog::Count(RtLog::BLOCKED, side.Right());
+         if (!blocked)
+            Rearm(epoll, side, index);
+         blocked = true;
+         break;
+      case Side::NOT_READY:   // Shouldn't hit this, we already validated Ready().
+         RtLog::Count(RtLog::NOT_READY, side.Right());
+         break;
+      case Side::TRUNCATED:   // This is just an O/S l2cap stack error.
+         RtLog::Count(RtLog::TRUNCATED, side.Right());
+         break;
+      case Side::OVERSIZED:   // This is just an O/S l2cap stack error.
+         RtLog::Count(RtLog::OVERSIZED, side.Right());
+         break;
+      }
+      return false;
+   }
+}
+
 
 Device::Device(const std::string& name):
    m_name(name)
 {
    m_state = UNINITIALIZED;
+   RtLog::Start();
+   if (Config::IoUring())
+   {
+      m_uring = std::make_unique<Uring>();
+      if (!m_uring->Valid())
+      {
+         g_warning("io_uring is not available, sending audio with send()");
+         m_uring.reset();
+      }
+   }
+}
+
+
+Device::AudioSides::AudioSides():
+   epoll{epoll_create1(EPOLL_CLOEXEC)}
+{
+}
+
+
+Device::AudioSides::~AudioSides()
+{
+   if (epoll >= 0)
+      close(epoll);
 }
 
 
 Device::~Device()
 {
    m_sides.clear();
+   delete m_audio_sides.exchange(nullptr);
 }
 
 
@@ -30,82 +119,204 @@ bool Device::SendAudio(const RawS16& samples)
    if (m_state != STREAMING)
       return false;
 
-   // Called from pipewire thread, don't let sides disappear while we are using
-   // them.
-   std::lock_guard<std::mutex> lock(m_sides_mutex);
-   if (!SidesAreAll(Side::STREAMING))
+   // Called from pipewire thread.
+   ReadGuard guard{m_audio_readers};
+   AudioSides* audio = m_audio_sides.load();
+   if (!audio || audio->sides.empty())
       return false;
+   auto& sides = audio->sides;
 
-   // TODO: Also check for closed socket?
-   struct pollfd fds[m_sides.size()];
-   for (size_t i = 0; i < m_sides.size(); ++i)
+   for (auto& s: sides)
    {
-      fds[i] = pollfd{
-         .fd = m_sides[i].second->Sock(),
-         .events = POLLOUT
-      };
+      if (s.side->State() != Side::STREAMING)
+         return false;
    }
-   if (m_sides.size() != poll(fds, m_sides.size(), 0))
+
+   // Sockets are assumed writable until a send fails. After that, wait for
+   // epoll to report that they drained. This saves a poll() per frame.
+   bool blocked = false;
+   for (auto& s: sides)
+      blocked = blocked || s.blocked;
+   if (blocked)
    {
-      return false;
+      epoll_event events[4];
+      int count = epoll_wait(audio->epoll, events, 4, 0);
+      for (int i = 0; i < count; ++i)
+      {
+         if (events[i].data.u32 < sides.size())
+            sides[events[i].data.u32].blocked = false;
+      }
+      for (auto& s: sides)
+      {
+         if (s.blocked)
+            return false;
+      }
+   }
+
+   // Catch up a side that missed the last frame, so that the sides keep
+   // getting the same frames.
+   for (size_t i = 0; i < sides.size(); ++i)
+   {
+      auto& s = sides[i];
+      if (s.pending)
+      {
+         if (!Written(s.side->WriteAudioFrame(s.packet), *s.side, s.blocked, audio->epoll, i))
+            return false;
+         s.pending = false;
+      }
    }
 
+   uint64_t start = samples.stamp ? Now() : 0;
    AudioPacket packets[2];
    AudioPacket* left;
    AudioPacket* right;
 
-   if (m_sides.size() == 1)
+   // Encode with copies of the encoders, and keep them only if a side takes
+   // the frame. Otherwise the same samples may be offered again.
+   G722Encoder encoder_left = m_encoder_left;
+   G722Encoder encoder_right = m_encoder_right;
+   if (sides.size() == 1)
    {
       // Mix the two sides together.
       int16_t mono_samples[RawS16::SAMPLE_COUNT];
-      for (size_t i = 0; i < RawS16::SAMPLE_COUNT; ++i)
-         mono_samples[i] = ((int32_t)samples.l[i] + (int32_t)samples.r[i]) / 2;
+      samples.Downmix(mono_samples);
       left = right = &packets[0];
-      g722_encode(&m_state_left, left->data, mono_samples, samples.SAMPLE_COUNT);
+      encoder_left.Encode(left->data, mono_samples, samples.SAMPLE_COUNT);
    }
    else
    {
       left = &packets[0];
       right = &packets[1];
 
-      g722_encode(&m_state_left, left->data, samples.l, samples.SAMPLE_COUNT);
-      g722_encode(&m_state_right, right->data, samples.r, samples.SAMPLE_COUNT);
+      G722Encoder::EncodeStereo(encoder_left, encoder_right, left->data, right->data,
+                                samples.l, samples.r, samples.SAMPLE_COUNT);
    }
    assert(left);
    assert(right);
 
+   uint64_t encoded = start ? Now() : 0;
    left->seq = right->seq = m_audio_seq;
+   for (auto& s: sides)
+      s.side->QueueBeforeWrite();
+   // A device has a left and a right, at most.
+   assert(sides.size() <= 2);
+   Side::WriteStatus status[2];
+   int results[2];
+   if (m_uring && SendUring(sides, *left, *right, results))
+   {
+      for (size_t i = 0; i < sides.size(); ++i)
+         status[i] = sides[i].side->AudioFrameSent(results[i]);
+   }
+   else
+   {
+      for (size_t i = 0; i < sides.size(); ++i)
+         status[i] = sides[i].side->WriteAudioFrame(sides[i].side->Right() ? *right : *left);
+   }
+
    bool success = false;
-   for (auto& kv: m_sides)
+   for (size_t i = 0; i < sides.size(); ++i)
    {
-      Side::WriteStatus status = kv.second->WriteAudioFrame(kv.second->Right() ? *right : *left);
-      switch(status)
-      {
-      case Side::WRITE_OK:
+      auto& s = sides[i];
+      if (Written(status[i], *s.side, s.blocked, audio->epoll, i))
          success = true;
-         break;
-      case Side::DISCONNECTED:
-         g_info("WriteAudioFrame returned DISCONNECTED");
-         // Kick to stopping state, and retry?
-         break;
-      case Side::BUFFER_FULL: // Shoudn't hit this, we already validated that we can write.
-         g_info("WriteAudioFrame returned BUFFER_FULL");
-         break;
-      case Side::NOT_READY:   // Shouldn't hit this, we already validated Ready().
-         g_info("WriteAudioFrame returned NOT_READY");
-         break;
-      case Side::TRUNCATED:   // This is just an O/S l2cap stack error.
-         g_info("WriteAudioFrame returned TRUNCATED");
-         break;
-      case Side::OVERSIZED:   // This is just an O/S l2cap stack error.
-         g_info("WriteAudioFrame returned OVERSIZED");
-         break;
+      s.side->SampleQueue();
+   }
+   if (!success)
+   {
+      // Nobody took the frame, so nothing is owed. The caller decides
+      // whether to retry it or move on, and it gets the same seq either way.
+      return false;
+   }
+
+   m_encoder_left = encoder_left;
+   m_encoder_right = encoder_right;
+
+   // A side whose socket was full gets this frame before the next one. A
+   // side that failed for any other reason has lost it.
+   for (size_t i = 0; i < sides.size(); ++i)
+   {
+      auto& s = sides[i];
+      if (s.blocked)
+      {
+         s.pending = true;
+         s.packet = s.side->Right() ? *right : *left;
       }
+      else if (status[i] != Side::WRITE_OK)
+         RtLog::Count(RtLog::DROPPED, s.side->Right());
    }
-   if (success)
-      ++m_audio_seq;
+   ++m_audio_seq;
+   if (start)
+      Trace(samples, start, encoded, Now());
+
+   return true;
+}
 
-   return success;
+
+// Record where the time went for a frame that made it out. (audio thread)
+void Device::Trace(const RawS16& samples, uint64_t start, uint64_t encoded, uint64_t sent)
+{
+   m_timing.ring.Add((start - samples.stamp) / 1000);
+   m_timing.encode.Add((encoded - start) / 1000);
+   m_timing.send.Add((sent - encoded) / 1000);
+   m_timing.total.Add((sent - samples.stamp) / 1000);
+
+   // The difference wraps along with seq.
+   int32_t gap = samples.seq - m_next_frame;
+   if (m_next_frame && gap > 0)
+      __atomic_fetch_add(&m_timing.gaps, gap, __ATOMIC_RELAXED);
+   m_next_frame = samples.seq + 1;
+}
+
+
+size_t Device::QueuedFrames() const
+{
+   ReadGuard guard{m_audio_readers};
+   const AudioSides* audio = m_audio_sides.load();
+   size_t ret = 0;
+   if (audio)
+   {
+      for (auto& s: audio->sides)
+         ret = std::max(ret, s.side->QueuedFrames());
+   }
+   return ret;
+}
+
+
+size_t Device::SampleQueuedFrames()
+{
+   ReadGuard guard{m_audio_readers};
+   AudioSides* audio = m_audio_sides.load();
+   size_t ret = 0;
+   if (audio)
+   {
+      for (auto& s: audio->sides)
+         ret = std::max(ret, s.side->CountQueuedFrames());
+   }
+   return ret;
+}
+
+
+// Send the frame to every side with a single io_uring submission, and put
+// what each send() returned in results. Returns false, without sending
+// anything, if the caller should use WriteAudioFrame() instead.
+bool Device::SendUring(const std::vector<AudioSide>& sides, const AudioPacket& left, const AudioPacket& right, int* results)
+{
+   for (auto& s: sides)
+   {
+      if (!s.side->AudioReady())
+         return false;
+   }
+   for (auto& s: sides)
+      m_uring->QueueSend(s.side->Sock(), s.side->Right() ? &right : &left, sizeof(AudioPacket));
+
+   int count = m_uring->Submit(results);
+   if (count < 0)
+   {
+      RtLog::Warning("io_uring submission failed (%s), falling back to send()", strerror(-count));
+      m_uring.reset();
+      return false;
+   }
+   return true;
 }
 
 
@@ -147,10 +358,8 @@ void Device::AddSide(const std::string& path, const std::shared_ptr<Side>& side)
 
    bool otherstate = !m_sides.empty();
 
-   {
-      std::lock_guard<std::mutex> lock(m_sides_mutex);
-      m_sides.emplace_back(path, side);
-   }
+   m_sides.emplace_back(path, side);
+   PublishSides();
 
    std::weak_ptr<Side> ws = side;
    std::weak_ptr<Device> wt = std::dynamic_pointer_cast<Device>(shared_from_this());
@@ -212,12 +421,10 @@ bool Device::RemoveSide(const std::string& path)
    if (it == m_sides.end())
       return false;
 
-   // Meant for us. Lock, and remove, but don't delete just yet.
+   // Meant for us. Remove, but don't delete just yet.
    std::shared_ptr<Side> to_delete = it->second;
-   {
-      std::lock_guard<std::mutex> lock(m_sides_mutex);
-      m_sides.erase(it);
-   }
+   m_sides.erase(it);
+   PublishSides();
 
    // The side we are removing is no longer present, and will not respond to
    // any further bluetooth requests from us.
@@ -269,6 +476,30 @@ bool Device::RemoveSide(const std::string& path)
 }
 
 
+// Give SendAudio() a new copy of m_sides. (main thread)
+void Device::PublishSides()
+{
+   auto* audio = new AudioSides;
+   for (auto& kv: m_sides)
+   {
+      epoll_event event{};
+      event.events = EPOLLOUT | EPOLLET;
+      event.data.u32 = audio->sides.size();
+      int fd = kv.second->Sock();
+      if (audio->epoll >= 0 && fd >= 0)
+         epoll_ctl(audio->epoll, EPOLL_CTL_ADD, fd, &event);
+      audio->sides.push_back(AudioSide{kv.second});
+   }
+   AudioSides* old = m_audio_sides.exchange(audio);
+
+   // A reader that got in before the exchange may still be using the old
+   // list. That is at most one SendAudio() call, so just wait it out.
+   while (m_audio_readers.load() != 0)
+      sched_yield();
+   delete old;
+}
+
+
 Side* Device::Left()
 {
    for (auto& s: m_sides)
@@ -294,6 +525,29 @@ Side* Device::Right()
    return nullptr;
 }
 
+uint16_t Device::RenderDelay() const
+{
+   // Both sides should have the same render delay, but use the worst if
+   // they don't.
+   uint16_t ret = 0;
+   for (auto& s: m_sides)
+      ret = std::max(ret, s.second->GetProperties().render_delay);
+   return ret;
+}
+
+
+uint64_t Device::EarLatency(double fraction) const
+{
+   return EarLatency(m_timing.total, fraction);
+}
+
+uint64_t Device::EarLatency(const Histogram& total, double fraction) const
+{
+   return total.Percentile(fraction) * 1000
+      + QueuedFrames() * ASHA_PACKET_TIME
+      + RenderDelay() * 1000000ull;
+}
+
 // Called when a device acknowledges the start command, or it failed.
 void Device::OnStarted(const std::weak_ptr<Side>& side, bool status)
 {
@@ -395,11 +649,8 @@ void Device::OnStop(const std::weak_ptr<Side>& side, bool status)
 
 void Device::Start()
 {
-   // Rate means bit/sec telephone bandwidth, not sample rate. 64000
-   // just means "Use all 8 bits of each byte".
-
-   g722_encode_init(&m_state_left, 64000, G722_PACKED);
-   g722_encode_init(&m_state_right, 64000, G722_PACKED);
+   m_encoder_left.Reset();
+   m_encoder_right.Reset();
    m_audio_seq = 0;
    m_state = STREAMING;
    ProcessDeferred();
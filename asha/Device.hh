@@ -1,18 +1,18 @@
 #pragma once
 
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 #include <functional>
 #include <memory>
-#include <mutex>
 #include <vector>
 #include <string>
 
 #include "AudioPacket.hh"
 #include "DeviceInterface.hh"
-
-#include "../g722/g722_enc_dec.h"
+#include "FrameTiming.hh"
+#include "G722Encoder.hh"
 
 namespace pw {
    class Stream;
@@ -23,6 +23,7 @@ namespace asha {
 
 class Side;
 class Buffer;
+class Uring;
 
 // Manage a pair of hearing devices.
 class Device: public DeviceInterface
@@ -43,6 +44,8 @@ public:
 
    // These will be called by the pipewire stream. (pipewire thread)
    bool SendAudio(const RawS16& samples) override;
+   size_t QueuedFrames() const override;
+   size_t SampleQueuedFrames() override;
 
    enum AudioState{UNINITIALIZED, STOPPED, START_STREAMING, STREAMING };
    AudioState State() const { return m_state; }
@@ -60,6 +63,19 @@ public:
 
    Side* Left();
    Side* Right();
+   // The worst render delay of the sides, in ms. (main thread)
+   uint16_t RenderDelay() const;
+
+   // How long stamped frames took to get from pipewire to the sockets. (any
+   // thread)
+   const FrameTiming& Timing() const { return m_timing; }
+   // Estimated ns from a sample arriving from pipewire to it being heard,
+   // at the given percentile: the time to the sockets, the frames queued
+   // ahead of it in the kernel, and the render delay. (main thread)
+   uint64_t EarLatency(double fraction) const;
+   // The same, for the frames in the given total, such as one interval from
+   // FrameTiming::Since(). (main thread)
+   uint64_t EarLatency(const Histogram& total, double fraction) const;
 
    // virtual void OnConnect();
    // virtual void OnDisconnect();
@@ -83,20 +99,57 @@ protected:
    void StreamStopImpl();
    void ProcessDeferred();
 
+   void PublishSides();
+
 private:
    AudioState m_state = UNINITIALIZED;
    std::string m_name;
 
-   g722_encode_state_t m_state_left{};
-   g722_encode_state_t m_state_right{};
+   // Mono devices only use the left encoder.
+   G722Encoder m_encoder_left;
+   G722Encoder m_encoder_right;
 
-   // Accessed from both pipewire and main, but only modified from main thread.
-   // This means main thread only needs to lock it when modifying.
+   // Only touched from the main thread.
    std::vector<std::pair<std::string, std::shared_ptr<Side>>> m_sides;
-   std::mutex m_sides_mutex;
+
+   // What SendAudio() knows about each side. Only the audio thread changes
+   // it after it is published.
+   struct AudioSide
+   {
+      std::shared_ptr<Side> side;
+      // The socket was full. Cleared when epoll says it drained.
+      bool blocked = false;
+      // A frame the other side already got, to send before the next one.
+      bool pending = false;
+      AudioPacket packet;
+   };
+   struct AudioSides
+   {
+      AudioSides();
+      AudioSides(const AudioSides&) = delete;
+      ~AudioSides();
+      // Edge triggered EPOLLOUT for every side's socket.
+      int epoll = -1;
+      std::vector<AudioSide> sides;
+   };
+
+   // Copy of m_sides for SendAudio(), so the audio thread never waits on the
+   // main thread. PublishSides() swaps in a new copy, then waits for any
+   // SendAudio() still reading the old one before freeing it. That keeps
+   // Side destructors on the main thread.
+   std::atomic<AudioSides*> m_audio_sides{nullptr};
+   mutable std::atomic<size_t> m_audio_readers{0};
+
+
+   void Trace(const RawS16& samples, uint64_t start, uint64_t encoded, uint64_t sent);
+   bool SendUring(const std::vector<AudioSide>& sides, const AudioPacket& left, const AudioPacket& right, int* results);
+   // Set with --io_uring, if the kernel supports it. Audio thread only.
+   std::unique_ptr<Uring> m_uring;
 
    std::shared_ptr<pw::Stream> m_stream;
    uint8_t m_audio_seq = 0;
+   FrameTiming m_timing;
+   uint32_t m_next_frame = 0; // The seq of the frame expected next. Audio thread only.
    int8_t m_volume = -60;
 
 
@@ -9,7 +9,14 @@ class DeviceInterface: public std::enable_shared_from_this<DeviceInterface>
 {
 public:
    virtual ~DeviceInterface() = default;
+   // Returns false if no side took the frame. Nothing of it is kept then,
+   // so the same samples can be offered again.
    virtual bool SendAudio(const RawS16& samples) = 0;
    virtual void StreamStart() = 0;
    virtual void StreamStop() = 0;
+   // Frames sent but still queued in the kernel, for the side that is
+   // furthest behind, as of the last frame sent.
+   virtual size_t QueuedFrames() const { return 0; }
+   // The same, but looking at the sockets again now. (audio thread)
+   virtual size_t SampleQueuedFrames() { return QueuedFrames(); }
 };
\ No newline at end of file
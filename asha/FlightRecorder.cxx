@@ -0,0 +1,327 @@
+#include "FlightRecorder.hh"
+
+#include "Config.hh"
+#include "RtLog.hh"
+
+#include <gio/gio.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+using namespace asha;
+
+namespace
+{
+   // Monitor channel opcodes.
+   constexpr uint16_t EVENT_PKT = 3;
+   constexpr uint16_t ACL_TX_PKT = 4;
+   constexpr uint16_t ACL_RX_PKT = 5;
+   constexpr uint16_t SCO_TX_PKT = 6;
+   constexpr uint16_t SCO_RX_PKT = 7;
+   constexpr uint16_t ISO_TX_PKT = 18;
+   constexpr uint16_t ISO_RX_PKT = 19;
+
+   constexpr uint8_t EVT_DISCONNECTION_COMPLETE = 0x05;
+
+   // Every packet on the monitor channel starts with this.
+   struct MonitorHeader
+   {
+      uint16_t opcode;
+      uint16_t index;
+      uint16_t length;
+   } __attribute__((packed));
+
+   // btsnoop, as written by btmon. Everything is big endian, and stamps are
+   // microseconds since the year 0.
+   constexpr uint32_t BTSNOOP_MONITOR = 2001;
+   constexpr int64_t BTSNOOP_EPOCH = 0x00dcddb30f2f8000ll;
+
+   struct SnoopRecord
+   {
+      uint32_t original_length;
+      uint32_t included_length;
+      uint32_t flags;
+      uint32_t drops;
+      int64_t stamp;
+   } __attribute__((packed));
+
+   // The biggest packet we keep. ACL data is at most a few hundred bytes
+   // with DLE, so this only cuts off oddities.
+   constexpr size_t MAX_PACKET = 1024;
+
+   // How long after a trigger to dump, and how long to wait before another.
+   constexpr int64_t DUMP_DELAY_US = 2 * G_USEC_PER_SEC;
+   constexpr int64_t DUMP_HOLDOFF_US = 30 * G_USEC_PER_SEC;
+
+   uint16_t Le16(const uint8_t* p) { return p[0] | p[1] << 8; }
+
+   // What RtLog has counted on both sides, and the frames the buffers threw
+   // away. Frames blocked on a full socket are still sent, so they don't
+   // count.
+   void Totals(const std::function<size_t()>& buffer_dropped, size_t& dropped, size_t& failed, size_t& disconnected)
+   {
+      dropped = buffer_dropped ? buffer_dropped() : 0;
+      failed = disconnected = 0;
+      for (bool right: { false, true })
+      {
+         dropped += RtLog::Total(RtLog::DROPPED, right);
+         failed += RtLog::Total(RtLog::TRUNCATED, right) + RtLog::Total(RtLog::OVERSIZED, right);
+         disconnected += RtLog::Total(RtLog::DISCONNECTED, right);
+      }
+   }
+}
+
+
+FlightRecorder::FlightRecorder(size_t bytes, std::function<size_t()> buffer_dropped):
+   m_buffer(bytes),
+   m_buffer_dropped{std::move(buffer_dropped)}
+{
+}
+
+
+FlightRecorder::~FlightRecorder()
+{
+   if (m_timer)
+      g_source_remove(m_timer);
+   if (m_source)
+      g_source_destroy(m_source.get());
+}
+
+
+bool FlightRecorder::Start()
+{
+   int sock = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, BTPROTO_HCI);
+   if (sock < 0)
+   {
+      g_warning("Unable to open an HCI socket for the flight recorder: %s", strerror(errno));
+      return false;
+   }
+
+   struct sockaddr_hci addr{};
+   addr.hci_family = AF_BLUETOOTH;
+   addr.hci_dev = HCI_DEV_NONE;
+   addr.hci_channel = HCI_CHANNEL_MONITOR;
+   if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+   {
+      g_warning("Unable to open the HCI monitor channel for the flight recorder. "
+                "It requires CAP_NET_RAW: %s", strerror(errno));
+      close(sock);
+      return false;
+   }
+
+   // Let the kernel stamp the packets, so a busy main loop doesn't bunch
+   // them up.
+   int on = 1;
+   setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+
+   m_sock.reset(g_socket_new_from_fd(sock, nullptr), g_object_unref);
+   if (!m_sock)
+   {
+      close(sock);
+      return false;
+   }
+
+   m_source.reset(g_socket_create_source(m_sock.get(), G_IO_IN, nullptr), g_source_unref);
+   GSocketSourceFunc callback = [](GSocket*, GIOCondition, gpointer data) {
+      ((FlightRecorder*)data)->Read();
+      return (gboolean)G_SOURCE_CONTINUE;
+   };
+   g_source_set_callback(m_source.get(), G_SOURCE_FUNC(callback), this, nullptr);
+   g_source_attach(m_source.get(), nullptr);
+
+   Totals(m_buffer_dropped, m_dropped, m_failed, m_disconnected);
+   m_timer = g_timeout_add(1000, [](gpointer data) -> gboolean {
+      ((FlightRecorder*)data)->Check();
+      return G_SOURCE_CONTINUE;
+   }, this);
+
+   g_info("Flight recorder keeping the last %zu KB of HCI traffic", m_buffer.size() / 1024);
+   return true;
+}
+
+
+void FlightRecorder::Read()
+{
+   int fd = g_socket_get_fd(m_sock.get());
+   for (;;)
+   {
+      MonitorHeader header;
+      uint8_t data[MAX_PACKET];
+      struct iovec iov[2] = {
+         { &header, sizeof(header) },
+         { data, sizeof(data) },
+      };
+      char control[CMSG_SPACE(sizeof(struct timeval))];
+      struct msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = 2;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      ssize_t size = recvmsg(fd, &msg, MSG_DONTWAIT);
+      if (size < (ssize_t)sizeof(header))
+         break;
+
+      int64_t stamp = g_get_real_time();
+      for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      {
+         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP)
+         {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            stamp = tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+         }
+      }
+
+      size_t length = std::min<size_t>(size - sizeof(header), le16toh(header.length));
+      Record(le16toh(header.opcode), le16toh(header.index), data, length, stamp, le16toh(header.length));
+   }
+}
+
+
+void FlightRecorder::Record(uint16_t opcode, uint16_t index, const uint8_t* data, size_t size, int64_t stamp, size_t original)
+{
+   switch (opcode)
+   {
+   case ACL_TX_PKT:
+   case ACL_RX_PKT:
+      if (size < 2)
+         return;
+      if (s_filtered && !s_watched.count({index, (uint16_t)(Le16(data) & 0x0fff)}))
+         return;
+      break;
+   case SCO_TX_PKT:
+   case SCO_RX_PKT:
+   case ISO_TX_PKT:
+   case ISO_RX_PKT:
+      // ASHA doesn't use these.
+      return;
+   case EVENT_PKT:
+      // event code, length, status, handle, reason
+      if (size >= 6 && data[0] == EVT_DISCONNECTION_COMPLETE && data[2] == 0 &&
+          s_watched.count({index, (uint16_t)(Le16(data + 3) & 0x0fff)}))
+      {
+         Trigger("disconnect");
+         Unwatch(index, Le16(data + 3) & 0x0fff);
+      }
+      break;
+   }
+
+   size_t total = sizeof(SnoopRecord) + size;
+   if (total > m_buffer.size())
+      return;
+
+   // Make room.
+   while (m_used + total > m_buffer.size())
+   {
+      SnoopRecord oldest;
+      Get(m_head, &oldest, sizeof(oldest));
+      size_t old_size = sizeof(oldest) + be32toh(oldest.included_length);
+      m_head = (m_head + old_size) % m_buffer.size();
+      m_used -= old_size;
+      --m_packets;
+   }
+
+   SnoopRecord record{};
+   record.original_length = htobe32(std::max(size, original));
+   record.included_length = htobe32(size);
+   record.flags = htobe32((uint32_t)index << 16 | opcode);
+   record.stamp = htobe64(stamp + BTSNOOP_EPOCH);
+   Put(&record, sizeof(record));
+   Put(data, size);
+   ++m_packets;
+}
+
+
+void FlightRecorder::Put(const void* data, size_t size)
+{
+   size_t offset = (m_head + m_used) % m_buffer.size();
+   size_t first = std::min(size, m_buffer.size() - offset);
+   memcpy(m_buffer.data() + offset, data, first);
+   memcpy(m_buffer.data(), (const uint8_t*)data + first, size - first);
+   m_used += size;
+}
+
+
+void FlightRecorder::Get(size_t offset, void* data, size_t size) const
+{
+   size_t first = std::min(size, m_buffer.size() - offset);
+   memcpy(data, m_buffer.data() + offset, first);
+   memcpy((uint8_t*)data + first, m_buffer.data(), size - first);
+}
+
+
+void FlightRecorder::Trigger(const std::string& reason)
+{
+   int64_t now = g_get_monotonic_time();
+   if (m_dump_at || (m_last_dump && now - m_last_dump < DUMP_HOLDOFF_US))
+      return;
+   m_reason = reason;
+   m_dump_at = now + DUMP_DELAY_US;
+}
+
+
+bool FlightRecorder::Dump(std::ostream& out) const
+{
+   const uint32_t header[] = { htobe32(1), htobe32(BTSNOOP_MONITOR) };
+   out.write("btsnoop\0", 8);
+   out.write((const char*)header, sizeof(header));
+
+   size_t first = std::min(m_used, m_buffer.size() - m_head);
+   out.write((const char*)m_buffer.data() + m_head, first);
+   out.write((const char*)m_buffer.data(), m_used - first);
+   return (bool)out;
+}
+
+
+void FlightRecorder::Check()
+{
+   // Look for trouble on the audio threads since the last check.
+   size_t dropped, failed, disconnected;
+   Totals(m_buffer_dropped, dropped, failed, disconnected);
+
+   if (Config::FlightRecorderDrops() && dropped - m_dropped >= Config::FlightRecorderDrops())
+      Trigger(std::to_string(dropped - m_dropped) + " frames dropped");
+   else if (failed != m_failed)
+      Trigger("failed write");
+   else if (disconnected != m_disconnected)
+      Trigger("disconnect");
+   m_dropped = dropped;
+   m_failed = failed;
+   m_disconnected = disconnected;
+
+   if (m_dump_at && g_get_monotonic_time() >= m_dump_at)
+   {
+      DumpToFile();
+      m_dump_at = 0;
+      m_last_dump = g_get_monotonic_time();
+   }
+}
+
+
+void FlightRecorder::DumpToFile()
+{
+   std::string dir = std::string(g_get_user_cache_dir()) + "/asha";
+   g_mkdir_with_parents(dir.c_str(), 0700);
+
+   char name[64];
+   time_t now = time(nullptr);
+   strftime(name, sizeof(name), "/flight-%Y%m%d-%H%M%S.btsnoop", localtime(&now));
+   std::string path = dir + name;
+
+   std::ofstream out(path, std::ios::binary);
+   if (Dump(out))
+      g_warning("Wrote the last %zu HCI packets to %s (%s)", m_packets, path.c_str(), m_reason.c_str());
+   else
+      g_warning("Unable to write the flight recorder to %s", path.c_str());
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct _GSocket;
+struct _GSource;
+
+namespace asha
+{
+
+// Keeps the most recent HCI traffic from the kernel's monitor channel (what
+// btmon sees) in a fixed size ring, already laid out as btsnoop records.
+// When something goes wrong, like a burst of dropped frames, a failed write
+// or a disconnect, the ring is written out as a
+// btsnoop file that snoop_analyze and btmon can read. Until then it only
+// costs the memory for the ring.
+//
+// Reading the monitor channel requires CAP_NET_RAW.
+class FlightRecorder final
+{
+public:
+   // buffer_dropped returns how many frames the buffers have thrown away
+   // so far, to count along with the sides' own drops.
+   FlightRecorder(size_t bytes, std::function<size_t()> buffer_dropped = nullptr);
+   ~FlightRecorder();
+
+   // Start capturing, and checking for trouble once a second. Returns false
+   // if the monitor channel can't be opened. (main thread)
+   bool Start();
+
+   // Keep the ACL traffic for this connection. Once anything is watched,
+   // ACL traffic for other connections is left out. (main thread)
+   static void Watch(uint16_t index, uint16_t handle)
+   {
+      s_watched.emplace(index, handle);
+      s_filtered = true;
+   }
+   // Stop keeping it. The controller hands the handle to the next
+   // connection, which may have nothing to do with us. This is also done
+   // when the monitor channel shows the disconnect. (main thread)
+   static void Unwatch(uint16_t index, uint16_t handle) { s_watched.erase({index, handle}); }
+
+   // Add a monitor channel packet, stamped in microseconds since the unix
+   // epoch. original is the packet's length, if it was cut short to size.
+   // The oldest records are thrown away to make room.
+   void Record(uint16_t opcode, uint16_t index, const uint8_t* data, size_t size, int64_t stamp, size_t original = 0);
+
+   // Dump what we have a couple of seconds from now, so that the file shows
+   // what happened next as well.
+   void Trigger(const std::string& reason);
+
+   // Write everything in the ring as a btsnoop file.
+   bool Dump(std::ostream& out) const;
+
+   size_t Packets() const { return m_packets; }
+   size_t Bytes() const { return m_used; }
+
+private:
+   void Read();
+   void Check();
+   void DumpToFile();
+
+   void Put(const void* data, size_t size);
+   void Get(size_t offset, void* data, size_t size) const;
+
+   std::vector<uint8_t> m_buffer;
+   size_t m_head = 0;     // Offset of the oldest record.
+   size_t m_used = 0;
+   size_t m_packets = 0;
+
+   std::shared_ptr<_GSocket> m_sock;
+   std::shared_ptr<_GSource> m_source;
+   unsigned m_timer = 0;
+
+   std::function<size_t()> m_buffer_dropped;
+   // What had been counted at the last check.
+   size_t m_dropped = 0;
+   size_t m_failed = 0;
+   size_t m_disconnected = 0;
+
+   std::string m_reason;
+   int64_t m_dump_at = 0;   // Monotonic time of the pending dump, or 0.
+   int64_t m_last_dump = 0;
+
+   inline static std::set<std::pair<uint16_t, uint16_t>> s_watched;
+   // Something was watched, so other ACL traffic is left out even once
+   // every watched connection is gone.
+   inline static bool s_filtered = false;
+};
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Histogram.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace asha
+{
+
+// Where the time goes between pipewire handing us a frame and the frame
+// going out on the sockets, in microseconds. Device::SendAudio() fills it in
+// for every stamped frame it sends, and anyone can read it.
+struct FrameTiming
+{
+   Histogram ring;   // From the first sample arriving to SendAudio().
+   Histogram encode; // G.722 encoding.
+   Histogram send;   // Writing to the sockets.
+   Histogram total;  // From the first sample arriving to the last write.
+
+   // Frames that never made it to the sockets between two that did. That
+   // is everything the buffer dropped or threw away as idle silence, and
+   // everything the sockets refused.
+   size_t gaps = 0;
+
+   size_t Gaps() const { return __atomic_load_n(&gaps, __ATOMIC_RELAXED); }
+
+   void Merge(const FrameTiming& other)
+   {
+      ring.Merge(other.ring);
+      encode.Merge(other.encode);
+      send.Merge(other.send);
+      total.Merge(other.total);
+      gaps += other.Gaps();
+   }
+
+   // Just the frames after `earlier`, an older copy of this.
+   FrameTiming Since(const FrameTiming& earlier) const
+   {
+      FrameTiming ret;
+      ret.ring = ring.Since(earlier.ring);
+      ret.encode = encode.Since(earlier.encode);
+      ret.send = send.Since(earlier.send);
+      ret.total = total.Since(earlier.total);
+      ret.gaps = Gaps() > earlier.gaps ? Gaps() - earlier.gaps : 0;
+      return ret;
+   }
+};
+
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#include "../g722/g722_qmf.h"
+#include "../g722/g722_quantl.h"
+
+namespace asha
+{
+
+// G.722 encoder for the only profile ASHA uses: 64 kbit/s from 16 kHz audio,
+// one code per output byte. The output is identical to g722_encode() with
+// G722_PACKED, but there are no mode checks per sample, and the state is
+// small: both ADPCM bands together fit in two cache lines.
+//
+// g722_encode() is still the reference, and the unit tests compare the two.
+class G722Encoder
+{
+public:
+   G722Encoder() { Reset(); }
+
+   void Reset()
+   {
+      m_band[0] = Band{};
+      m_band[0].det = 32;
+      m_band[1] = Band{};
+      m_band[1].det = 8;
+      std::fill(std::begin(m_history), std::end(m_history), 0);
+   }
+
+   // Encodes count samples into count / 2 bytes, and returns the number of
+   // bytes written. count should be even; a trailing odd sample is ignored.
+   size_t Encode(uint8_t* out, const int16_t* in, size_t count)
+   {
+      int16_t window[HISTORY + CHUNK];
+      count &= ~(size_t)1;
+      for (size_t done = 0; done < count; )
+      {
+         size_t n = std::min(count - done, CHUNK);
+         Load(window, in + done, n);
+         for (size_t i = 0; i < n; i += 2)
+         {
+            int sum, diff;
+            qmf_dot(&window[i], &sum, &diff);
+            *out++ = EncodeBands(sum >> 14, diff >> 14);
+         }
+         Save(window, n);
+         done += n;
+      }
+      return count / 2;
+   }
+
+   // Runs two encoders together. Same output as calling Encode() on each.
+   // The QMF for both channels runs first, sharing the vector registers,
+   // then each channel's ADPCM runs on its own. Interleaving the two ADPCM
+   // chains sample by sample ran out of registers and was slower than two
+   // Encode() calls.
+   static size_t EncodeStereo(G722Encoder& left, G722Encoder& right,
+                              uint8_t* out_left, uint8_t* out_right,
+                              const int16_t* in_left, const int16_t* in_right,
+                              size_t count)
+   {
+      int16_t window_left[HISTORY + CHUNK];
+      int16_t window_right[HISTORY + CHUNK];
+      int xlow[2][CHUNK / 2];
+      int xhigh[2][CHUNK / 2];
+      count &= ~(size_t)1;
+      for (size_t done = 0; done < count; )
+      {
+         size_t n = std::min(count - done, CHUNK);
+         left.Load(window_left, in_left + done, n);
+         right.Load(window_right, in_right + done, n);
+         for (size_t i = 0; i < n; i += 2)
+         {
+            int sum_left, diff_left, sum_right, diff_right;
+            qmf_dot2(&window_left[i], &window_right[i],
+                     &sum_left, &diff_left, &sum_right, &diff_right);
+            xlow[0][i / 2] = sum_left >> 14;
+            xhigh[0][i / 2] = diff_left >> 14;
+            xlow[1][i / 2] = sum_right >> 14;
+            xhigh[1][i / 2] = diff_right >> 14;
+         }
+         for (size_t i = 0; i < n / 2; ++i)
+            *out_left++ = left.EncodeBands(xlow[0][i], xhigh[0][i]);
+         for (size_t i = 0; i < n / 2; ++i)
+            *out_right++ = right.EncodeBands(xlow[1][i], xhigh[1][i]);
+         left.Save(window_left, n);
+         right.Save(window_right, n);
+         done += n;
+      }
+      return count / 2;
+   }
+
+private:
+   // The QMF window is 24 samples, so 22 carry over between calls.
+   static constexpr size_t HISTORY = 22;
+   // One ASHA frame.
+   static constexpr size_t CHUNK = 320;
+
+   // Everything here is saturated to 16 bits by the algorithm, except sz,
+   // which is the sum of six 16 bit terms. The predictor coefficients that
+   // g722_band_t keeps in ap[] and bp[] are only needed inside Block4().
+   struct Band
+   {
+      int32_t sz = 0;
+      int16_t s = 0;
+      int16_t det = 0;
+      int16_t nb = 0;
+      int16_t r[3] = {};
+      int16_t p[3] = {};
+      int16_t a[3] = {};
+      int16_t d[7] = {};
+      int16_t b[7] = {};
+   };
+
+   static constexpr int16_t ILN[32] = {
+       0, 63, 62, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19,
+      18, 17, 16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  0
+   };
+   static constexpr int16_t ILP[32] = {
+       0, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47,
+      46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 32,  0
+   };
+   static constexpr int16_t WL[8] = { -60, -30, 58, 172, 334, 538, 1198, 3042 };
+   static constexpr int16_t RL42[16] = { 0, 7, 6, 5, 4, 3, 2, 1, 7, 6, 5, 4, 3, 2, 1, 0 };
+   static constexpr int16_t ILB[32] = {
+      2048, 2093, 2139, 2186, 2233, 2282, 2332, 2383,
+      2435, 2489, 2543, 2599, 2656, 2714, 2774, 2834,
+      2896, 2960, 3025, 3091, 3158, 3228, 3298, 3371,
+      3444, 3520, 3597, 3676, 3756, 3838, 3922, 4008
+   };
+   static constexpr int16_t QM4[16] = {
+           0, -20456, -12896, -8968, -6288, -4240, -2584, -1200,
+       20456,  12896,   8968,  6288,  4240,  2584,  1200,     0
+   };
+   static constexpr int16_t QM2[4] = { -7408, -1616, 7408, 1616 };
+   static constexpr int16_t IHN[3] = { 0, 1, 0 };
+   static constexpr int16_t IHP[3] = { 0, 3, 2 };
+   static constexpr int16_t WH[3] = { 0, -214, 798 };
+   static constexpr int16_t RH2[4] = { 2, 1, 2, 1 };
+
+   static int16_t Saturate(int32_t v)
+   {
+      if (v > 32767) return 32767;
+      if (v < -32768) return -32768;
+      return (int16_t)v;
+   }
+
+   void Load(int16_t* window, const int16_t* in, size_t n) const
+   {
+      memcpy(window, m_history, sizeof(m_history));
+      memcpy(window + HISTORY, in, n * sizeof(int16_t));
+   }
+
+   void Save(const int16_t* window, size_t n)
+   {
+      memcpy(m_history, window + n, sizeof(m_history));
+   }
+
+   // Block 3, LOGSCL/LOGSCH and SCALEL/SCALEH: adapt the step size.
+   static void Scale(Band& band, int nb, int max_nb, int shift)
+   {
+      nb = std::clamp(nb, 0, max_nb);
+      band.nb = nb;
+      int wd1 = (nb >> 6) & 31;
+      int wd2 = shift - (nb >> 11);
+      int wd3 = (wd2 < 0) ? (ILB[wd1] << -wd2) : (ILB[wd1] >> wd2);
+      band.det = wd3 << 2;
+   }
+
+   // Block 4: update the pole/zero predictor with the new difference d.
+   static void Block4(Band& band, int d)
+   {
+      // RECONS, PARREC
+      int r0 = Saturate(band.s + d);
+      int p0 = Saturate(band.sz + d);
+
+      // UPPOL2
+      int sg0 = p0 >> 15;
+      int sg1 = band.p[1] >> 15;
+      int sg2 = band.p[2] >> 15;
+      int wd1 = Saturate(band.a[1] << 2);
+      int wd2 = (sg0 == sg1) ? -wd1 : wd1;
+      if (wd2 > 32767)
+         wd2 = 32767;
+      int ap2 = (wd2 >> 7) + ((sg0 == sg2) ? 128 : -128);
+      ap2 += (band.a[2] * 32512) >> 15;
+      ap2 = std::clamp(ap2, -12288, 12288);
+
+      // UPPOL1
+      wd1 = (sg0 == sg1) ? 192 : -192;
+      wd2 = (band.a[1] * 32640) >> 15;
+      int ap1 = Saturate(wd1 + wd2);
+      int wd3 = Saturate(15360 - ap2);
+      ap1 = std::clamp(ap1, -wd3, wd3);
+
+      // UPZERO, DELAYA and FILTEZ together. The reference updates all of b[]
+      // before shifting d[], but each b[i] only depends on the old d[i].
+      wd1 = (d == 0) ? 0 : 128;
+      int sgd = d >> 15;
+      int sz = 0;
+      for (int i = 6; i > 0; --i)
+      {
+         int wd = ((band.d[i] >> 15) == sgd) ? wd1 : -wd1;
+         int bi = Saturate(wd + ((band.b[i] * 32640) >> 15));
+         int di = (i == 1) ? d : band.d[i - 1];
+         band.b[i] = bi;
+         band.d[i] = di;
+         sz += (bi * Saturate(di + di)) >> 15;
+      }
+      band.sz = sz;
+
+      band.r[2] = band.r[1];
+      band.r[1] = r0;
+      band.p[2] = band.p[1];
+      band.p[1] = p0;
+      band.a[1] = ap1;
+      band.a[2] = ap2;
+
+      // FILTEP, PREDIC
+      wd1 = (band.a[1] * Saturate(band.r[1] + band.r[1])) >> 15;
+      wd2 = (band.a[2] * Saturate(band.r[2] + band.r[2])) >> 15;
+      band.s = Saturate(Saturate(wd1 + wd2) + band.sz);
+   }
+
+   uint8_t EncodeBands(int xlow, int xhigh)
+   {
+      Band& low = m_band[0];
+      Band& high = m_band[1];
+
+      // Block 1L, SUBTRA and QUANTL
+      int el = Saturate(xlow - low.s);
+      int wd = (el >= 0) ? el : -(el + 1);
+      int i = quantl(wd, low.det);
+      int ilow = (el < 0) ? ILN[i] : ILP[i];
+
+      // Block 2L, INVQAL
+      int ril = ilow >> 2;
+      int dlow = (low.det * QM4[ril]) >> 15;
+
+      // Block 3L
+      Scale(low, ((low.nb * 127) >> 7) + WL[RL42[ril]], 18432, 8);
+      Block4(low, dlow);
+
+      // Block 1H, SUBTRA and QUANTH
+      int eh = Saturate(xhigh - high.s);
+      wd = (eh >= 0) ? eh : -(eh + 1);
+      int mih = (wd >= ((564 * high.det) >> 12)) ? 2 : 1;
+      int ihigh = (eh < 0) ? IHN[mih] : IHP[mih];
+
+      // Block 2H, INVQAH
+      int dhigh = (high.det * QM2[ihigh]) >> 15;
+
+      // Block 3H
+      Scale(high, ((high.nb * 127) >> 7) + WH[RH2[ihigh]], 22528, 10);
+      Block4(high, dhigh);
+
+      return (uint8_t)((ihigh << 6) | ilow);
+   }
+
+   Band m_band[2];
+   int16_t m_history[HISTORY];
+};
+
+}
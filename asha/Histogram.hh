@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace asha
+{
+
+// Counts values in power of two buckets: bucket 0 holds 0, and bucket n holds
+// [2^(n-1), 2^n). Meant for timing distributions in the audio path, so Add()
+// is cheap and doesn't lock. One thread adds while others read; a reader may
+// see a bucket updated before the max, but never a torn count.
+class Histogram
+{
+public:
+   static constexpr size_t BUCKETS = 32;
+
+   void Add(uint64_t value)
+   {
+      __atomic_fetch_add(&m_bucket[Bucket(value)], 1, __ATOMIC_RELAXED);
+      if (value > __atomic_load_n(&m_max, __ATOMIC_RELAXED))
+         __atomic_store_n(&m_max, value, __ATOMIC_RELAXED);
+   }
+
+   void Merge(const Histogram& other)
+   {
+      for (size_t i = 0; i < BUCKETS; ++i)
+         m_bucket[i] += other.Count(i);
+      if (other.Max() > m_max)
+         m_max = other.Max();
+   }
+
+   // What was added after `earlier`, an older copy of this one, so that
+   // percentiles can cover an interval rather than the whole run. The max
+   // is only known to within its bucket.
+   Histogram Since(const Histogram& earlier) const
+   {
+      Histogram ret;
+      for (size_t i = 0; i < BUCKETS; ++i)
+      {
+         size_t count = Count(i);
+         ret.m_bucket[i] = count > earlier.Count(i) ? count - earlier.Count(i) : 0;
+         if (ret.m_bucket[i] && i > 0)
+            ret.m_max = std::min(Max(), (uint64_t(1) << i) - 1);
+      }
+      return ret;
+   }
+
+   size_t Count(size_t bucket) const { return __atomic_load_n(&m_bucket[bucket], __ATOMIC_RELAXED); }
+   uint64_t Max() const { return __atomic_load_n(&m_max, __ATOMIC_RELAXED); }
+
+   size_t Total() const
+   {
+      size_t total = 0;
+      for (size_t i = 0; i < BUCKETS; ++i)
+         total += Count(i);
+      return total;
+   }
+
+   // The upper bound of the bucket that holds the given fraction (0 to 1)
+   // of the values, capped at the largest value seen. 0 when empty.
+   uint64_t Percentile(double fraction) const
+   {
+      size_t total = Total();
+      if (total == 0)
+         return 0;
+      size_t rank = fraction * total;
+      size_t seen = 0;
+      for (size_t i = 0; i < BUCKETS; ++i)
+      {
+         seen += Count(i);
+         if (seen > rank)
+            return i == 0 ? 0 : std::min(Max(), (uint64_t(1) << i) - 1);
+      }
+      return Max();
+   }
+
+   static size_t Bucket(uint64_t value)
+   {
+      if (value == 0)
+         return 0;
+      size_t bits = 64 - __builtin_clzll(value);
+      return bits < BUCKETS ? bits : BUCKETS - 1;
+   }
+
+private:
+   size_t m_bucket[BUCKETS] = {};
+   uint64_t m_max = 0;
+};
+
+}
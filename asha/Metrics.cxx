@@ -0,0 +1,388 @@
+#include "Metrics.hh"
+
+#include "AirtimeMonitor.hh"
+#include "Asha.hh"
+#include "Buffer.hh"
+#include "Config.hh"
+#include "Device.hh"
+#include "ObjectManager.hh"
+#include "Side.hh"
+
+#include <gio/gio.h>
+
+#include <set>
+#include <vector>
+
+using namespace asha;
+
+namespace
+{
+   constexpr char BUS_NAME[] = "org.asha";
+   constexpr char BASE_PATH[] = "/org/asha";
+
+   constexpr auto READABLE = G_DBUS_PROPERTY_INFO_FLAGS_READABLE;
+
+   GDBusPropertyInfo DEVICE_PROPERTIES[] = {
+      {-1, (char*)"Name", (char*)"s", READABLE, nullptr },
+      {-1, (char*)"HiSyncId", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"Occupancy", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"OccupancyHigh", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"OccupancyHistogram", (char*)"at", READABLE, nullptr },
+      {-1, (char*)"RingDropped", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"FailedWrites", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"Silence", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"Gaps", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"LatenessP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RingWaitP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RingWaitP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"EncodeP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"EncodeP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"SendP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"SendP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"TotalP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"TotalP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"EarLatencyP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"EarLatencyP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentLatenessP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentRingWaitP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentEncodeP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentSendP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentTotalP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentTotalP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentEarLatencyP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentEarLatencyP99", (char*)"t", READABLE, nullptr },
+   };
+
+   GDBusPropertyInfo SIDE_PROPERTIES[] = {
+      {-1, (char*)"Rssi", (char*)"n", READABLE, nullptr },
+      {-1, (char*)"QueuedFrames", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"QueueHistogram", (char*)"at", READABLE, nullptr },
+      {-1, (char*)"Phy", (char*)"y", READABLE, nullptr },
+      {-1, (char*)"TxOctets", (char*)"q", READABLE, nullptr },
+      {-1, (char*)"TxTime", (char*)"q", READABLE, nullptr },
+      {-1, (char*)"FragmentsPerSdu", (char*)"d", READABLE, nullptr },
+      {-1, (char*)"PdusPerSdu", (char*)"d", READABLE, nullptr },
+      {-1, (char*)"AirtimeUtilization", (char*)"d", READABLE, nullptr },
+      {-1, (char*)"ControllerLatencyP50", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"ControllerLatencyP99", (char*)"t", READABLE, nullptr },
+      {-1, (char*)"RecentControllerLatencyP99", (char*)"t", READABLE, nullptr },
+   };
+
+   // gdbus wants a null terminated list of pointers.
+   template <size_t N>
+   std::vector<GDBusPropertyInfo*> PropertyList(GDBusPropertyInfo (&properties)[N])
+   {
+      std::vector<GDBusPropertyInfo*> ret;
+      for (auto& p: properties)
+         ret.push_back(&p);
+      ret.push_back(nullptr);
+      return ret;
+   }
+
+   GDBusInterfaceInfo* DeviceMetricsInterface()
+   {
+      static auto properties = PropertyList(DEVICE_PROPERTIES);
+      static GDBusInterfaceInfo info = {
+         .ref_count = -1,
+         .name = (char*)"org.asha.DeviceMetrics1",
+         .properties = properties.data(),
+      };
+      return &info;
+   }
+
+   GDBusInterfaceInfo* SideMetricsInterface()
+   {
+      static auto properties = PropertyList(SIDE_PROPERTIES);
+      static GDBusInterfaceInfo info = {
+         .ref_count = -1,
+         .name = (char*)"org.asha.SideMetrics1",
+         .properties = properties.data(),
+      };
+      return &info;
+   }
+
+   GVariant* HistogramVariant(const Histogram& h)
+   {
+      GVariantBuilder b = G_VARIANT_BUILDER_INIT(G_VARIANT_TYPE("at"));
+      for (size_t i = 0; i < Histogram::BUCKETS; ++i)
+         g_variant_builder_add(&b, "t", (guint64)h.Count(i));
+      return g_variant_builder_end(&b);
+   }
+}
+
+
+// One object on the bus, holding the values from the last update.
+class Metrics::Object
+{
+public:
+   Object(GDBusConnection* connection, const std::string& path, GDBusInterfaceInfo* info):
+      m_connection{connection}, m_path{path}, m_info{info}
+   {
+      static const GDBusInterfaceVTable VTABLE = {
+         .get_property = &Object::GetDbusProperty,
+      };
+      GError* err = nullptr;
+      m_object_id = g_dbus_connection_register_object(m_connection, m_path.c_str(), m_info, &VTABLE, this, nullptr, &err);
+      if (err)
+      {
+         g_warning("Error registering %s for %s: %s", m_info->name, m_path.c_str(), err->message);
+         g_error_free(err);
+         m_object_id = -1;
+      }
+   }
+
+   ~Object()
+   {
+      if (m_object_id != (uint32_t)-1)
+         g_dbus_connection_unregister_object(m_connection, m_object_id);
+   }
+
+   const char* Interface() const { return m_info->name; }
+
+   std::vector<std::string> GetPropertyList() const
+   {
+      std::vector<std::string> ret;
+      for (auto p = m_info->properties; *p; ++p)
+         ret.push_back((*p)->name);
+      return ret;
+   }
+
+   GVariant* GetProperty(const std::string& name) const
+   {
+      // Callers expect a new floating reference, so hand out a copy.
+      auto it = m_values.find(name);
+      if (it == m_values.end())
+         return nullptr;
+      GBytes* bytes = g_variant_get_data_as_bytes(it->second.get());
+      GVariant* ret = g_variant_new_from_bytes(g_variant_get_type(it->second.get()), bytes, true);
+      g_bytes_unref(bytes);
+      return ret;
+   }
+
+   // Takes a floating value, like the ones from g_variant_new_*().
+   void Set(const char* name, GVariant* value)
+   {
+      std::shared_ptr<GVariant> v(g_variant_ref_sink(value), g_variant_unref);
+      auto& old = m_values[name];
+      if (!old || !g_variant_equal(old.get(), v.get()))
+      {
+         old = v;
+         m_changed.push_back(name);
+      }
+   }
+
+   // The first time, add the object to the ObjectManager. After that,
+   // send PropertiesChanged for whatever Set() changed.
+   void Publish(ObjectManager& om)
+   {
+      if (!m_published)
+      {
+         om.AddInterface(m_path, m_info->name, *this);
+         m_published = true;
+      }
+      else if (!m_changed.empty())
+      {
+         GVariantBuilder changed = G_VARIANT_BUILDER_INIT(G_VARIANT_TYPE("a{sv}"));
+         for (auto& name: m_changed)
+            g_variant_builder_add(&changed, "{sv}", name.c_str(), GetProperty(name));
+
+         GError* err = nullptr;
+         g_dbus_connection_emit_signal(
+            m_connection,
+            nullptr,
+            m_path.c_str(),
+            "org.freedesktop.DBus.Properties",
+            "PropertiesChanged",
+            g_variant_new("(sa{sv}as)", m_info->name, &changed, nullptr),
+            &err
+         );
+         if (err)
+         {
+            g_warning("Error emitting PropertiesChanged for %s: %s", m_path.c_str(), err->message);
+            g_error_free(err);
+         }
+      }
+      m_changed.clear();
+   }
+
+private:
+   static GVariant* GetDbusProperty(
+      GDBusConnection*,
+      const gchar* sender,
+      const gchar* object_path,
+      const gchar* interface_name,
+      const gchar* property_name,
+      GError** error,
+      gpointer user_data)
+   {
+      auto self = (Object*)user_data;
+      GVariant* ret = self->GetProperty(property_name);
+      if (!ret && error)
+         *error = g_error_new(g_dbus_error_quark(), G_DBUS_ERROR_UNKNOWN_PROPERTY, "Property %s does not exist", property_name);
+      return ret;
+   }
+
+   GDBusConnection* m_connection;
+   const std::string m_path;
+   GDBusInterfaceInfo* m_info;
+   uint32_t m_object_id = -1;
+   bool m_published = false;
+
+   std::map<std::string, std::shared_ptr<GVariant>> m_values;
+   std::vector<std::string> m_changed;
+};
+
+
+Metrics::Metrics(const Asha& asha):
+   m_asha{asha}
+{
+   GError* err = nullptr;
+   m_connection.reset(g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &err), g_object_unref);
+   if (err)
+   {
+      g_warning("Not publishing metrics, unable to connect to the session bus: %s", err->message);
+      g_error_free(err);
+      m_connection.reset();
+      return;
+   }
+
+   m_om.reset(new ObjectManager(m_connection.get(), BASE_PATH));
+   if (Config::Airtime())
+      m_airtime.reset(new AirtimeMonitor);
+   m_name_id = g_bus_own_name_on_connection(m_connection.get(), BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+      [](GDBusConnection*, const gchar* name, gpointer) { g_info("Publishing metrics as %s", name); },
+      [](GDBusConnection*, const gchar* name, gpointer) { g_warning("Unable to own %s, is another instance running?", name); },
+      nullptr,
+      nullptr
+   );
+
+   Update();
+   m_timer = g_timeout_add(Config::MetricsInterval(), [](gpointer user_data) -> gboolean {
+      ((Metrics*)user_data)->Update();
+      return G_SOURCE_CONTINUE;
+   }, this);
+}
+
+
+Metrics::~Metrics()
+{
+   if (m_timer)
+      g_source_remove(m_timer);
+   for (auto& kv: m_objects)
+      m_om->RemoveInterface(kv.first, kv.second->Interface());
+   m_objects.clear();
+   m_om.reset();
+   if (m_name_id)
+      g_bus_unown_name(m_name_id);
+}
+
+
+Metrics::Object& Metrics::Get(const std::string& path, bool side)
+{
+   auto& obj = m_objects[path];
+   if (!obj)
+      obj.reset(new Object(m_connection.get(), path, side ? SideMetricsInterface() : DeviceMetricsInterface()));
+   return *obj;
+}
+
+
+void Metrics::Update()
+{
+   if (m_airtime)
+      m_airtime->Tick(g_get_monotonic_time());
+   std::set<std::string> seen;
+   m_asha.ForEachDevice([&](uint64_t id, Device& device, const Buffer& buffer) {
+      std::string path = std::string(BASE_PATH) + "/dev_" + std::to_string(id);
+      seen.insert(path);
+
+      auto stats = buffer.Stats();
+      FrameTiming timing;
+      timing.Merge(device.Timing());
+      auto& window = m_windows[path];
+      auto recent = timing.Since(window.timing);
+      auto recent_lateness = stats.lateness.Since(window.lateness);
+      window.timing = timing;
+      window.lateness = stats.lateness;
+
+      auto& d = Get(path, false);
+      d.Set("Name", g_variant_new_string(device.Name().c_str()));
+      d.Set("HiSyncId", g_variant_new_uint64(id));
+      d.Set("Occupancy", g_variant_new_uint64(stats.occupancy));
+      d.Set("OccupancyHigh", g_variant_new_uint64(stats.high_occupancy));
+      d.Set("OccupancyHistogram", HistogramVariant(stats.occupancy_depth));
+      d.Set("RingDropped", g_variant_new_uint64(stats.ring_dropped));
+      d.Set("FailedWrites", g_variant_new_uint64(stats.failed_writes));
+      d.Set("Silence", g_variant_new_uint64(stats.silence));
+      d.Set("Gaps", g_variant_new_uint64(timing.Gaps()));
+      d.Set("LatenessP99", g_variant_new_uint64(stats.lateness.Percentile(0.99)));
+      d.Set("RingWaitP50", g_variant_new_uint64(timing.ring.Percentile(0.5)));
+      d.Set("RingWaitP99", g_variant_new_uint64(timing.ring.Percentile(0.99)));
+      d.Set("EncodeP50", g_variant_new_uint64(timing.encode.Percentile(0.5)));
+      d.Set("EncodeP99", g_variant_new_uint64(timing.encode.Percentile(0.99)));
+      d.Set("SendP50", g_variant_new_uint64(timing.send.Percentile(0.5)));
+      d.Set("SendP99", g_variant_new_uint64(timing.send.Percentile(0.99)));
+      d.Set("TotalP50", g_variant_new_uint64(timing.total.Percentile(0.5)));
+      d.Set("TotalP99", g_variant_new_uint64(timing.total.Percentile(0.99)));
+      d.Set("EarLatencyP50", g_variant_new_uint64(device.EarLatency(timing.total, 0.5) / 1000));
+      d.Set("EarLatencyP99", g_variant_new_uint64(device.EarLatency(timing.total, 0.99) / 1000));
+      d.Set("RecentLatenessP99", g_variant_new_uint64(recent_lateness.Percentile(0.99)));
+      d.Set("RecentRingWaitP99", g_variant_new_uint64(recent.ring.Percentile(0.99)));
+      d.Set("RecentEncodeP99", g_variant_new_uint64(recent.encode.Percentile(0.99)));
+      d.Set("RecentSendP99", g_variant_new_uint64(recent.send.Percentile(0.99)));
+      d.Set("RecentTotalP50", g_variant_new_uint64(recent.total.Percentile(0.5)));
+      d.Set("RecentTotalP99", g_variant_new_uint64(recent.total.Percentile(0.99)));
+      d.Set("RecentEarLatencyP50", g_variant_new_uint64(device.EarLatency(recent.total, 0.5) / 1000));
+      d.Set("RecentEarLatencyP99", g_variant_new_uint64(device.EarLatency(recent.total, 0.99) / 1000));
+
+      for (auto& [name, side]: { std::make_pair("left", device.Left()), std::make_pair("right", device.Right()) })
+      {
+         if (!side)
+            continue;
+         std::string side_path = path + "/" + name;
+         seen.insert(side_path);
+
+         auto& s = Get(side_path, true);
+         s.Set("Rssi", g_variant_new_int16(side->Rssi()));
+         s.Set("QueuedFrames", g_variant_new_uint64(side->QueuedFrames()));
+         s.Set("QueueHistogram", HistogramVariant(side->QueueDepth()));
+
+         // Zeros until the controller has told us something.
+         static const AirtimeMonitor::Link NONE{0, 0, 0};
+         const AirtimeMonitor::Link* link = nullptr;
+         if (m_airtime && side->ConnectionHandle() != (uint16_t)-1)
+         {
+            m_airtime->AddController(side->HciIndex());
+            link = m_airtime->Get(side->HciIndex(), side->ConnectionHandle());
+         }
+         if (!link)
+            link = &NONE;
+         s.Set("Phy", g_variant_new_byte(link->phy));
+         s.Set("TxOctets", g_variant_new_uint16(link->tx_octets));
+         s.Set("TxTime", g_variant_new_uint16(link->tx_time));
+         s.Set("FragmentsPerSdu", g_variant_new_double(link->FragmentsPerSdu()));
+         s.Set("PdusPerSdu", g_variant_new_double(link->PdusPerSdu()));
+         s.Set("AirtimeUtilization", g_variant_new_double(link->utilization));
+         s.Set("ControllerLatencyP50", g_variant_new_uint64(link->latency.Percentile(0.5)));
+         s.Set("ControllerLatencyP99", g_variant_new_uint64(link->latency.Percentile(0.99)));
+         auto& side_window = m_windows[side_path];
+         s.Set("RecentControllerLatencyP99", g_variant_new_uint64(link->latency.Since(side_window.controller).Percentile(0.99)));
+         side_window.controller = Histogram();
+         side_window.controller.Merge(link->latency);
+      }
+   });
+
+   for (auto it = m_objects.begin(); it != m_objects.end();)
+   {
+      if (seen.count(it->first))
+      {
+         it->second->Publish(*m_om);
+         ++it;
+      }
+      else
+      {
+         m_om->RemoveInterface(it->first, it->second->Interface());
+         m_windows.erase(it->first);
+         it = m_objects.erase(it);
+      }
+   }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "FrameTiming.hh"
+#include "Histogram.hh"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+struct _GDBusConnection;
+
+namespace asha
+{
+
+class AirtimeMonitor;
+class Asha;
+class ObjectManager;
+
+// Publish the counters for every device and side on the session bus, so
+// that monitoring and the gui can read them without scraping the log. The
+// objects are listed by an ObjectManager at /org/asha, and are kept up to
+// date every Config::MetricsInterval() ms, with PropertiesChanged sent for
+// whatever changed:
+//
+//   /org/asha/dev_<hisyncid>        org.asha.DeviceMetrics1
+//   /org/asha/dev_<hisyncid>/left   org.asha.SideMetrics1
+//   /org/asha/dev_<hisyncid>/right  org.asha.SideMetrics1
+//
+// Times are in microseconds. The Recent properties only cover what happened
+// since the last update, so that they follow the latency as it changes,
+// while the rest cover the whole run. Histograms are arrays of power of two
+// buckets, where bucket n counts values from 2^(n-1) up to 2^n. The airtime
+// side properties come from an AirtimeMonitor, and stay at zero unless
+// --airtime is set and we have CAP_NET_RAW.
+class Metrics final
+{
+public:
+   Metrics(const Asha& asha);
+   ~Metrics();
+
+private:
+   class Object;
+
+   void Update();
+   Object& Get(const std::string& path, bool side);
+
+   const Asha& m_asha;
+   std::shared_ptr<_GDBusConnection> m_connection;
+   std::unique_ptr<ObjectManager> m_om;
+   std::unique_ptr<AirtimeMonitor> m_airtime;
+   std::map<std::string, std::unique_ptr<Object>> m_objects;
+
+   // What each object's histograms held at the last update.
+   struct Window
+   {
+      FrameTiming timing;
+      Histogram lateness;
+      Histogram controller;
+   };
+   std::map<std::string, Window> m_windows;
+
+   uint32_t m_name_id = 0;
+   uint32_t m_timer = 0;
+};
+
+}
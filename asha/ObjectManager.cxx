@@ -90,7 +90,7 @@ ObjectManager::ObjectManager(GDBusConnection* connection, const std::string& bas
 
 ObjectManager::~ObjectManager()
 {
-   if (m_connection && m_object_id == (uint32_t)-1)
+   if (m_connection && m_object_id != (uint32_t)-1)
    {
       g_dbus_connection_unregister_object(m_connection, m_object_id);
    }
@@ -115,11 +115,12 @@ void ObjectManager::AddInterface(const std::string& path, const std::string& ifa
 
    g_info("<-- %s ObjectManager::InterfacesAdded(%s)", m_base_path.c_str(), GVariantDump(args).c_str());
 
+   // The signals come from the manager, and name the object in the args.
    GError* err{};
    g_dbus_connection_emit_signal(
       m_connection,
       nullptr,
-      it->first.c_str(),
+      m_base_path.c_str(),
       "org.freedesktop.DBus.ObjectManager",
       "InterfacesAdded",
       args, // (oa{sa{sv}})
@@ -145,15 +146,14 @@ void ObjectManager::RemoveInterface(const std::string& path, const std::string&
             GVariantBuilder b = G_VARIANT_BUILDER_INIT(G_VARIANT_TYPE("(oas)"));
             g_variant_builder_add(&b, "o", it->first.c_str());
             GVariantBuilder ab = G_VARIANT_BUILDER_INIT(G_VARIANT_TYPE("as"));
-            for (auto& property_name: it2->GetPropertyList())
-               g_variant_builder_add(&ab, "s", property_name.c_str());
+            g_variant_builder_add(&ab, "s", iface_name.c_str());
             g_variant_builder_add(&b, "as", &ab);
 
             GError* err{};
             g_dbus_connection_emit_signal(
                m_connection,
                nullptr,
-               it->first.c_str(),
+               m_base_path.c_str(),
                "org.freedesktop.DBus.ObjectManager",
                "InterfacesRemoved",
                g_variant_builder_end(&b),
@@ -169,7 +169,7 @@ void ObjectManager::RemoveInterface(const std::string& path, const std::string&
             if (it->second.empty())
                m_objects.erase(it);
             
-            break;
+            return;
          }
       }
    }
@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <poll.h>
 
 // What other sources of information can we access?
@@ -610,3 +611,98 @@ bool RawHci::HandleFromSocket(int sock, uint16_t* handle)
    *handle = ci.hci_handle;
    return true;
 }
+
+
+std::vector<uint16_t> RawHci::DeviceIds()
+{
+   std::vector<uint16_t> ret;
+   int sock = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
+   if (sock < 0)
+      return ret;
+
+   char buffer[sizeof(hci_dev_list_req) + HCI_MAX_DEV * sizeof(hci_dev_req)] = {};
+   auto dev_list = (hci_dev_list_req*)buffer;
+   dev_list->dev_num = HCI_MAX_DEV;
+   if (ioctl(sock, HCIGETDEVLIST, buffer) == 0)
+   {
+      for (size_t i = 0; i < dev_list->dev_num; ++i)
+      {
+         if (hci_test_bit(HCI_UP, &(dev_list->dev_req[i].dev_opt)))
+            ret.push_back(dev_list->dev_req[i].dev_id);
+      }
+   }
+   close(sock);
+   return ret;
+}
+
+
+int RawHci::OpenTrafficSocket(uint16_t device_id, const std::vector<uint8_t>& events)
+{
+   int sock = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, BTPROTO_HCI);
+   if (sock < 0)
+      return -1;
+
+   // A bound raw socket puts the controller in promiscuous mode, so we see
+   // what the kernel sends as well as what it receives.
+   struct sockaddr_hci addr{};
+   addr.hci_family = AF_BLUETOOTH;
+   addr.hci_dev = device_id;
+
+   struct hci_filter filter{};
+   hci_filter_set_ptype(HCI_ACLDATA_PKT, &filter);
+   hci_filter_set_ptype(HCI_EVENT_PKT, &filter);
+   for (uint8_t event: events)
+      hci_filter_set_event(event, &filter);
+
+   int on = 1;
+   struct hci_filter applied{};
+   socklen_t size = sizeof(applied);
+   if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+       setsockopt(sock, SOL_HCI, HCI_FILTER, &filter, sizeof(filter)) < 0 ||
+       setsockopt(sock, SOL_HCI, HCI_DATA_DIR, &on, sizeof(on)) < 0 ||
+       setsockopt(sock, SOL_HCI, HCI_TIME_STAMP, &on, sizeof(on)) < 0 ||
+       getsockopt(sock, SOL_HCI, HCI_FILTER, &applied, &size) < 0 ||
+       !hci_filter_test_ptype(HCI_ACLDATA_PKT, &applied))
+   {
+      close(sock);
+      return -1;
+   }
+   return sock;
+}
+
+
+ssize_t RawHci::ReadTraffic(int sock, uint8_t* buffer, size_t size, bool* incoming, int64_t* stamp)
+{
+   struct iovec iov{ buffer, size };
+   char control[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct timeval))];
+   struct msghdr msg{};
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   ssize_t ret = recvmsg(sock, &msg, MSG_DONTWAIT);
+   if (ret < 0)
+      return -1;
+
+   *incoming = true;
+   *stamp = 0;
+   for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+   {
+      if (cmsg->cmsg_level != SOL_HCI)
+         continue;
+      if (cmsg->cmsg_type == HCI_CMSG_DIR)
+      {
+         int dir;
+         memcpy(&dir, CMSG_DATA(cmsg), sizeof(dir));
+         *incoming = dir != 0;
+      }
+      else if (cmsg->cmsg_type == HCI_CMSG_TSTAMP)
+      {
+         struct timeval tv;
+         memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+         *stamp = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+      }
+   }
+   return ret;
+}
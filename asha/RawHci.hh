@@ -41,6 +41,19 @@ public:
    bool SendConnectionUpdate(uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout, uint16_t min_ce=0, uint16_t max_ce=0);
 
    static bool HandleFromSocket(int sock, uint16_t* handle);
+   // The ids of the controllers that are up.
+   static std::vector<uint16_t> DeviceIds();
+
+   // Open a non-blocking raw socket on a controller that gets the given
+   // events, along with a copy of the ACL data sent to the controller. Each
+   // packet starts with its HCI packet type. Returns -1 on failure. Requires
+   // CAP_NET_RAW, without which the kernel quietly filters out ACL data and
+   // most events, so that is reported as a failure too.
+   static int OpenTrafficSocket(uint16_t device_id, const std::vector<uint8_t>& events);
+   // Read one packet from a traffic socket, with its direction and the time
+   // the kernel saw it, in microseconds since the epoch. Returns the size
+   // read, or -1 if there is nothing waiting.
+   static ssize_t ReadTraffic(int sock, uint8_t* buffer, size_t size, bool* incoming, int64_t* stamp);
    
 
 protected:
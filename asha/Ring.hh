@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace asha
+{
+
+// Single producer, single consumer ring of slots that are filled in place.
+// The producer claims the next free slot, fills it and commits it, which
+// lines up with BufferInterface's NextBuffer()/SendBuffer(). The consumer
+// peeks at the oldest committed slots and pops them when it is done with
+// them. Each side can be on its own thread without locking.
+//
+// The indices only ever count up, and are taken modulo the capacity, so the
+// capacity doesn't need to be a power of two.
+template <typename T>
+class Ring
+{
+public:
+   static constexpr size_t CACHE_LINE = 64;
+
+   Ring(size_t capacity):
+      m_capacity{capacity > 0 ? capacity : 1},
+      m_slots{new T[m_capacity]{}}
+   {
+   }
+   Ring(const Ring&) = delete;
+   Ring& operator=(const Ring&) = delete;
+
+   size_t Capacity() const { return m_capacity; }
+
+   // Committed slots that haven't been popped. Exact on either side's own
+   // thread, a snapshot anywhere else.
+   size_t Size() const
+   {
+      return m_write.load(std::memory_order_relaxed) - m_read.load(std::memory_order_relaxed);
+   }
+
+   // Producer: the next free slot, or nullptr if the ring is full. The slot
+   // belongs to the producer until Commit().
+   T* Claim()
+   {
+      size_t write = m_write.load(std::memory_order_relaxed);
+      if (write - m_read.load(std::memory_order_acquire) >= m_capacity)
+         return nullptr;
+      return &m_slots[write % m_capacity];
+   }
+
+   // Producer: hand the claimed slot to the consumer.
+   void Commit()
+   {
+      m_write.store(m_write.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   // Consumer: committed slots that can be peeked at.
+   size_t Available() const
+   {
+      return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_relaxed);
+   }
+
+   // Consumer: the i'th oldest committed slot. i must be less than
+   // Available().
+   T& Peek(size_t i = 0)
+   {
+      return m_slots[(m_read.load(std::memory_order_relaxed) + i) % m_capacity];
+   }
+
+   // Consumer: give the oldest count slots back to the producer.
+   void Pop(size_t count = 1)
+   {
+      m_read.store(m_read.load(std::memory_order_relaxed) + count, std::memory_order_release);
+   }
+
+private:
+   const size_t m_capacity;
+   const std::unique_ptr<T[]> m_slots;
+
+   // Each index gets a cache line to itself, so that the two sides don't
+   // bounce one line between them.
+   alignas(CACHE_LINE) std::atomic<size_t> m_read{0};
+   alignas(CACHE_LINE) std::atomic<size_t> m_write{0};
+};
+
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+#include <glib.h>
+
+namespace asha
+{
+
+// Logging for the audio threads. g_info() formats, takes a lock and writes
+// to stderr before it returns, which is too slow for a thread that has to
+// deliver a frame every 20ms. Instead, messages are formatted into a
+// preallocated ring that the main loop passes on to g_info() a few at a time.
+// Events that can happen on every frame, like a full socket, are only
+// counted, and the main loop logs the counts once a second.
+//
+// A frame BLOCKED on a full socket is kept for the side, and sent once the
+// socket drains. DROPPED is only for frames a side never gets.
+//
+// Any thread can log. Nothing here allocates, locks or makes a syscall. If
+// the ring is full, the message is thrown away and counted instead.
+class RtLog final
+{
+public:
+   // What happened to a frame written to one side.
+   enum Event { BLOCKED, DROPPED, TRUNCATED, OVERSIZED, NOT_READY, DISCONNECTED, EVENT_COUNT };
+
+   static constexpr size_t CAPACITY = 128;
+   static constexpr size_t MESSAGE_SIZE = 120;
+   // How often the main loop looks at the ring, and how much it passes on
+   // each time.
+   static constexpr unsigned DRAIN_INTERVAL_MS = 100;
+   static constexpr size_t DRAIN_MESSAGES = 10;
+
+   static void Info(const char* format, ...) __attribute__((format(printf, 1, 2)))
+   {
+      va_list args;
+      va_start(args, format);
+      Push(false, format, args);
+      va_end(args);
+   }
+
+   static void Warning(const char* format, ...) __attribute__((format(printf, 1, 2)))
+   {
+      va_list args;
+      va_start(args, format);
+      Push(true, format, args);
+      va_end(args);
+   }
+
+   static void Count(Event e, bool right)
+   {
+      s_counts[right][e].fetch_add(1, std::memory_order_relaxed);
+   }
+
+   // Start passing things on from the main loop. Safe to call more than
+   // once. (main thread)
+   static void Start()
+   {
+      if (s_timer)
+         return;
+      s_timer = g_timeout_add(DRAIN_INTERVAL_MS, [](gpointer) -> gboolean {
+         Drain(DRAIN_MESSAGES, [](bool warning, const char* text) {
+            if (warning)
+               g_warning("%s", text);
+            else
+               g_info("%s", text);
+         });
+         if (++s_ticks * DRAIN_INTERVAL_MS >= 1000)
+         {
+            s_ticks = 0;
+            LogCounts();
+         }
+         return G_SOURCE_CONTINUE;
+      }, nullptr);
+   }
+
+   // Hand up to max messages to out, oldest first. Returns how many.
+   // Only one thread may drain. (main thread)
+   static size_t Drain(size_t max, void (*out)(bool warning, const char* text))
+   {
+      size_t count = 0;
+      for (; count < max; ++count)
+      {
+         Entry& e = s_entries[s_read % CAPACITY];
+         size_t lap = s_read / CAPACITY;
+         if (e.state.load(std::memory_order_acquire) != 2 * lap + 1)
+            break;
+         out(e.warning, e.text);
+         e.state.store(2 * (lap + 1), std::memory_order_release);
+         ++s_read;
+      }
+
+      size_t lost = s_lost.exchange(0, std::memory_order_relaxed);
+      if (lost)
+      {
+         char text[64];
+         snprintf(text, sizeof(text), "%zu audio thread log messages were lost", lost);
+         out(true, text);
+      }
+      return count;
+   }
+
+   // How many times an event has happened.
+   static size_t Total(Event e, bool right)
+   {
+      return s_counts[right][e].load(std::memory_order_relaxed);
+   }
+
+   // The count of an event since the last time it was taken. (main thread)
+   static size_t TakeCount(Event e, bool right)
+   {
+      size_t total = Total(e, right);
+      size_t count = total - s_taken[right][e];
+      s_taken[right][e] = total;
+      return count;
+   }
+
+private:
+   static void Push(bool warning, const char* format, va_list args)
+   {
+      // Each slot is free for lap n of the ring when its state is 2n, and
+      // full when it is 2n+1. Producers race for the write index; the one
+      // that wins owns the slot until it publishes the new state.
+      size_t pos = s_write.load(std::memory_order_relaxed);
+      Entry* e;
+      for (;;)
+      {
+         e = &s_entries[pos % CAPACITY];
+         size_t free = 2 * (pos / CAPACITY);
+         size_t state = e->state.load(std::memory_order_acquire);
+         if (state == free)
+         {
+            if (s_write.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+               break;
+         }
+         else if (state < free)
+         {
+            // Still holding a message from the last lap.
+            s_lost.fetch_add(1, std::memory_order_relaxed);
+            return;
+         }
+         else
+            pos = s_write.load(std::memory_order_relaxed);
+      }
+
+      e->warning = warning;
+      vsnprintf(e->text, MESSAGE_SIZE, format, args);
+      e->state.store(2 * (pos / CAPACITY) + 1, std::memory_order_release);
+   }
+
+   static void LogCounts()
+   {
+      static constexpr const char* NAMES[EVENT_COUNT] = {
+         "blocked on a full socket", "dropped", "truncated", "oversized", "not ready", "disconnected"
+      };
+      for (bool right: { false, true })
+      {
+         std::string line;
+         for (size_t e = 0; e < EVENT_COUNT; ++e)
+         {
+            size_t count = TakeCount((Event)e, right);
+            if (count)
+               line += (line.empty() ? "" : ", ") + std::to_string(count) + " " + NAMES[e];
+         }
+         if (!line.empty())
+            g_info("%s frames in the last second: %s", right ? "Right" : "Left", line.c_str());
+      }
+   }
+
+   // Zeroed as statics, so every slot starts free for the first lap.
+   struct Entry
+   {
+      std::atomic<size_t> state;
+      bool warning;
+      char text[MESSAGE_SIZE];
+   };
+
+   inline static Entry s_entries[CAPACITY];
+   alignas(64) inline static std::atomic<size_t> s_write{0};
+   alignas(64) inline static size_t s_read = 0;
+   inline static std::atomic<size_t> s_lost{0};
+   inline static std::atomic<size_t> s_counts[2][EVENT_COUNT];
+   inline static size_t s_taken[2][EVENT_COUNT];
+
+   inline static guint s_timer = 0;
+   inline static unsigned s_ticks = 0;
+};
+
+}
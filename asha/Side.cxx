@@ -1,10 +1,13 @@
 #include "Side.hh"
 
 #include "Config.hh"
+#include "FlightRecorder.hh"
 #include "GVariantDump.hh"
 #include "HexDump.hh"
 #include "RawHci.hh"
+#include "RtLog.hh"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <sstream>
@@ -13,6 +16,7 @@
 #include <bluetooth/l2cap.h>
 #include <glib-2.0/glib.h>
 #include <gio/gio.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -110,6 +114,8 @@ std::shared_ptr<Side> Side::CreateIfValid(const Bluetooth::BluezDevice& device)
 
 Side::~Side()
 {
+   if (m_hci_handle != (uint16_t)-1)
+      FlightRecorder::Unwatch(m_hci_index, m_hci_handle);
    if (m_sock_cancellable)
       g_cancellable_cancel(m_sock_cancellable.get());
    if (m_connect_failed_timeout != -1)
@@ -177,9 +183,8 @@ void Side::ReadProperties()
             //    self->m_OnConnectionReady();
             // }
          }
-         // TODO: once we have the properties, we can theoretically set
-         //       a spa_latency_build() POD to indicate what latency the
-         //       hearing devices expect.
+         // Asha::SideReady() passes render_delay on to pipewire as the
+         // stream latency.
       }
       else
       {
@@ -368,6 +373,10 @@ void Side::ConnectSucceeded()
    g_debug("Connection Succeeded");
    // TODO: make these async
    RawHci hci(m_mac, g_socket_get_fd(m_sock.get()));
+   m_hci_index = hci.DeviceId();
+   m_hci_handle = hci.ConnectionHandle();
+   if (m_hci_handle != (uint16_t)-1)
+      FlightRecorder::Watch(m_hci_index, m_hci_handle);
    if (Config::Phy1m() || Config::Phy2m())
    {
       // This requires CAP_NET_RAW
@@ -541,40 +550,89 @@ Side::WriteStatus Side::WriteAudioFrame(const AudioPacket& packet)
 {
    // Write 20ms of data. Should be exactly 160 bytes in size.
    static_assert(sizeof(packet) == 161, "We can only send 161 byte audio packets");
+   if (!AudioReady())
+      return NOT_READY;
+
+   int bytes_sent = g_socket_send(m_sock.get(), (const char*)&packet, sizeof(packet), m_sock_cancellable.get(), nullptr);
+   return AudioFrameSent(bytes_sent >= 0 ? bytes_sent : -errno);
+}
+
+bool Side::AudioReady() const
+{
+   return m_sock && m_ready_to_receive_audio;
+}
+
+// On the audio thread, so log through RtLog. Device counts what went wrong.
+Side::WriteStatus Side::AudioFrameSent(ssize_t result)
+{
    WriteStatus ret = NOT_READY;
-   if (m_sock && m_ready_to_receive_audio)
+   if (result == sizeof(AudioPacket))
+      ret = WRITE_OK;
+   else if (result > (ssize_t)sizeof(AudioPacket))
    {
-      int bytes_sent = g_socket_send(m_sock.get(), (const char*)&packet, sizeof(packet), m_sock_cancellable.get(), nullptr);
-      int err = errno;
-      if (bytes_sent == sizeof(packet))
-         ret = WRITE_OK;
-      else if (bytes_sent > (int)sizeof(packet))
-      {
-         g_warning("Ok, this has to be a kernel bug. We tried to send %zu bytes, but really sent %d", sizeof(packet), bytes_sent);
-         ret = OVERSIZED;
-      }
-      else if (bytes_sent >= 0)
-      {
-         g_warning("Only sent %d out of %zu bytes", bytes_sent, sizeof(packet));
-         ret = TRUNCATED;
-      }
-      else if (err == EAGAIN || err == EWOULDBLOCK)
-      {
-         g_info("Dropping frame for %s", Description().c_str());
-         ret = BUFFER_FULL;
-      }
-      else
-      {
-         g_warning("Disconnected from %s: (%s)", Description().c_str(), strerror(err));
+      RtLog::Warning("Ok, this has to be a kernel bug. We tried to send %zu bytes, but really sent %zd", sizeof(AudioPacket), result);
+      ret = OVERSIZED;
+   }
+   else if (result >= 0)
+      ret = TRUNCATED;
+   else if (result == -EAGAIN || result == -EWOULDBLOCK)
+      ret = BUFFER_FULL;
+   else
+   {
+      RtLog::Warning("Disconnected from %s: (%s)", m_name.c_str(), strerror(-result));
+      if (m_sock)
          g_socket_close(m_sock.get(), nullptr);
-         m_sock.reset();
-         m_ready_to_receive_audio = false;
-         ret = DISCONNECTED;
-      }
+      m_sock.reset();
+      m_ready_to_receive_audio = false;
+      ret = DISCONNECTED;
    }
    return ret;
 }
 
+int Side::QueuedBytes()
+{
+   int fd = Sock();
+   if (fd < 0)
+      return -1;
+   if (m_sndbuf <= 0)
+   {
+      socklen_t len = sizeof(m_sndbuf);
+      if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &m_sndbuf, &len) < 0)
+         return -1;
+   }
+   // Bluetooth sockets answer TIOCOUTQ with the free space in the send
+   // buffer, not the queued bytes like other sockets do.
+   int space = 0;
+   if (ioctl(fd, TIOCOUTQ, &space) < 0)
+      return -1;
+   return std::max(0, m_sndbuf - space);
+}
+
+void Side::SampleQueue()
+{
+   int bytes = QueuedBytes();
+   int before = m_bytes_before;
+   m_bytes_before = -1;
+   if (bytes < 0)
+      return;
+   if (before >= 0 && bytes - before > m_frame_bytes)
+      m_frame_bytes = bytes - before;
+   m_queue_depth.Add(StoreQueuedFrames(bytes));
+}
+
+size_t Side::CountQueuedFrames()
+{
+   int bytes = QueuedBytes();
+   return bytes < 0 ? QueuedFrames() : StoreQueuedFrames(bytes);
+}
+
+size_t Side::StoreQueuedFrames(int bytes)
+{
+   size_t frames = (bytes + m_frame_bytes / 2) / m_frame_bytes;
+   __atomic_store_n(&m_queued_frames, frames, __ATOMIC_RELAXED);
+   return frames;
+}
+
 bool Side::UpdateOtherConnected(bool connected)
 {
    const char* side = Left() ? "left " : "right";
@@ -3,8 +3,10 @@
 #include "AudioPacket.hh"
 #include "Bluetooth.hh"
 #include "Characteristic.hh"
+#include "Histogram.hh"
 #include <string>
 #include <vector>
+#include <sys/types.h>
 
 struct _GTimer;
 struct _GSocket;
@@ -60,6 +62,24 @@ public:
    virtual bool Start(bool otherstate, std::function<void(bool)> OnDone);
    virtual bool Stop(std::function<void(bool)> OnDone);
    virtual WriteStatus WriteAudioFrame(const AudioPacket& packet);
+   // For sending audio on Sock() without WriteAudioFrame(). Check that the
+   // side will take audio first, then pass the result of send() (or -errno)
+   // back to get the same status and handling that WriteAudioFrame() gives.
+   virtual bool AudioReady() const;
+   WriteStatus AudioFrameSent(ssize_t result);
+
+   // Bytes waiting in the kernel to go out to the device, or -1 if unknown.
+   virtual int QueuedBytes();
+   // Record the send queue depth. Called before and after each frame is
+   // written, to measure what a frame costs. (audio thread)
+   void QueueBeforeWrite() { m_bytes_before = QueuedBytes(); }
+   void SampleQueue();
+   // Look at the send queue again, without adding to QueueDepth(). (audio
+   // thread)
+   size_t CountQueuedFrames();
+   // Frames in the send queue at the last sample, and all the samples so far.
+   size_t QueuedFrames() const { return __atomic_load_n(&m_queued_frames, __ATOMIC_RELAXED); }
+   const Histogram& QueueDepth() const { return m_queue_depth; }
    virtual bool UpdateOtherConnected(bool connected);
    virtual bool UpdateConnectionParameters(uint8_t interval);
 
@@ -75,7 +95,7 @@ public:
    };
    SideState State() const { return m_state; }
 
-   int Sock() const;
+   virtual int Sock() const;
 
    // Must be called before Connect()
    void SetConnectionParameters(uint16_t interval, uint16_t latency, uint16_t timeout, uint16_t celen)
@@ -92,6 +112,10 @@ public:
    uint8_t MicrophoneVolume() const { return m_microphone_volume; }
    uint8_t Battery() const { return m_battery; }
    int16_t Rssi() const { return m_rssi; }
+   // The controller and connection handle behind the socket, or -1 if we
+   // couldn't find them.
+   uint16_t HciIndex() const { return m_hci_index; }
+   uint16_t ConnectionHandle() const { return m_hci_handle; }
 
    void SetUpdateCallback(std::function<void()> fn) const { m_updated = fn; }
 
@@ -134,6 +158,7 @@ private:
    void ConnectSucceeded();
    void ConnectFailed(const struct _GError* err);
    void ConnectionReady();
+   size_t StoreQueuedFrames(int bytes);
 
    struct
    {
@@ -166,6 +191,14 @@ private:
    std::function<void()> m_OnConnectionReady;
    bool m_connection_ready = false;
    bool m_ready_to_receive_audio = false;
+   int m_sndbuf = 0;
+   // The kernel charges a frame more than its 161 bytes. Each write adds
+   // that, less whatever went out meanwhile, so the largest growth seen
+   // across a write is the best estimate.
+   int m_frame_bytes = sizeof(AudioPacket);
+   int m_bytes_before = -1;
+   size_t m_queued_frames = 0;
+   Histogram m_queue_depth;
    unsigned int m_connect_failed_timeout = -1;
    SideState m_state = INIT;
 
@@ -182,6 +215,8 @@ private:
    uint8_t m_battery = 0;
    uint8_t m_microphone_volume = 0;
    int16_t m_rssi = 0;
+   uint16_t m_hci_index = -1;
+   uint16_t m_hci_handle = -1;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Clock.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <set>
+
+namespace asha
+{
+
+// A Clock for buffer_sim and the unit tests. Time only moves when the
+// caller moves it, and it only moves once every delivery thread is asleep,
+// so a run is the same every time.
+class SimClock: public Clock
+{
+public:
+   SimClock(uint64_t now): m_now{now} {}
+
+   virtual uint64_t Now() const override
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_now;
+   }
+
+   virtual void SleepUntil(uint64_t deadline) const override
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      auto it = m_deadlines.insert(deadline);
+      m_settled.notify_all();
+      m_wake.wait(lock, [&]() { return m_released || m_now >= deadline; });
+      m_deadlines.erase(it);
+   }
+
+   // The earliest time a sleeping thread wants to wake.
+   uint64_t NextDeadline() const
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_deadlines.empty() ? std::numeric_limits<uint64_t>::max() : *m_deadlines.begin();
+   }
+
+   // Move the time forward, and wait until all of the given number of
+   // threads have done what they had to and gone back to sleep.
+   void AdvanceTo(uint64_t now, size_t threads)
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_now = std::max(m_now, now);
+      m_wake.notify_all();
+      m_settled.wait(lock, [&]() {
+         return m_deadlines.size() == threads && (threads == 0 || *m_deadlines.begin() > m_now);
+      });
+   }
+
+   // Let every sleeper go, so that the threads can be joined.
+   void Release()
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_released = true;
+      m_wake.notify_all();
+   }
+
+private:
+   mutable std::mutex m_mutex;
+   mutable std::condition_variable m_wake;
+   mutable std::condition_variable m_settled;
+   mutable std::multiset<uint64_t> m_deadlines;
+   uint64_t m_now;
+   bool m_released = false;
+};
+
+}
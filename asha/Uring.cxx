@@ -0,0 +1,206 @@
+#include "Uring.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace asha;
+
+namespace
+{
+   int io_uring_setup(unsigned entries, io_uring_params* params)
+   {
+      return syscall(__NR_io_uring_setup, entries, params);
+   }
+
+   int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+   {
+      return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+   }
+
+   int io_uring_register(int fd, unsigned opcode, void* arg, unsigned count)
+   {
+      return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+   }
+
+   // IORING_OP_SEND and the probe both came in 5.6. Before that, every send
+   // would complete with -EINVAL, which looks like a dead socket.
+   bool SendSupported(int fd)
+   {
+      constexpr unsigned OPS = 256;
+      std::vector<uint64_t> buf((sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op)) / sizeof(uint64_t));
+      io_uring_probe* probe = (io_uring_probe*)buf.data();
+      if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, OPS) < 0)
+         return false;
+      return IORING_OP_SEND <= probe->last_op &&
+             (probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED);
+   }
+
+   template <typename T>
+   T* Offset(void* base, uint32_t offset)
+   {
+      return (T*)((uint8_t*)base + offset);
+   }
+}
+
+
+Uring::Uring(unsigned entries)
+{
+   io_uring_params params{};
+   int fd = io_uring_setup(entries, &params);
+   if (fd < 0)
+      return;
+   if (!SendSupported(fd))
+   {
+      close(fd);
+      return;
+   }
+
+   m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+   bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+   if (single_mmap)
+      m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+
+   m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+   if (m_sq_ring == MAP_FAILED)
+   {
+      m_sq_ring = nullptr;
+      close(fd);
+      return;
+   }
+   if (single_mmap)
+      m_cq_ring = m_sq_ring;
+   else
+   {
+      m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (m_cq_ring == MAP_FAILED)
+      {
+         m_cq_ring = nullptr;
+         munmap(m_sq_ring, m_sq_ring_size);
+         m_sq_ring = nullptr;
+         close(fd);
+         return;
+      }
+   }
+   m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+   void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+   if (sqes == MAP_FAILED)
+   {
+      if (m_cq_ring != m_sq_ring)
+         munmap(m_cq_ring, m_cq_ring_size);
+      munmap(m_sq_ring, m_sq_ring_size);
+      m_sq_ring = m_cq_ring = nullptr;
+      close(fd);
+      return;
+   }
+   m_sqes = (io_uring_sqe*)sqes;
+
+   m_sq_tail = Offset<unsigned>(m_sq_ring, params.sq_off.tail);
+   m_sq_mask = *Offset<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+   m_sq_entries = params.sq_entries;
+   m_sq_array = Offset<unsigned>(m_sq_ring, params.sq_off.array);
+
+   m_cq_head = Offset<unsigned>(m_cq_ring, params.cq_off.head);
+   m_cq_tail = Offset<unsigned>(m_cq_ring, params.cq_off.tail);
+   m_cq_mask = *Offset<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+   m_cqes = Offset<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+
+   m_fd = fd;
+}
+
+
+Uring::~Uring()
+{
+   if (m_sqes)
+      munmap(m_sqes, m_sqes_size);
+   if (m_cq_ring && m_cq_ring != m_sq_ring)
+      munmap(m_cq_ring, m_cq_ring_size);
+   if (m_sq_ring)
+      munmap(m_sq_ring, m_sq_ring_size);
+   if (m_fd >= 0)
+      close(m_fd);
+}
+
+
+bool Uring::QueueSend(int fd, const void* data, size_t size)
+{
+   // Submit() always empties the ring, so m_queued is all that's in it.
+   if (!Valid() || m_queued >= m_sq_entries)
+      return false;
+
+   unsigned tail = *m_sq_tail;
+   unsigned idx = tail & m_sq_mask;
+   io_uring_sqe& sqe = m_sqes[idx];
+   memset(&sqe, 0, sizeof(sqe));
+   sqe.opcode = IORING_OP_SEND;
+   sqe.fd = fd;
+   sqe.addr = (uint64_t)(uintptr_t)data;
+   sqe.len = size;
+   // MSG_DONTWAIT makes a full socket complete with -EAGAIN, rather than
+   // io_uring waiting in the background for it to drain.
+   sqe.msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+   sqe.user_data = m_queued;
+   m_sq_array[idx] = idx;
+   __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+   ++m_queued;
+   return true;
+}
+
+
+int Uring::Submit(int* results)
+{
+   unsigned count = m_queued;
+   m_queued = 0;
+   if (count == 0)
+      return 0;
+
+   for (unsigned i = 0; i < count; ++i)
+      results[i] = -ECANCELED;
+
+   // The sends don't block, so the completions are normally posted before
+   // io_uring_enter() returns. It only fails with EINTR when nothing was
+   // submitted, so keep at it until everything is in, or there would be
+   // nothing to wait for below.
+   unsigned submitted = 0;
+   while (submitted < count)
+   {
+      int ret = io_uring_enter(m_fd, count - submitted, count, IORING_ENTER_GETEVENTS);
+      if (ret < 0 && errno != EINTR)
+         return -errno;
+      if (ret == 0)
+         return -EIO;
+      if (ret > 0)
+         submitted += ret;
+   }
+
+   unsigned done = 0;
+   while (done < count)
+   {
+      unsigned head = *m_cq_head;
+      unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head)
+      {
+         const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+         if (cqe.user_data < count)
+            results[cqe.user_data] = cqe.res;
+         ++done;
+      }
+      __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+      if (done < count)
+      {
+         int ret = io_uring_enter(m_fd, 0, count - done, IORING_ENTER_GETEVENTS);
+         if (ret < 0 && errno != EINTR)
+            return -errno;
+      }
+   }
+   return count;
+}
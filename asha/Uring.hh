@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace asha
+{
+
+// Just enough io_uring to send a few packets with a single syscall, without
+// depending on liburing. Device uses it to write to both sides at once.
+//
+// Not thread safe. Only one thread should queue and submit.
+class Uring
+{
+public:
+   Uring(unsigned entries = 8);
+   ~Uring();
+   Uring(const Uring&) = delete;
+   Uring& operator=(const Uring&) = delete;
+
+   // False if the kernel doesn't have io_uring, it is disabled, or it is too
+   // old to send() with it.
+   bool Valid() const { return m_fd >= 0; }
+
+   // Queue a non blocking send(). data has to stay valid until Submit()
+   // returns. Returns false if the queue is full.
+   bool QueueSend(int fd, const void* data, size_t size);
+
+   // Submit everything queued, and wait for all of it to finish. results[i]
+   // gets what send() returned for the i'th QueueSend(), or -errno. Returns
+   // the number of results, or -errno if the submission itself failed, in
+   // which case the ring is in an unknown state and shouldn't be used again.
+   int Submit(int* results);
+
+private:
+   int m_fd = -1;
+
+   void* m_sq_ring = nullptr;
+   void* m_cq_ring = nullptr;
+   size_t m_sq_ring_size = 0;
+   size_t m_cq_ring_size = 0;
+   io_uring_sqe* m_sqes = nullptr;
+   size_t m_sqes_size = 0;
+
+   unsigned* m_sq_tail = nullptr;
+   unsigned m_sq_mask = 0;
+   unsigned m_sq_entries = 0;
+   unsigned* m_sq_array = nullptr;
+
+   unsigned* m_cq_head = nullptr;
+   unsigned* m_cq_tail = nullptr;
+   unsigned m_cq_mask = 0;
+   io_uring_cqe* m_cqes = nullptr;
+
+   unsigned m_queued = 0;
+};
+
+}
@@ -1,5 +1,8 @@
 #include "../Side.hh"
 
+#include <sys/socket.h>
+#include <unistd.h>
+
 
 namespace asha
 {
@@ -7,7 +10,16 @@ namespace asha
 class MockSide: public Side
 {
 public:
-   MockSide(): Side("MockSide") {}
+   MockSide(): Side("MockSide")
+   {
+      // Device waits on the socket with epoll once a write comes back full.
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, m_sock);
+   }
+   ~MockSide()
+   {
+      close(m_sock[0]);
+      close(m_sock[1]);
+   }
    using Side::SetProps;
    using Side::SetState;
    using Side::OnStatusNotify;
@@ -36,9 +48,11 @@ public:
    }
    virtual WriteStatus WriteAudioFrame(const AudioPacket& packet)
    {
-      m_last_audio_seq = packet.seq;
-      return WRITE_OK;
+      if (m_write_status == WRITE_OK)
+         m_sent.push_back(packet.seq);
+      return m_write_status;
    }
+   virtual int Sock() const { return m_sock[0]; }
    virtual bool UpdateOtherConnected(bool connected) { return LogCall(OTHER, connected); }
    virtual bool UpdateConnectionParameters(uint8_t interval) { return LogCall(PARAM, interval); }
 
@@ -59,6 +73,23 @@ public:
    bool Called(Call c) { return m_call[c].called; }
    bool Arg(Call c) { return m_call[c].arg; }
    void FinishCall(Call c, bool status) { return m_call[c].finish(status); }
+   // What the next writes return, and the seq of every frame written.
+   void SetWriteStatus(WriteStatus status) { m_write_status = status; }
+   const std::vector<uint8_t>& Sent() const { return m_sent; }
+   // Really fill the socket that Device waits on, or read everything back
+   // out of it from the other end.
+   void FillSocket()
+   {
+      char packet[161] = {};
+      while (send(m_sock[0], packet, sizeof(packet), MSG_DONTWAIT) > 0)
+         ;
+   }
+   void DrainSocket()
+   {
+      char packet[161];
+      while (recv(m_sock[1], packet, sizeof(packet), MSG_DONTWAIT) > 0)
+         ;
+   }
 
 protected:
    bool LogCall(Call c, std::function<void(bool)> f)
@@ -77,7 +108,9 @@ protected:
    }
 
 private:
-   uint16_t m_last_audio_seq = 0;
+   int m_sock[2] = {-1, -1};
+   WriteStatus m_write_status = WRITE_OK;
+   std::vector<uint8_t> m_sent;
 
    struct CallInfo
    {
@@ -0,0 +1,221 @@
+#include "unit_test.hh"
+
+#include "../AirtimeMonitor.hh"
+
+#include <vector>
+
+using namespace asha;
+
+static constexpr uint16_t INDEX = 0;
+
+static std::vector<uint8_t> Acl(uint16_t handle, uint8_t pb, uint16_t length)
+{
+   std::vector<uint8_t> p = {
+      0x02,
+      (uint8_t)handle, (uint8_t)(handle >> 8 | pb << 4),
+      (uint8_t)length, (uint8_t)(length >> 8)
+   };
+   p.resize(p.size() + length);
+   return p;
+}
+
+static std::vector<uint8_t> Completed(uint16_t handle, uint16_t count)
+{
+   return { 0x04, 0x13, 5, 1, (uint8_t)handle, (uint8_t)(handle >> 8), (uint8_t)count, (uint8_t)(count >> 8) };
+}
+
+static std::vector<uint8_t> DataLength(uint16_t handle, uint16_t octets, uint16_t time)
+{
+   return {
+      0x04, 0x3e, 11, 0x07,
+      (uint8_t)handle, (uint8_t)(handle >> 8),
+      (uint8_t)octets, (uint8_t)(octets >> 8),
+      (uint8_t)time, (uint8_t)(time >> 8),
+      27, 0, 0x48, 0x01
+   };
+}
+
+static std::vector<uint8_t> Phy(uint16_t handle, uint8_t phy)
+{
+   return { 0x04, 0x3e, 6, 0x0c, 0x00, (uint8_t)handle, (uint8_t)(handle >> 8), phy, phy };
+}
+
+static std::vector<uint8_t> Disconnect(uint16_t handle)
+{
+   return { 0x04, 0x05, 4, 0x00, (uint8_t)handle, (uint8_t)(handle >> 8), 0x13 };
+}
+
+static void Send(AirtimeMonitor& m, const std::vector<uint8_t>& p, int64_t stamp, bool incoming = true)
+{
+   m.Packet(INDEX, p.data(), p.size(), incoming, stamp);
+}
+
+void test_PduTime()
+{
+   // 41 bytes with a 27 byte payload at 1µs a bit, the 10 byte empty PDU
+   // back, and two 150µs gaps.
+   ASSERT_TRUE(AirtimeMonitor::PduTime(1, 27) == 328 + 80 + 300) << AirtimeMonitor::PduTime(1, 27);
+   // Twice as fast, with a longer preamble.
+   ASSERT_TRUE(AirtimeMonitor::PduTime(2, 27) == 168 + 44 + 300) << AirtimeMonitor::PduTime(2, 27);
+   ASSERT_TRUE(AirtimeMonitor::PduTime(3, 27) > AirtimeMonitor::PduTime(1, 27));
+   ASSERT_TRUE(AirtimeMonitor::PduTime(2, 251) < AirtimeMonitor::PduTime(1, 251));
+}
+
+void test_Dle()
+{
+   // One audio frame is a 167 byte L2CAP PDU. With DLE and 2M PHY it goes
+   // out in one LL PDU.
+   AirtimeMonitor m;
+   Send(m, DataLength(0x40, 251, 2120), 0);
+   Send(m, Phy(0x40, 2), 0);
+   // Something sent before we started.
+   Send(m, Completed(0x40, 1), 500);
+   Send(m, Acl(0x40, 0, 167), 1000, false);
+
+   auto* link = m.Get(INDEX, 0x40);
+   ASSERT_TRUE(link);
+   ASSERT_TRUE(link->phy == 2);
+   ASSERT_TRUE(link->tx_octets == 251);
+   ASSERT_TRUE(link->tx_time == 2120);
+   ASSERT_TRUE(link->sdus == 1);
+   ASSERT_TRUE(link->in_flight.size() == 1);
+   ASSERT_TRUE(link->FragmentsPerSdu() == 1.0);
+   ASSERT_TRUE(link->PdusPerSdu() == 1.0);
+
+   Send(m, Completed(0x40, 1), 3500);
+   ASSERT_TRUE(link->completed == 2);
+   ASSERT_TRUE(link->in_flight.empty());
+   ASSERT_TRUE(link->latency.Percentile(0.5) == 2500) << link->latency.Percentile(0.5);
+   ASSERT_TRUE(link->airtime == AirtimeMonitor::PduTime(2, 167));
+
+   // Other connections don't get mixed in.
+   Send(m, Completed(0x41, 1), 4000);
+   ASSERT_TRUE(link->completed == 2);
+   ASSERT_TRUE(!m.Get(INDEX, 0x41));
+}
+
+void test_NoDle()
+{
+   // Without DLE, the same frame takes 7 LL PDUs on 1M.
+   AirtimeMonitor m;
+   Send(m, Acl(0x41, 0, 167), 0, false);
+   auto* link = m.Get(INDEX, 0x41);
+   ASSERT_TRUE(link);
+   ASSERT_TRUE(link->PdusPerSdu() == 7.0) << link->PdusPerSdu();
+   ASSERT_TRUE(link->FragmentsPerSdu() == 1.0) << link->FragmentsPerSdu();
+
+   // The first completion might have been for something sent before we
+   // started, so it isn't timed.
+   Send(m, Completed(0x41, 1), 10000);
+   ASSERT_TRUE(link->completed == 1);
+   ASSERT_TRUE(link->latency.Total() == 0);
+   ASSERT_TRUE(link->airtime == 0);
+
+   Send(m, Acl(0x41, 0, 167), 20000, false);
+   Send(m, Completed(0x41, 1), 30000);
+   ASSERT_TRUE(link->airtime == 6 * AirtimeMonitor::PduTime(1, 27) + AirtimeMonitor::PduTime(1, 5));
+
+   // When the kernel splits the frame into two ACL packets, it is still one
+   // SDU. Incoming ACL data isn't counted.
+   Send(m, Acl(0x41, 0, 100), 40000, false);
+   Send(m, Acl(0x41, 1, 67), 40000, false);
+   Send(m, Acl(0x41, 2, 20), 40000, true);
+   ASSERT_TRUE(link->sdus == 3);
+   ASSERT_TRUE(link->fragments == 4);
+   ASSERT_TRUE(link->pdus == 7 + 7 + 4 + 3) << link->pdus;
+   ASSERT_TRUE(link->FragmentsPerSdu() == 4.0 / 3) << link->FragmentsPerSdu();
+
+   // Completed in two events.
+   Send(m, Completed(0x41, 1), 45000);
+   Send(m, Completed(0x41, 1), 50000);
+   ASSERT_TRUE(link->completed == 4);
+   ASSERT_TRUE(link->latency.Total() == 3);
+   ASSERT_TRUE(link->latency.Max() == 10000);
+}
+
+void test_AlreadyInFlight()
+{
+   // Two packets were already in the controller when we started, and the
+   // first one we see goes out after them.
+   AirtimeMonitor m;
+   Send(m, Acl(0x40, 0, 167), 0, false);
+   Send(m, Completed(0x40, 2), 5000);
+   Send(m, Completed(0x40, 1), 10000);
+   auto* link = m.Get(INDEX, 0x40);
+   ASSERT_TRUE(link->completed == 3);
+   ASSERT_TRUE(link->latency.Total() == 0) << link->latency.Total();
+
+   // From here on they line up.
+   Send(m, Acl(0x40, 0, 167), 20000, false);
+   Send(m, Completed(0x40, 1), 24000);
+   ASSERT_TRUE(link->latency.Total() == 1) << link->latency.Total();
+   ASSERT_TRUE(link->latency.Max() == 4000) << link->latency.Max();
+}
+
+void test_NotDrained()
+{
+   // The first completion leaves some of what we saw outstanding, so it
+   // could still be draining packets sent before we started. Nothing sent
+   // until the rest is done is timed either.
+   AirtimeMonitor m;
+   Send(m, Acl(0x40, 0, 167), 0, false);
+   Send(m, Acl(0x40, 0, 167), 0, false);
+   Send(m, Completed(0x40, 1), 5000);
+   auto* link = m.Get(INDEX, 0x40);
+   ASSERT_TRUE(!link->synced);
+   Send(m, Acl(0x40, 0, 167), 6000, false);
+   Send(m, Completed(0x40, 1), 10000);
+   ASSERT_TRUE(!link->synced);
+   Send(m, Completed(0x40, 1), 12000);
+   ASSERT_TRUE(link->synced);
+   ASSERT_TRUE(link->completed == 3);
+   ASSERT_TRUE(link->latency.Total() == 0) << link->latency.Total();
+   ASSERT_TRUE(link->airtime == 0) << link->airtime;
+
+   Send(m, Acl(0x40, 0, 167), 20000, false);
+   Send(m, Completed(0x40, 1), 23000);
+   ASSERT_TRUE(link->latency.Total() == 1) << link->latency.Total();
+   ASSERT_TRUE(link->latency.Max() == 3000) << link->latency.Max();
+}
+
+void test_Utilization()
+{
+   AirtimeMonitor m;
+   Send(m, Phy(0x40, 2), 0);
+   Send(m, Completed(0x40, 1), 0);
+   m.Tick(1000000);
+
+   // 50 frames a second, as we stream.
+   for (int i = 0; i < 50; ++i)
+   {
+      Send(m, Acl(0x40, 0, 167), i * 20000, false);
+      Send(m, Completed(0x40, 1), i * 20000 + 5000);
+   }
+   m.Tick(2000000);
+
+   auto* link = m.Get(INDEX, 0x40);
+   double expected = 50.0 * (6 * AirtimeMonitor::PduTime(2, 27) + AirtimeMonitor::PduTime(2, 5)) / 1000000;
+   ASSERT_TRUE(link->utilization > expected * 0.999 && link->utilization < expected * 1.001) << link->utilization << " " << expected;
+
+   // Nothing sent since.
+   m.Tick(3000000);
+   ASSERT_TRUE(link->utilization == 0);
+
+   // The handle goes away with the connection.
+   Send(m, Disconnect(0x40), 4000000);
+   ASSERT_TRUE(!m.Get(INDEX, 0x40));
+}
+
+int main()
+{
+   test_PduTime();
+   test_Dle();
+   test_NoDle();
+   test_AlreadyInFlight();
+   test_NotDrained();
+   test_Utilization();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
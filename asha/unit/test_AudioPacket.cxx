@@ -0,0 +1,38 @@
+#include "unit_test.hh"
+
+#include "../AudioPacket.hh"
+
+void test_IsSilent()
+{
+   RawS16 samples{};
+   ASSERT_TRUE(samples.IsSilent());
+   ASSERT_TRUE(samples.IsSilent(8));
+
+   samples.r[RawS16::SAMPLE_COUNT - 1] = 1;
+   ASSERT_TRUE(!samples.IsSilent());
+   ASSERT_TRUE(samples.IsSilent(8));
+
+   samples.l[17] = -8;
+   ASSERT_TRUE(samples.IsSilent(8));
+   samples.l[17] = -9;
+   ASSERT_TRUE(!samples.IsSilent(8));
+   samples.l[17] = 9;
+   ASSERT_TRUE(!samples.IsSilent(8));
+
+   // The ends of the range mustn't wrap around into silence.
+   samples.l[17] = 0;
+   samples.r[3] = -32768;
+   ASSERT_TRUE(!samples.IsSilent(8));
+   samples.r[3] = 32767;
+   ASSERT_TRUE(!samples.IsSilent(8));
+   ASSERT_TRUE(!samples.IsSilent(0));
+}
+
+int main()
+{
+   test_IsSilent();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
@@ -0,0 +1,235 @@
+#include "unit_test.hh"
+
+#include "../BufferCredit.hh"
+
+#include <algorithm>
+
+using namespace asha;
+
+namespace
+{
+   static constexpr size_t CREDITS = ASHA_STREAM_DEPTH / ASHA_PACKET_TIME;
+
+   // A hearing device on a simulated clock. It plays a frame every 20ms of
+   // its own clock, which can run a little fast or slow, and holds as many
+   // frames as it has credits. Anything past that waits in the "kernel".
+   //
+   // Like a real socket, a frame still counts as queued for a moment after
+   // it is written, and QueuedFrames() is what was seen right after the
+   // last write. Only SampleQueuedFrames() looks again.
+   class SimDevice: public DeviceInterface
+   {
+   public:
+      SimDevice(const uint64_t& now, double rate): m_now{now}, m_rate{rate} {}
+
+      virtual bool SendAudio(const RawS16& samples) override
+      {
+         Run();
+         if (m_held < CREDITS)
+            ++m_held;
+         else
+            ++m_kernel;
+         m_high = std::max(m_high, m_held + m_kernel);
+         if (m_last_send != m_now)
+            m_in_transit = 0;
+         ++m_in_transit;
+         m_last_send = m_now;
+         m_sampled = m_kernel + m_in_transit;
+         return true;
+      }
+      virtual void StreamStart() override {}
+      virtual void StreamStop() override {}
+      virtual size_t QueuedFrames() const override { return m_sampled; }
+      virtual size_t SampleQueuedFrames() override
+      {
+         Run();
+         m_sampled = m_kernel + (m_last_send == m_now ? m_in_transit : 0);
+         return m_sampled;
+      }
+
+      // Play everything due up to now.
+      void Run()
+      {
+         while (m_next <= m_now)
+         {
+            if (m_held > 0)
+            {
+               --m_held;
+               m_playing = true;
+            }
+            else if (m_playing)
+               ++m_underruns;
+            if (m_kernel > 0)
+            {
+               --m_kernel;
+               ++m_held;
+            }
+            m_next += ASHA_PACKET_TIME * m_rate;
+         }
+      }
+
+      size_t Held() const { return m_held + m_kernel; }
+      size_t High() const { return m_high; }
+      size_t Underruns() const { return m_underruns; }
+
+   private:
+      const uint64_t& m_now;
+      const double m_rate;
+      uint64_t m_next = 0;
+      size_t m_held = 0;
+      size_t m_kernel = 0;
+      size_t m_high = 0;
+      size_t m_underruns = 0;
+      bool m_playing = false;
+      uint64_t m_last_send = 0;
+      size_t m_in_transit = 0;
+      size_t m_sampled = 0;
+   };
+
+   class SimClock: public Clock
+   {
+   public:
+      SimClock(const uint64_t& now): m_now{now} {}
+      virtual uint64_t Now() const override { return m_now; }
+
+   private:
+      const uint64_t& m_now;
+   };
+
+   struct Result
+   {
+      size_t underruns;
+      size_t high;
+      size_t silence;
+      size_t dropped;
+      size_t final_depth;
+   };
+
+   // Feeds 20 minutes of audio from a producer that delivers `burst` frames
+   // at a time, every `burst` frame periods scaled by `producer_rate`.
+   Result Simulate(size_t target, size_t burst, double producer_rate, double device_rate)
+   {
+      uint64_t now = 1;
+      auto device = std::make_shared<SimDevice>(now, device_rate);
+      SimClock clock(now);
+      BufferCredit buffer(device, target, clock);
+
+      const uint64_t period = ASHA_PACKET_TIME * burst * producer_rate;
+      const size_t frames = 20 * 60 * 50;
+      size_t high_after_start = 0;
+      for (size_t i = 0; i < frames; i += burst)
+      {
+         now += period;
+         device->Run();
+         for (size_t j = 0; j < burst; ++j)
+         {
+            buffer.NextBuffer();
+            buffer.SendBuffer();
+         }
+         if (i > 100 * burst)
+            high_after_start = std::max(high_after_start, device->Held());
+      }
+      return Result{device->Underruns(), high_after_start, buffer.Stats().silence, buffer.Stats().ring_dropped, device->Held()};
+   }
+}
+
+void test_Steady()
+{
+   auto r = Simulate(3, 1, 1.0, 1.0);
+   ASSERT_TRUE(r.underruns == 0) << r.underruns;
+   // The estimate leans fast, so even with matched clocks it falls a frame
+   // behind the real depth every 100 seconds. Without rate matching that
+   // costs a little silence, and a few drops once the device fills up and
+   // the estimate is corrected.
+   ASSERT_TRUE(r.silence < 20) << r.silence;
+   ASSERT_TRUE(r.dropped < 20) << r.dropped;
+   ASSERT_TRUE(r.high <= CREDITS + 3) << r.high;
+}
+
+void test_Bursty()
+{
+   // A 1024 sample quantum at 48kHz is a little over three frames. Round it
+   // to three frames every 60ms.
+   auto r = Simulate(3, 3, 1.0, 1.0);
+   ASSERT_TRUE(r.underruns == 0) << r.underruns;
+   ASSERT_TRUE(r.dropped < 20) << r.dropped;
+   ASSERT_TRUE(r.high <= CREDITS + 3 + 3) << r.high;
+}
+
+void test_FastProducer()
+{
+   // 0.1% fast without rate matching has to drop about one frame in a
+   // thousand, but shouldn't let the latency grow.
+   auto r = Simulate(3, 1, 0.999, 1.0);
+   ASSERT_TRUE(r.underruns == 0) << r.underruns;
+   ASSERT_TRUE(r.dropped > 0);
+   ASSERT_TRUE(r.high <= CREDITS + 3) << r.high;
+}
+
+void test_SlowProducer()
+{
+   // 0.1% slow has to insert silence now and then, which shows up as a
+   // short underrun on a real device, but the buffer must keep recovering.
+   auto r = Simulate(3, 1, 1.001, 1.0);
+   ASSERT_TRUE(r.silence > 2);
+   ASSERT_TRUE(r.dropped < 20) << r.dropped;
+   ASSERT_TRUE(r.high <= CREDITS + 3) << r.high;
+   ASSERT_TRUE(r.final_depth > 0 && r.final_depth <= CREDITS + 3) << r.final_depth;
+}
+
+void test_SlowDevice()
+{
+   // The device clock runs slow, so our estimate runs ahead of the real
+   // depth until the device runs out of credits.
+   auto r = Simulate(3, 1, 1.0, 1.001);
+   ASSERT_TRUE(r.underruns == 0) << r.underruns;
+   ASSERT_TRUE(r.dropped > 0);
+   ASSERT_TRUE(r.high <= CREDITS + 1) << r.high;
+}
+
+void test_FastDevice()
+{
+   // The device clock runs fast, so the real depth falls behind our
+   // estimate, where nothing can see it. The estimate has to assume the
+   // device plays faster still, and pad with silence before the device
+   // actually runs dry.
+   auto r = Simulate(3, 1, 1.0, 0.9999);
+   ASSERT_TRUE(r.underruns == 0) << r.underruns;
+   ASSERT_TRUE(r.silence > 2) << r.silence;
+   ASSERT_TRUE(r.high <= CREDITS + 1) << r.high;
+}
+
+void test_Gap()
+{
+   uint64_t now = 1;
+   auto device = std::make_shared<SimDevice>(now, 1.0);
+   SimClock clock(now);
+   BufferCredit buffer(device, 3, clock);
+   for (int i = 0; i < 50; ++i)
+   {
+      now += ASHA_PACKET_TIME;
+      buffer.SendBuffer();
+   }
+   // Nothing for a second, so the device plays out and starts over.
+   now += 50 * ASHA_PACKET_TIME;
+   device->Run();
+   ASSERT_TRUE(device->Held() == 0);
+   buffer.SendBuffer();
+   ASSERT_TRUE(device->Held() == 3) << device->Held();
+   ASSERT_TRUE(buffer.Stats().silence == 4) << buffer.Stats().silence;
+}
+
+int main()
+{
+   test_Steady();
+   test_Bursty();
+   test_FastProducer();
+   test_SlowProducer();
+   test_SlowDevice();
+   test_FastDevice();
+   test_Gap();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
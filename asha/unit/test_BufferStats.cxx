@@ -0,0 +1,94 @@
+#include "unit_test.hh"
+
+#include "../BufferStats.hh"
+
+#include <thread>
+
+using namespace asha;
+
+void test_Counters()
+{
+   BufferStats stats;
+   auto s = stats.Read();
+   ASSERT_TRUE(s.occupancy == 0);
+   ASSERT_TRUE(s.occupancy_depth.Total() == 0);
+
+   stats.Occupancy(3);
+   stats.Occupancy(5);
+   stats.Occupancy(2);
+   stats.RingDropped();
+   stats.RingDropped(2);
+   stats.FailedWrite();
+   stats.Silence(4);
+   stats.Late(100);
+
+   s = stats.Read();
+   ASSERT_TRUE(s.occupancy == 2) << s.occupancy;
+   ASSERT_TRUE(s.high_occupancy == 5) << s.high_occupancy;
+   ASSERT_TRUE(s.occupancy_depth.Total() == 3);
+   ASSERT_TRUE(s.occupancy_depth.Max() == 5);
+   ASSERT_TRUE(s.ring_dropped == 3);
+   ASSERT_TRUE(s.failed_writes == 1);
+   ASSERT_TRUE(s.silence == 4);
+   ASSERT_TRUE(s.lateness.Total() == 1);
+}
+
+void test_Sum()
+{
+   BufferStats a, b;
+   a.Occupancy(4);
+   a.Silence(10);
+   b.Occupancy(2);
+   b.Occupancy(1);
+   b.Silence(5);
+
+   auto s = a.Read();
+   s += b.Read();
+   ASSERT_TRUE(s.occupancy == 5) << s.occupancy;
+   ASSERT_TRUE(s.high_occupancy == 4);
+   ASSERT_TRUE(s.silence == 15);
+   ASSERT_TRUE(s.occupancy_depth.Total() == 3);
+}
+
+void test_Threads()
+{
+   // Both sides of the ring count dropped frames. None may be lost, and
+   // a reader must never see the count go backwards.
+   static constexpr size_t COUNT = 200000;
+   BufferStats stats;
+   auto Count = [&stats]() {
+      for (size_t i = 0; i < COUNT; ++i)
+      {
+         stats.RingDropped();
+         stats.Silence();
+      }
+   };
+   std::thread producer(Count);
+   std::thread consumer(Count);
+
+   size_t last = 0;
+   bool monotonic = true;
+   while (last < 2 * COUNT)
+   {
+      size_t now = stats.Read().ring_dropped;
+      monotonic = monotonic && now >= last;
+      last = now;
+   }
+   producer.join();
+   consumer.join();
+
+   ASSERT_TRUE(monotonic);
+   ASSERT_TRUE(stats.Read().ring_dropped == 2 * COUNT);
+   ASSERT_TRUE(stats.Read().silence == 2 * COUNT);
+}
+
+int main()
+{
+   test_Counters();
+   test_Sum();
+   test_Threads();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
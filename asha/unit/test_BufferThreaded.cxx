@@ -0,0 +1,178 @@
+#include "unit_test.hh"
+
+#include "../BufferThreaded.hh"
+#include "../Config.hh"
+#include "../SimClock.hh"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <glib.h>
+
+using namespace asha;
+
+namespace
+{
+   constexpr uint64_t START = 1000000000;
+   constexpr size_t DEPTH = BufferThreaded::DEFAULT_DEPTH;
+   // How long the device takes to play again after it was stopped.
+   constexpr uint64_t RESTART = 500000000;
+
+   // Takes everything, except for a while after it is started again.
+   class SimDevice: public DeviceInterface
+   {
+   public:
+      SimDevice(const Clock& clock): m_clock{clock} {}
+
+      virtual bool SendAudio(const RawS16& samples) override
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         uint64_t now = m_clock.Now();
+         if (m_stopped || now < m_ready)
+            return false;
+         if (samples.l[0])
+            m_heard.emplace_back(samples.l[0], now);
+         return true;
+      }
+      virtual void StreamStart() override
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         if (m_stops > 0)
+            m_ready = m_clock.Now() + RESTART;
+         m_stopped = false;
+      }
+      virtual void StreamStop() override
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stopped = true;
+         ++m_stops;
+      }
+
+      size_t Stops()
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         return m_stops;
+      }
+      // Each frame with sound in it that was played, and when.
+      std::vector<std::pair<int16_t, uint64_t>> Heard()
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         return m_heard;
+      }
+
+   private:
+      const Clock& m_clock;
+      std::mutex m_mutex;
+      bool m_stopped = false;
+      uint64_t m_ready = 0;
+      size_t m_stops = 0;
+      std::vector<std::pair<int16_t, uint64_t>> m_heard;
+   };
+
+   // Feeds pipewire's side of the buffer one frame every 20ms.
+   struct Harness
+   {
+      Harness(): clock{START}, device{std::make_shared<SimDevice>(clock)}
+      {
+         Config::SetConfigItem("idle_timeout", (uint16_t)1);
+         buffer = std::make_shared<BufferThreaded>(device, DEPTH, clock);
+         buffer->StreamStart();
+      }
+      ~Harness()
+      {
+         clock.Release();
+         buffer.reset();
+      }
+
+      // A frame of silence for 0, or of sound tagged with the value.
+      void Push(int16_t value)
+      {
+         RawS16* slot = buffer->NextBuffer();
+         if (slot)
+         {
+            *slot = RawS16{};
+            for (size_t i = 0; i < RawS16::SAMPLE_COUNT; ++i)
+               slot->l[i] = slot->r[i] = value;
+            buffer->SendBuffer();
+         }
+         if (value)
+            pushed[value] = now;
+         now += ASHA_PACKET_TIME;
+         // Stop at each of the delivery thread's deadlines on the way, so
+         // it sees every wakeup on time.
+         clock.AdvanceTo(clock.Now(), 1);
+         for (uint64_t t = clock.NextDeadline(); t < now; t = clock.NextDeadline())
+            clock.AdvanceTo(t, 1);
+         clock.AdvanceTo(now, 1);
+         while (g_main_context_iteration(nullptr, FALSE))
+            ;
+      }
+
+      uint64_t now = START;
+      SimClock clock;
+      std::shared_ptr<SimDevice> device;
+      std::shared_ptr<BufferThreaded> buffer;
+      std::map<int16_t, uint64_t> pushed;
+   };
+}
+
+void test_ResumeKeepsPreroll()
+{
+   Harness h;
+   for (int i = 0; i < 100; ++i)
+      h.Push(0);
+   ASSERT_TRUE(h.device->Stops() == 1) << h.device->Stops();
+
+   // Sound while the device restarts, then a pause to catch up in.
+   for (int16_t i = 100; i < 160; ++i)
+      h.Push(i);
+   for (int i = 0; i < 60; ++i)
+      h.Push(0);
+   for (int16_t i = 160; i < 180; ++i)
+      h.Push(i);
+   for (int i = 0; i < 20; ++i)
+      h.Push(0);
+
+   // Every frame is heard, in order, even the ones that arrived while the
+   // device wasn't taking anything.
+   auto heard = h.device->Heard();
+   ASSERT_TRUE(heard.size() == 80) << heard.size();
+   for (size_t i = 0; i < heard.size(); ++i)
+      ASSERT_TRUE(heard[i].first == (int16_t)(100 + i)) << i << ": " << heard[i].first;
+   ASSERT_TRUE(h.buffer->Stats().ring_dropped == 0) << h.buffer->Stats().ring_dropped;
+
+   // The first waited out the restart, and the pause brought the latency
+   // back down to the depth.
+   uint64_t first = heard.front().second - h.pushed[100];
+   uint64_t after = heard[60].second - h.pushed[160];
+   ASSERT_TRUE(first >= RESTART) << first;
+   ASSERT_TRUE(after <= (DEPTH + 1) * ASHA_PACKET_TIME) << after;
+}
+
+void test_ResumeWithoutPause()
+{
+   Harness h;
+   for (int i = 0; i < 100; ++i)
+      h.Push(0);
+   ASSERT_TRUE(h.device->Stops() == 1) << h.device->Stops();
+
+   // With no silence to skip, the oldest audio goes once the catch up times
+   // out, rather than keeping the latency of the restart.
+   for (int16_t i = 100; i < 1100; ++i)
+      h.Push(i);
+   auto heard = h.device->Heard();
+   ASSERT_TRUE(h.buffer->Stats().ring_dropped > 0);
+   uint64_t last = heard.back().second - h.pushed[heard.back().first];
+   ASSERT_TRUE(last <= (DEPTH + 1) * ASHA_PACKET_TIME) << last;
+}
+
+int main()
+{
+   test_ResumeKeepsPreroll();
+   test_ResumeWithoutPause();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
@@ -2,6 +2,7 @@
 
 #include "MockSide.hh"
 #include "../Device.hh"
+#include "../RtLog.hh"
 #include <cassert>
 
 using namespace asha;
@@ -283,6 +284,65 @@ public:
       ASSERT_TRUE(m_d->State() == Device::STREAMING);
    }
 
+   void test_SendAudioBlockedSingle()
+   {
+      InitToState(Device::STREAMING, false);
+      RawS16 samples{};
+
+      // Nothing was taken, so nothing is owed, and the seq doesn't move.
+      m_left->SetWriteStatus(Side::BUFFER_FULL);
+      ASSERT_TRUE(!m_d->SendAudio(samples));
+      ASSERT_TRUE(m_left->Sent().empty());
+
+      m_left->SetWriteStatus(Side::WRITE_OK);
+      ASSERT_TRUE(m_d->SendAudio(samples));
+      ASSERT_TRUE(m_d->SendAudio(samples));
+      ASSERT_TRUE((m_left->Sent() == std::vector<uint8_t>{0, 1}));
+   }
+
+   void test_SendAudioBlockedOne()
+   {
+      InitToState(Device::STREAMING, true);
+      RawS16 samples{};
+
+      // The left side got the frame, so the right side gets it once its
+      // socket drains, ahead of the next one. It was held back, not dropped.
+      size_t blocked = RtLog::Total(RtLog::BLOCKED, true);
+      size_t dropped = RtLog::Total(RtLog::DROPPED, true);
+      m_right->FillSocket();
+      m_right->SetWriteStatus(Side::BUFFER_FULL);
+      ASSERT_TRUE(m_d->SendAudio(samples));
+      m_right->SetWriteStatus(Side::WRITE_OK);
+
+      // Nothing is sent while the socket is still full.
+      ASSERT_TRUE(!m_d->SendAudio(samples));
+      ASSERT_TRUE(m_right->Sent().empty());
+
+      m_right->DrainSocket();
+      ASSERT_TRUE(m_d->SendAudio(samples));
+      ASSERT_TRUE((m_left->Sent() == std::vector<uint8_t>{0, 1}));
+      ASSERT_TRUE((m_right->Sent() == std::vector<uint8_t>{0, 1}));
+      ASSERT_TRUE(RtLog::Total(RtLog::BLOCKED, true) == blocked + 1);
+      ASSERT_TRUE(RtLog::Total(RtLog::DROPPED, true) == dropped);
+   }
+
+   void test_SendAudioLostOne()
+   {
+      InitToState(Device::STREAMING, true);
+      RawS16 samples{};
+
+      // A write that fails for any other reason isn't retried, so the
+      // right side never gets that frame.
+      size_t dropped = RtLog::Total(RtLog::DROPPED, true);
+      m_right->SetWriteStatus(Side::TRUNCATED);
+      ASSERT_TRUE(m_d->SendAudio(samples));
+      m_right->SetWriteStatus(Side::WRITE_OK);
+      ASSERT_TRUE(m_d->SendAudio(samples));
+      ASSERT_TRUE((m_left->Sent() == std::vector<uint8_t>{0, 1}));
+      ASSERT_TRUE((m_right->Sent() == std::vector<uint8_t>{1}));
+      ASSERT_TRUE(RtLog::Total(RtLog::DROPPED, true) == dropped + 1);
+   }
+
 private:
    static constexpr uint64_t HISYNC = 1234;
    static const std::string LEFT;
@@ -320,6 +380,10 @@ int main()
    test_Device().test_StopStartSingle();
    test_Device().test_StopStartBoth();
 
+   test_Device().test_SendAudioBlockedSingle();
+   test_Device().test_SendAudioBlockedOne();
+   test_Device().test_SendAudioLostOne();
+
    std::cout << "All test passed\n";
 
    return 0;
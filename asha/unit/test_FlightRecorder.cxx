@@ -0,0 +1,194 @@
+#include "unit_test.hh"
+
+#include "../FlightRecorder.hh"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+using namespace asha;
+
+static constexpr uint16_t EVENT_PKT = 3;
+static constexpr uint16_t ACL_TX_PKT = 4;
+static constexpr uint16_t ISO_TX_PKT = 18;
+
+static constexpr size_t RECORD_HEADER = 24;
+
+struct Packet
+{
+   uint16_t opcode;
+   uint16_t index;
+   int64_t stamp;
+   uint32_t original;
+   std::string data;
+};
+
+// Read back a btsnoop file, the way snoop_analyze does.
+static std::vector<Packet> Parse(const std::string& file)
+{
+   std::vector<Packet> ret;
+   ASSERT_TRUE(file.size() >= 16);
+   ASSERT_TRUE(memcmp(file.data(), "btsnoop\0", 8) == 0);
+   uint32_t header[2];
+   memcpy(header, file.data() + 8, sizeof(header));
+   ASSERT_TRUE(be32toh(header[0]) == 1);
+   ASSERT_TRUE(be32toh(header[1]) == 2001);
+
+   size_t pos = 16;
+   while (pos < file.size())
+   {
+      ASSERT_TRUE(pos + RECORD_HEADER <= file.size());
+      uint32_t fields[4];
+      int64_t stamp;
+      memcpy(fields, file.data() + pos, sizeof(fields));
+      memcpy(&stamp, file.data() + pos + 16, sizeof(stamp));
+      uint32_t length = be32toh(fields[1]);
+      ASSERT_TRUE(be32toh(fields[0]) >= length);
+      ASSERT_TRUE(pos + RECORD_HEADER + length <= file.size());
+
+      Packet p;
+      p.opcode = be32toh(fields[2]) & 0xffff;
+      p.index = be32toh(fields[2]) >> 16;
+      p.stamp = be64toh(stamp) - 0x00dcddb30f2f8000ll;
+      p.original = be32toh(fields[0]);
+      p.data.assign(file.data() + pos + RECORD_HEADER, length);
+      ret.push_back(p);
+      pos += RECORD_HEADER + length;
+   }
+   return ret;
+}
+
+static std::vector<Packet> Dump(const FlightRecorder& recorder)
+{
+   std::ostringstream out;
+   ASSERT_TRUE(recorder.Dump(out));
+   return Parse(out.str());
+}
+
+static void RecordAcl(FlightRecorder& recorder, uint16_t handle, int64_t stamp, size_t size = 20)
+{
+   std::string data(size, (char)stamp);
+   data[0] = handle & 0xff;
+   data[1] = handle >> 8 | 0x20;
+   recorder.Record(ACL_TX_PKT, 0, (const uint8_t*)data.data(), data.size(), stamp);
+}
+
+void test_Empty()
+{
+   FlightRecorder recorder(1024);
+   ASSERT_TRUE(Dump(recorder).empty());
+   ASSERT_TRUE(recorder.Packets() == 0);
+
+   // Nothing fits, but nothing breaks either.
+   FlightRecorder none(0);
+   RecordAcl(none, 0x40, 1);
+   ASSERT_TRUE(Dump(none).empty());
+}
+
+void test_Wrap()
+{
+   // Room for a little more than ten packets, so the ring wraps in the
+   // middle of records.
+   static constexpr size_t PACKET = 20;
+   FlightRecorder recorder(10 * (RECORD_HEADER + PACKET) + 17);
+
+   for (int64_t i = 1; i <= 5; ++i)
+      RecordAcl(recorder, 0x40, i);
+   auto packets = Dump(recorder);
+   ASSERT_TRUE(packets.size() == 5);
+   ASSERT_TRUE(packets[0].stamp == 1);
+   ASSERT_TRUE(packets[0].opcode == ACL_TX_PKT);
+   ASSERT_TRUE(packets[0].data.size() == PACKET);
+
+   for (int64_t i = 6; i <= 100; ++i)
+   {
+      RecordAcl(recorder, 0x40, i);
+      ASSERT_TRUE(recorder.Packets() == std::min<int64_t>(i, 10)) << recorder.Packets();
+      ASSERT_TRUE(recorder.Bytes() <= 10 * (RECORD_HEADER + PACKET) + 17);
+
+      // Only the newest are kept, in order, and intact.
+      packets = Dump(recorder);
+      ASSERT_TRUE(packets.size() == recorder.Packets());
+      for (size_t j = 0; j < packets.size(); ++j)
+      {
+         int64_t stamp = i - packets.size() + 1 + j;
+         ASSERT_TRUE(packets[j].stamp == stamp) << packets[j].stamp << " " << stamp;
+         ASSERT_TRUE(packets[j].data.substr(2) == std::string(PACKET - 2, (char)stamp));
+      }
+   }
+
+   // A big packet pushes out several small ones.
+   RecordAcl(recorder, 0x40, 101, 3 * PACKET);
+   packets = Dump(recorder);
+   ASSERT_TRUE(packets.size() == 9) << packets.size();
+   ASSERT_TRUE(packets.back().data.size() == 3 * PACKET);
+}
+
+void test_Filter()
+{
+   FlightRecorder recorder(4096);
+
+   // Events are always kept, and ISO never is.
+   const uint8_t event[] = { 0x13, 0x05, 0x01, 0x40, 0x00, 0x01, 0x00 };
+   recorder.Record(EVENT_PKT, 0, event, sizeof(event), 1);
+   recorder.Record(ISO_TX_PKT, 0, event, sizeof(event), 2);
+   ASSERT_TRUE(recorder.Packets() == 1);
+
+   // Until we watch a connection, all ACL traffic is kept.
+   RecordAcl(recorder, 0x40, 3);
+   RecordAcl(recorder, 0x41, 4);
+   ASSERT_TRUE(recorder.Packets() == 3);
+
+   FlightRecorder::Watch(0, 0x41);
+   RecordAcl(recorder, 0x40, 5);
+   RecordAcl(recorder, 0x41, 6);
+   recorder.Record(EVENT_PKT, 1, event, sizeof(event), 7);
+   auto packets = Dump(recorder);
+   ASSERT_TRUE(packets.size() == 5);
+   ASSERT_TRUE(packets[3].stamp == 6);
+   ASSERT_TRUE(packets[4].index == 1);
+
+   // Once it disconnects, the next connection to get the handle isn't
+   // kept, and neither is anything else.
+   const uint8_t disconnect[] = { 0x05, 0x04, 0x00, 0x41, 0x00, 0x13 };
+   recorder.Record(EVENT_PKT, 0, disconnect, sizeof(disconnect), 8);
+   RecordAcl(recorder, 0x41, 9);
+   RecordAcl(recorder, 0x40, 10);
+   ASSERT_TRUE(recorder.Packets() == 6) << recorder.Packets();
+
+   // The same goes for a side that goes away.
+   FlightRecorder::Watch(0, 0x42);
+   RecordAcl(recorder, 0x42, 11);
+   FlightRecorder::Unwatch(0, 0x42);
+   RecordAcl(recorder, 0x42, 12);
+   ASSERT_TRUE(recorder.Packets() == 7) << recorder.Packets();
+}
+
+void test_Truncated()
+{
+   // A packet cut short keeps its real length, so readers can tell.
+   FlightRecorder recorder(4096);
+   const uint8_t event[] = { 0x3e, 0xff, 0x02 };
+   recorder.Record(EVENT_PKT, 0, event, sizeof(event), 1, 2000);
+   recorder.Record(EVENT_PKT, 0, event, sizeof(event), 2);
+   auto packets = Dump(recorder);
+   ASSERT_TRUE(packets.size() == 2);
+   ASSERT_TRUE(packets[0].data.size() == sizeof(event));
+   ASSERT_TRUE(packets[0].original == 2000) << packets[0].original;
+   ASSERT_TRUE(packets[1].original == sizeof(event)) << packets[1].original;
+}
+
+int main()
+{
+   test_Empty();
+   test_Wrap();
+   test_Filter();
+   test_Truncated();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
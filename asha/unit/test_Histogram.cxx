@@ -0,0 +1,89 @@
+#include "unit_test.hh"
+
+#include "../Histogram.hh"
+
+using namespace asha;
+
+void test_Buckets()
+{
+   ASSERT_TRUE(Histogram::Bucket(0) == 0);
+   ASSERT_TRUE(Histogram::Bucket(1) == 1);
+   ASSERT_TRUE(Histogram::Bucket(2) == 2);
+   ASSERT_TRUE(Histogram::Bucket(3) == 2);
+   ASSERT_TRUE(Histogram::Bucket(4) == 3);
+   ASSERT_TRUE(Histogram::Bucket(1023) == 10);
+   ASSERT_TRUE(Histogram::Bucket(1024) == 11);
+   ASSERT_TRUE(Histogram::Bucket(~0ull) == Histogram::BUCKETS - 1);
+}
+
+void test_Percentile()
+{
+   Histogram h;
+   ASSERT_TRUE(h.Percentile(0.5) == 0);
+   ASSERT_TRUE(h.Max() == 0);
+
+   // 90 small values and 10 large ones.
+   for (int i = 0; i < 90; ++i)
+      h.Add(5);
+   for (int i = 0; i < 10; ++i)
+      h.Add(3000);
+
+   ASSERT_TRUE(h.Total() == 100);
+   ASSERT_TRUE(h.Max() == 3000);
+   ASSERT_TRUE(h.Percentile(0.5) == 7) << h.Percentile(0.5);
+   ASSERT_TRUE(h.Percentile(0.89) == 7) << h.Percentile(0.89);
+   // The bucket goes to 4095, but nothing above 3000 was seen.
+   ASSERT_TRUE(h.Percentile(0.99) == 3000) << h.Percentile(0.99);
+   ASSERT_TRUE(h.Percentile(1.0) == 3000) << h.Percentile(1.0);
+}
+
+void test_Merge()
+{
+   Histogram a;
+   Histogram b;
+   a.Add(1);
+   a.Add(100);
+   b.Add(100);
+   b.Add(500);
+
+   a.Merge(b);
+   ASSERT_TRUE(a.Total() == 4);
+   ASSERT_TRUE(a.Count(Histogram::Bucket(100)) == 2);
+   ASSERT_TRUE(a.Max() == 500);
+   ASSERT_TRUE(b.Total() == 2);
+}
+
+void test_Since()
+{
+   Histogram h;
+   for (int i = 0; i < 1000; ++i)
+      h.Add(5);
+   Histogram earlier;
+   earlier.Merge(h);
+
+   // The latency grows, but there is too much history for the whole run's
+   // p99 to notice.
+   for (int i = 0; i < 5; ++i)
+      h.Add(3000);
+   ASSERT_TRUE(h.Percentile(0.99) == 7) << h.Percentile(0.99);
+
+   auto recent = h.Since(earlier);
+   ASSERT_TRUE(recent.Total() == 5) << recent.Total();
+   ASSERT_TRUE(recent.Percentile(0.99) == 3000) << recent.Percentile(0.99);
+   ASSERT_TRUE(h.Since(h).Total() == 0);
+   // A count that went backwards, like a device that went away, is empty
+   // rather than huge.
+   ASSERT_TRUE(earlier.Since(h).Total() == 0);
+}
+
+int main()
+{
+   test_Buckets();
+   test_Percentile();
+   test_Merge();
+   test_Since();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
@@ -0,0 +1,90 @@
+#include "unit_test.hh"
+
+#include "../Ring.hh"
+
+#include <thread>
+
+using namespace asha;
+
+void test_Basic()
+{
+   // Not a power of two.
+   Ring<int> ring(3);
+   ASSERT_TRUE(ring.Capacity() == 3);
+   ASSERT_TRUE(ring.Size() == 0);
+   ASSERT_TRUE(ring.Available() == 0);
+
+   // Go round a few times so the indices wrap.
+   int next = 0;
+   int expected = 0;
+   for (int loop = 0; loop < 10; ++loop)
+   {
+      while (int* slot = ring.Claim())
+      {
+         *slot = next++;
+         ring.Commit();
+      }
+      ASSERT_TRUE(ring.Size() == 3);
+      ASSERT_TRUE(ring.Available() == 3);
+
+      for (size_t i = 0; i < 3; ++i)
+         ASSERT_TRUE(ring.Peek(i) == expected + (int)i);
+
+      ring.Pop(2);
+      expected += 2;
+      ASSERT_TRUE(ring.Available() == 1);
+      ASSERT_TRUE(ring.Peek() == expected);
+   }
+}
+
+void test_Threads()
+{
+   // Pass a counter across threads, and check that nothing is lost,
+   // duplicated or reordered.
+   static constexpr unsigned COUNT = 1000000;
+   Ring<unsigned> ring(5);
+
+   std::thread producer([&ring]() {
+      for (unsigned i = 0; i < COUNT;)
+      {
+         unsigned* slot = ring.Claim();
+         if (!slot)
+         {
+            std::this_thread::yield();
+            continue;
+         }
+         *slot = i++;
+         ring.Commit();
+      }
+   });
+
+   unsigned expected = 0;
+   bool ordered = true;
+   while (expected < COUNT)
+   {
+      size_t available = ring.Available();
+      if (!available)
+      {
+         std::this_thread::yield();
+         continue;
+      }
+      for (size_t i = 0; i < available; ++i)
+         ordered = ordered && ring.Peek(i) == expected + i;
+      expected += available;
+      ring.Pop(available);
+   }
+   producer.join();
+
+   ASSERT_TRUE(ordered);
+   ASSERT_TRUE(ring.Size() == 0);
+}
+
+int main()
+{
+   test_Basic();
+   test_Threads();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
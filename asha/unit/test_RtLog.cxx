@@ -0,0 +1,155 @@
+#include "unit_test.hh"
+
+#include "../RtLog.hh"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace asha;
+
+static std::vector<std::string> s_messages;
+static size_t s_warnings = 0;
+
+static void Collect(bool warning, const char* text)
+{
+   s_messages.push_back(text);
+   if (warning)
+      ++s_warnings;
+}
+
+static void Reset()
+{
+   while (RtLog::Drain(RtLog::CAPACITY, [](bool, const char*) {}))
+      ;
+   s_messages.clear();
+   s_warnings = 0;
+}
+
+void test_Basic()
+{
+   Reset();
+   RtLog::Info("one %d", 1);
+   RtLog::Warning("two %s", "2");
+   ASSERT_TRUE(RtLog::Drain(1, Collect) == 1);
+   ASSERT_TRUE(RtLog::Drain(10, Collect) == 1);
+   ASSERT_TRUE(RtLog::Drain(10, Collect) == 0);
+   ASSERT_TRUE(s_messages.size() == 2) << s_messages.size();
+   ASSERT_TRUE(s_messages[0] == "one 1") << s_messages[0];
+   ASSERT_TRUE(s_messages[1] == "two 2") << s_messages[1];
+   ASSERT_TRUE(s_warnings == 1);
+
+   // Long messages are cut short, not overrun.
+   std::string long_text(RtLog::MESSAGE_SIZE * 2, 'x');
+   RtLog::Info("%s", long_text.c_str());
+   ASSERT_TRUE(RtLog::Drain(10, Collect) == 1);
+   ASSERT_TRUE(s_messages.back().size() == RtLog::MESSAGE_SIZE - 1) << s_messages.back().size();
+}
+
+void test_Lost()
+{
+   // Overfill the ring. What doesn't fit is counted, and the count is
+   // passed on as a warning once the ring has drained.
+   Reset();
+   for (size_t i = 0; i < RtLog::CAPACITY + 5; ++i)
+      RtLog::Info("%zu", i);
+   ASSERT_TRUE(RtLog::Drain(RtLog::CAPACITY * 2, Collect) == RtLog::CAPACITY);
+   ASSERT_TRUE(s_messages.size() == RtLog::CAPACITY + 1) << s_messages.size();
+   ASSERT_TRUE(s_messages[0] == "0");
+   ASSERT_TRUE(s_messages[RtLog::CAPACITY - 1] == std::to_string(RtLog::CAPACITY - 1));
+   ASSERT_TRUE(strstr(s_messages.back().c_str(), "5 audio thread") != nullptr) << s_messages.back();
+   ASSERT_TRUE(s_warnings == 1);
+
+   // And there is room again.
+   RtLog::Info("again");
+   s_messages.clear();
+   ASSERT_TRUE(RtLog::Drain(10, Collect) == 1);
+   ASSERT_TRUE(s_messages.size() == 1 && s_messages[0] == "again");
+}
+
+void test_Counts()
+{
+   RtLog::Count(RtLog::DROPPED, true);
+   RtLog::Count(RtLog::DROPPED, true);
+   RtLog::Count(RtLog::DISCONNECTED, false);
+   ASSERT_TRUE(RtLog::TakeCount(RtLog::DROPPED, true) == 2);
+   ASSERT_TRUE(RtLog::TakeCount(RtLog::DROPPED, true) == 0);
+   ASSERT_TRUE(RtLog::TakeCount(RtLog::DROPPED, false) == 0);
+   ASSERT_TRUE(RtLog::TakeCount(RtLog::DISCONNECTED, false) == 1);
+}
+
+void test_Threads()
+{
+   // Several threads log while the main thread drains. Every message is
+   // either passed on or counted as lost, and each thread's messages stay
+   // in order.
+   static constexpr unsigned THREADS = 4;
+   static constexpr unsigned COUNT = 20000;
+   Reset();
+
+   std::vector<std::thread> producers;
+   for (unsigned t = 0; t < THREADS; ++t)
+   {
+      producers.emplace_back([t]() {
+         for (unsigned i = 0; i < COUNT; ++i)
+         {
+            RtLog::Info("%u %u", t, i);
+            if (i % 64 == 0)
+               std::this_thread::yield();
+         }
+      });
+   }
+
+   static size_t s_received;
+   static size_t s_lost;
+   static bool s_ordered;
+   static int s_last[THREADS];
+   s_received = 0;
+   s_lost = 0;
+   s_ordered = true;
+   for (auto& last: s_last)
+      last = -1;
+
+   auto out = [](bool warning, const char* text) {
+      if (warning)
+      {
+         s_lost += strtoul(text, nullptr, 10);
+         return;
+      }
+      unsigned t, i;
+      if (sscanf(text, "%u %u", &t, &i) != 2 || t >= THREADS || (int)i <= s_last[t])
+         s_ordered = false;
+      else
+         s_last[t] = i;
+      ++s_received;
+   };
+
+   auto done = [&producers]() {
+      for (auto& p: producers)
+         p.join();
+   };
+   std::thread joiner(done);
+   while (s_received + s_lost < THREADS * COUNT)
+   {
+      if (!RtLog::Drain(RtLog::DRAIN_MESSAGES, out))
+         std::this_thread::yield();
+   }
+   joiner.join();
+
+   ASSERT_TRUE(s_ordered);
+   ASSERT_TRUE(s_received + s_lost == THREADS * COUNT) << s_received << " + " << s_lost;
+   ASSERT_TRUE(RtLog::Drain(10, out) == 0);
+}
+
+int main()
+{
+   test_Basic();
+   test_Lost();
+   test_Counts();
+   test_Threads();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
@@ -0,0 +1,116 @@
+#include "unit_test.hh"
+
+#include "../Uring.hh"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace asha;
+
+// Stands in for an l2cap socket.
+struct SocketPair
+{
+   SocketPair()
+   {
+      ASSERT_TRUE(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+   }
+   ~SocketPair()
+   {
+      close(fds[0]);
+      close(fds[1]);
+   }
+   int fds[2] = {-1, -1};
+};
+
+void test_SendBoth()
+{
+   Uring uring;
+   SocketPair left, right;
+   uint8_t a[161], b[161];
+   memset(a, 0x11, sizeof(a));
+   memset(b, 0x22, sizeof(b));
+
+   ASSERT_TRUE(uring.QueueSend(left.fds[0], a, sizeof(a)));
+   ASSERT_TRUE(uring.QueueSend(right.fds[0], b, sizeof(b)));
+   int results[2];
+   ASSERT_TRUE(uring.Submit(results) == 2);
+   ASSERT_TRUE(results[0] == sizeof(a)) << results[0];
+   ASSERT_TRUE(results[1] == sizeof(b)) << results[1];
+
+   uint8_t in[200];
+   ASSERT_TRUE(recv(left.fds[1], in, sizeof(in), MSG_DONTWAIT) == sizeof(a));
+   ASSERT_TRUE(0 == memcmp(in, a, sizeof(a)));
+   ASSERT_TRUE(recv(right.fds[1], in, sizeof(in), MSG_DONTWAIT) == sizeof(b));
+   ASSERT_TRUE(0 == memcmp(in, b, sizeof(b)));
+
+   // Nothing queued is fine.
+   ASSERT_TRUE(uring.Submit(results) == 0);
+}
+
+void test_Full()
+{
+   Uring uring;
+   SocketPair left, right;
+   uint8_t packet[161] = {};
+
+   // Fill the right socket, so only the left send goes through.
+   while (send(right.fds[0], packet, sizeof(packet), MSG_DONTWAIT) > 0)
+   {
+   }
+
+   ASSERT_TRUE(uring.QueueSend(left.fds[0], packet, sizeof(packet)));
+   ASSERT_TRUE(uring.QueueSend(right.fds[0], packet, sizeof(packet)));
+   int results[2];
+   ASSERT_TRUE(uring.Submit(results) == 2);
+   ASSERT_TRUE(results[0] == sizeof(packet)) << results[0];
+   ASSERT_TRUE(results[1] == -EAGAIN) << results[1];
+}
+
+void test_Closed()
+{
+   Uring uring;
+   SocketPair pair;
+   close(pair.fds[1]);
+   pair.fds[1] = -1;
+   uint8_t packet[161] = {};
+
+   ASSERT_TRUE(uring.QueueSend(pair.fds[0], packet, sizeof(packet)));
+   int results[1];
+   ASSERT_TRUE(uring.Submit(results) == 1);
+   ASSERT_TRUE(results[0] == -EPIPE) << results[0];
+}
+
+void test_QueueLimit()
+{
+   Uring uring(2);
+   SocketPair pair;
+   uint8_t packet[161] = {};
+   size_t queued = 0;
+   while (queued < 100 && uring.QueueSend(pair.fds[0], packet, sizeof(packet)))
+      ++queued;
+   ASSERT_TRUE(queued >= 2 && queued < 100) << queued;
+   int results[100];
+   ASSERT_TRUE(uring.Submit(results) == (int)queued);
+}
+
+int main()
+{
+   if (!Uring().Valid())
+   {
+      // Not every kernel or sandbox allows it. Device falls back to send().
+      std::cout << "io_uring not available, skipping\n";
+      return 0;
+   }
+
+   test_SendBoth();
+   test_Full();
+   test_Closed();
+   test_QueueLimit();
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
@@ -0,0 +1,428 @@
+// Benchmark for everything that happens to one 20ms frame of audio on its
+// way from pipewire to the socket, without needing bluetooth or pipewire.
+//
+// Each stage is run on its own for a number of frames, and timed frame by
+// frame. CPU cycles come from perf_event_open, when the kernel allows it
+// (see /proc/sys/kernel/perf_event_paranoid).
+
+#include "asha/AudioPacket.hh"
+#include "asha/BufferInterface.hh"
+#include "asha/Config.hh"
+#include "asha/Device.hh"
+#include "asha/G722Encoder.hh"
+#include "asha/Now.hh"
+#include "asha/Side.hh"
+#include "g722/g722_enc_dec.h"
+#include "pw/Packetizer.hh"
+
+#include <linux/perf_event.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+   constexpr size_t DEFAULT_FRAMES = 5000;
+   // Samples per pipewire buffer. Deliberately not a multiple of a frame, so
+   // that the packetizer has to split buffers.
+   constexpr size_t QUANTUM = 256;
+   // One second of input, looped.
+   constexpr size_t INPUT_SAMPLES = 16000;
+
+   // Stop the compiler from optimizing away work whose result isn't used.
+   inline void Clobber(const void* p)
+   {
+      asm volatile("" : : "g"(p) : "memory");
+   }
+
+   // CPU cycles spent by this thread, in user space and the kernel if we
+   // are allowed, or only in user space if not.
+   class CycleCounter
+   {
+   public:
+      CycleCounter()
+      {
+         m_fd = Open(false);
+         if (m_fd < 0)
+         {
+            m_fd = Open(true);
+            m_user_only = m_fd >= 0;
+         }
+      }
+      ~CycleCounter()
+      {
+         if (m_fd >= 0)
+            close(m_fd);
+      }
+
+      bool Valid() const { return m_fd >= 0; }
+      bool UserOnly() const { return m_user_only; }
+
+      uint64_t Read() const
+      {
+         uint64_t v = 0;
+         if (m_fd < 0 || read(m_fd, &v, sizeof(v)) != sizeof(v))
+            return 0;
+         return v;
+      }
+
+   private:
+      static int Open(bool user_only)
+      {
+         perf_event_attr attr{};
+         attr.type = PERF_TYPE_HARDWARE;
+         attr.size = sizeof(attr);
+         attr.config = PERF_COUNT_HW_CPU_CYCLES;
+         attr.exclude_kernel = user_only;
+         attr.exclude_hv = 1;
+         return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+
+      int m_fd = -1;
+      bool m_user_only = false;
+   };
+
+   // A side that writes into one end of a socketpair, so Device::SendAudio
+   // does the same epoll and send() that it would on an l2cap socket.
+   class BenchSide: public asha::Side
+   {
+   public:
+      BenchSide(bool left): Side(left ? "Bench Left" : "Bench Right")
+      {
+         SetProps(left, 1);
+         SetState(STOPPED);
+         if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, m_fds) < 0)
+            throw std::runtime_error(std::string("socketpair failed: ") + strerror(errno));
+      }
+      ~BenchSide()
+      {
+         close(m_fds[0]);
+         close(m_fds[1]);
+      }
+
+      int Sock() const override { return m_fds[0]; }
+      bool AudioReady() const override { return true; }
+      // Unix sockets report the queued bytes directly.
+      int QueuedBytes() override
+      {
+         int bytes = 0;
+         return ioctl(m_fds[0], SIOCOUTQ, &bytes) < 0 ? -1 : bytes;
+      }
+
+      // Throw away everything written so far.
+      void Drain()
+      {
+         uint8_t buf[sizeof(AudioPacket)];
+         while (recv(m_fds[1], buf, sizeof(buf), MSG_DONTWAIT) > 0)
+         {
+         }
+      }
+
+      void SetStreamVolume(int8_t volume) override {}
+      void SetMicrophoneVolume(uint8_t volume) override {}
+      bool Start(bool otherstate, std::function<void(bool)> OnDone) override
+      {
+         SetState(STREAMING);
+         OnDone(true);
+         return true;
+      }
+      bool Stop(std::function<void(bool)> OnDone) override
+      {
+         SetState(STOPPED);
+         OnDone(true);
+         return true;
+      }
+      WriteStatus WriteAudioFrame(const AudioPacket& packet) override
+      {
+         ssize_t sent = send(m_fds[0], &packet, sizeof(packet), MSG_DONTWAIT);
+         if (sent == sizeof(packet))
+            return WRITE_OK;
+         if (sent >= 0)
+            return TRUNCATED;
+         return (errno == EAGAIN || errno == EWOULDBLOCK) ? BUFFER_FULL : DISCONNECTED;
+      }
+      bool UpdateOtherConnected(bool connected) override { return true; }
+      bool UpdateConnectionParameters(uint8_t interval) override { return true; }
+
+   private:
+      int m_fds[2] = {-1, -1};
+   };
+
+   // A one slot buffer, standing in for the Buffer ring.
+   class BenchBuffer: public BufferInterface
+   {
+   public:
+      RawS16* NextBuffer() override { return &m_slot; }
+      void SendBuffer() override
+      {
+         Clobber(&m_slot);
+         ++m_sent;
+      }
+      size_t Sent() const { return m_sent; }
+
+   private:
+      RawS16 m_slot;
+      size_t m_sent = 0;
+   };
+
+   struct Result
+   {
+      std::string name;
+      std::vector<uint64_t> ns;   // Per frame, sorted.
+      double cycles = NAN;        // Mean per frame.
+
+      double Mean() const
+      {
+         double total = 0;
+         for (auto v: ns)
+            total += v;
+         return ns.empty() ? NAN : total / ns.size();
+      }
+      uint64_t Percentile(double p) const
+      {
+         return ns.empty() ? 0 : ns[std::min(ns.size() - 1, (size_t)(p * ns.size()))];
+      }
+      uint64_t Max() const { return ns.empty() ? 0 : ns.back(); }
+   };
+
+   // Time frames runs of fn(i), calling between(i) untimed after each one.
+   template <typename Fn, typename Between>
+   Result Measure(const std::string& name, size_t frames, const CycleCounter& counter, Fn&& fn, Between&& between)
+   {
+      Result ret{name};
+      ret.ns.reserve(frames);
+      uint64_t cycles = 0;
+      for (size_t i = 0; i < frames; ++i)
+      {
+         uint64_t c0 = counter.Read();
+         uint64_t t0 = Now();
+         fn(i);
+         uint64_t t1 = Now();
+         uint64_t c1 = counter.Read();
+         ret.ns.push_back(t1 - t0);
+         cycles += c1 - c0;
+         between(i);
+      }
+      std::sort(ret.ns.begin(), ret.ns.end());
+      if (counter.Valid())
+         ret.cycles = (double)cycles / frames;
+      return ret;
+   }
+
+   template <typename Fn>
+   Result Measure(const std::string& name, size_t frames, const CycleCounter& counter, Fn&& fn)
+   {
+      return Measure(name, frames, counter, fn, [](size_t) {});
+   }
+
+   // A few tones and some noise, different on each channel, so the encoder
+   // has something realistic to chew on.
+   void Synthesize(std::vector<int16_t>& left, std::vector<int16_t>& right)
+   {
+      left.resize(INPUT_SAMPLES);
+      right.resize(INPUT_SAMPLES);
+      uint32_t lcg = 1;
+      for (size_t i = 0; i < INPUT_SAMPLES; ++i)
+      {
+         double t = i / 16000.0;
+         lcg = lcg * 1103515245u + 12345u;
+         double noise = (int32_t)(lcg >> 16) - 32768;
+         left[i] = 6000 * sin(2 * M_PI * 440 * t) + 2000 * sin(2 * M_PI * 2750 * t) + noise / 32;
+         right[i] = 6000 * sin(2 * M_PI * 330 * t) + 2000 * sin(2 * M_PI * 5100 * t) + noise / 32;
+      }
+   }
+
+   // Set up a device with the given number of bench sides, and get it to
+   // the STREAMING state.
+   std::shared_ptr<asha::Device> StreamingDevice(std::vector<std::shared_ptr<BenchSide>>& sides, size_t count)
+   {
+      auto device = std::make_shared<asha::Device>("Bench");
+      for (size_t i = 0; i < count; ++i)
+      {
+         sides.push_back(std::make_shared<BenchSide>(i == 0));
+         device->AddSide("/bench/side" + std::to_string(i), sides.back());
+      }
+      device->StreamStart();
+      if (device->State() != asha::Device::STREAMING)
+         throw std::runtime_error(std::string("Bench device did not start streaming: ") + device->StateStr());
+      return device;
+   }
+
+   void PrintTable(const std::vector<Result>& results, size_t frames, const CycleCounter& counter)
+   {
+      std::cout << frames << " frames per stage";
+      if (!counter.Valid())
+         std::cout << ", cycle counter not available";
+      else if (counter.UserOnly())
+         std::cout << ", cycles are user space only";
+      std::cout << "\n";
+
+      char line[256];
+      snprintf(line, sizeof(line), "%-18s %10s %10s %10s %10s %12s",
+         "stage", "mean ns", "p50 ns", "p99 ns", "max ns", "cycles");
+      std::cout << line << "\n";
+      for (auto& r: results)
+      {
+         snprintf(line, sizeof(line), "%-18s %10.0f %10lu %10lu %10lu %12.0f",
+            r.name.c_str(), r.Mean(), r.Percentile(0.5), r.Percentile(0.99), r.Max(), r.cycles);
+         std::cout << line << "\n";
+      }
+   }
+
+   void PrintJson(const std::vector<Result>& results, size_t frames, const CycleCounter& counter)
+   {
+      std::cout << "{\"frames\": " << frames
+                << ", \"cycles\": \"" << (!counter.Valid() ? "none" : counter.UserOnly() ? "user" : "all") << "\""
+                << ", \"stages\": [";
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+         auto& r = results[i];
+         char line[256];
+         snprintf(line, sizeof(line),
+            "%s\n   {\"name\": \"%s\", \"mean_ns\": %.1f, \"p50_ns\": %lu, \"p99_ns\": %lu, \"max_ns\": %lu, ",
+            i ? "," : "", r.name.c_str(), r.Mean(), r.Percentile(0.5), r.Percentile(0.99), r.Max());
+         std::cout << line;
+         if (std::isnan(r.cycles))
+            std::cout << "\"cycles\": null}";
+         else
+            std::cout << "\"cycles\": " << (uint64_t)r.cycles << "}";
+      }
+      std::cout << "\n]}\n";
+   }
+}
+
+int main(int argc, char** argv)
+{
+   asha::Config::SetHelpDescription("Times each stage of the per frame audio path, using fake devices.");
+   asha::Config::AddExtraStringOption("frames", "Number of frames to time for each stage [default: 5000]");
+   asha::Config::AddExtraFlagOption("json", "Print the results as json");
+   asha::Config::ReadArgs(argc, argv);
+
+   size_t frames = DEFAULT_FRAMES;
+   if (!asha::Config::Extra("frames").empty())
+      frames = std::stoul(asha::Config::Extra("frames"));
+   if (frames == 0)
+      asha::Config::HelpAndExit("--frames must be more than 0");
+
+   std::vector<int16_t> left;
+   std::vector<int16_t> right;
+   Synthesize(left, right);
+
+   CycleCounter counter;
+   std::vector<Result> results;
+
+   // pw::Stream::Process: planar pipewire buffers into RawS16 slots.
+   {
+      auto buffer = std::make_shared<BenchBuffer>();
+      size_t pos = 0;
+      pw::Packetizer packetizer(buffer);
+      results.push_back(Measure("packetize", frames, counter, [&](size_t) {
+         size_t target = buffer->Sent() + 1;
+         while (buffer->Sent() < target)
+         {
+            if (pos + QUANTUM > INPUT_SAMPLES)
+               pos = 0;
+            packetizer.Push(&left[pos], &right[pos], QUANTUM);
+            pos += QUANTUM;
+         }
+      }));
+   }
+
+   // Prepare every input frame up front, so the remaining stages only time
+   // their own work.
+   std::vector<RawS16> input(std::min<size_t>(frames, INPUT_SAMPLES / RawS16::SAMPLE_COUNT));
+   for (size_t i = 0; i < input.size(); ++i)
+   {
+      memcpy(input[i].l, &left[i * RawS16::SAMPLE_COUNT], sizeof(input[i].l));
+      memcpy(input[i].r, &right[i * RawS16::SAMPLE_COUNT], sizeof(input[i].r));
+   }
+   auto frame = [&](size_t i) -> const RawS16& { return input[i % input.size()]; };
+
+   int16_t mono[RawS16::SAMPLE_COUNT];
+   results.push_back(Measure("downmix", frames, counter, [&](size_t i) {
+      frame(i).Downmix(mono);
+      Clobber(mono);
+   }));
+
+   {
+      AudioPacket packet{};
+      g722_encode_state_t state;
+      g722_encode_init(&state, 64000, G722_PACKED);
+      results.push_back(Measure("g722_encode", frames, counter, [&](size_t i) {
+         g722_encode(&state, packet.data, frame(i).l, RawS16::SAMPLE_COUNT);
+         Clobber(&packet);
+      }));
+
+      asha::G722Encoder encoder;
+      results.push_back(Measure("encode_mono", frames, counter, [&](size_t i) {
+         encoder.Encode(packet.data, frame(i).l, RawS16::SAMPLE_COUNT);
+         Clobber(&packet);
+      }));
+   }
+
+   {
+      AudioPacket packets[2]{};
+      asha::G722Encoder encoder_left;
+      asha::G722Encoder encoder_right;
+      results.push_back(Measure("encode_stereo", frames, counter, [&](size_t i) {
+         asha::G722Encoder::EncodeStereo(encoder_left, encoder_right, packets[0].data, packets[1].data,
+                                         frame(i).l, frame(i).r, RawS16::SAMPLE_COUNT);
+         Clobber(packets);
+      }));
+
+      // Stamping a pair of packets with the sequence number and payload.
+      uint8_t seq = 0;
+      uint8_t encoded[2][AudioPacket::SIZE_BYTES];
+      memcpy(encoded[0], packets[0].data, sizeof(encoded[0]));
+      memcpy(encoded[1], packets[1].data, sizeof(encoded[1]));
+      results.push_back(Measure("packet", frames, counter, [&](size_t i) {
+         AudioPacket out[2];
+         out[0].seq = out[1].seq = seq++;
+         memcpy(out[0].data, encoded[0], sizeof(out[0].data));
+         memcpy(out[1].data, encoded[1], sizeof(out[1].data));
+         Clobber(out);
+      }));
+   }
+
+   // The whole of Device::SendAudio: downmix, encode and send(), then the
+   // same for stereo with both sends in one io_uring submission.
+   struct SendStage { const char* name; size_t count; bool uring; };
+   for (auto stage: { SendStage{"send_audio_mono", 1, false},
+                      SendStage{"send_audio_stereo", 2, false},
+                      SendStage{"send_audio_uring", 2, true} })
+   {
+      asha::Config::SetConfigItem("io_uring", stage.uring);
+      std::vector<std::shared_ptr<BenchSide>> sides;
+      auto device = StreamingDevice(sides, stage.count);
+      size_t failed = 0;
+      results.push_back(Measure(stage.name, frames, counter,
+         [&](size_t i) {
+            if (!device->SendAudio(frame(i)))
+               ++failed;
+         },
+         [&](size_t) {
+            for (auto& side: sides)
+               side->Drain();
+         }));
+      if (failed)
+         std::cerr << results.back().name << ": " << failed << " frames failed to send\n";
+   }
+
+   if (asha::Config::ExtraBool("json"))
+      PrintJson(results, frames, counter);
+   else
+      PrintTable(results, frames, counter);
+   return 0;
+}
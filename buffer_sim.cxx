@@ -0,0 +1,416 @@
+// Replays pipewire's buffer timing through each buffer algorithm against a
+// simulated hearing device, on a simulated clock, so that the algorithms
+// can be compared without hearing aids, and much faster than real time.
+//
+// The producer timing comes either from a trace file, with one
+// "<microseconds> <samples>" line per pipewire buffer (samples at 16kHz), or
+// from a synthetic graph running a fixed quantum with some scheduling
+// jitter.
+//
+// Every sample is tagged with the number of the frame it belongs to, so the
+// simulated device knows which frame it is playing, and when it was
+// produced. Silence shows up as frame 0.
+
+#include "asha/AudioPacket.hh"
+#include "asha/Buffer.hh"
+#include "asha/Clock.hh"
+#include "asha/Config.hh"
+#include "asha/DeviceInterface.hh"
+#include "asha/SimClock.hh"
+#include "pw/Packetizer.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+   // Pipewire runs the stream at 16kHz.
+   constexpr uint64_t STREAM_RATE = 16000;
+   // Frames the device can hold, and so credits it hands out.
+   constexpr size_t DEVICE_FRAMES = ASHA_STREAM_DEPTH / ASHA_PACKET_TIME;
+   // Frames the socket takes before send() fails.
+   constexpr size_t KERNEL_FRAMES = 16;
+   // Packets the link gets through in one connection event.
+   constexpr size_t PACKETS_PER_EVENT = 2;
+   // The device gives up and stops playing after this many empty slots.
+   constexpr size_t IDLE_SLOTS = DEVICE_FRAMES;
+   // Start the clock somewhere that doesn't look like "never".
+   constexpr uint64_t START = 1000000000;
+
+   struct Options
+   {
+      uint64_t interval;   // Connection interval, ns
+      double drift;        // Producer clock relative to the device, ppm
+      double loss;         // Chance that a packet needs retransmitting, 0 to 1
+      unsigned seed;
+   };
+
+   struct Result
+   {
+      std::string name;
+      size_t played = 0;
+      size_t dropouts = 0;
+      size_t silence = 0;
+      size_t skipped = 0;
+      size_t retransmits = 0;
+      std::vector<uint64_t> latency;
+
+      uint64_t Percentile(double fraction)
+      {
+         if (latency.empty())
+            return 0;
+         size_t rank = std::min(latency.size() - 1, (size_t)(fraction * latency.size()));
+         std::nth_element(latency.begin(), latency.begin() + rank, latency.end());
+         return latency[rank];
+      }
+   };
+
+   // A hearing device at the other end of an LE link. Frames wait in the
+   // kernel until the device has a free credit, then in the controller for
+   // the link to get them across, then play back every 20ms by the device's
+   // own clock. Each frame played hands its credit back.
+   class SimDevice: public DeviceInterface
+   {
+   public:
+      SimDevice(const Options& options, const std::vector<uint64_t>& produced, Result& result):
+         m_options{options},
+         m_produced{produced},
+         m_result{result},
+         m_rng{options.seed},
+         m_period{(uint64_t)(ASHA_PACKET_TIME * (1 + options.drift / 1000000))},
+         m_next_event{START}
+      {
+      }
+
+      virtual bool SendAudio(const RawS16& samples) override
+      {
+         if (m_kernel.size() >= KERNEL_FRAMES)
+            return false;
+         m_kernel.push_back((uint16_t)samples.l[0] | (uint32_t)(uint16_t)samples.r[0] << 16);
+         Flush();
+         return true;
+      }
+
+      virtual void StreamStart() override {}
+      virtual void StreamStop() override
+      {
+         m_kernel.clear();
+         m_controller.clear();
+         m_held.clear();
+         m_playing = false;
+      }
+      virtual size_t QueuedFrames() const override { return m_kernel.size(); }
+
+      uint64_t NextEvent() const { return m_playing ? std::min(m_next_event, m_next_play) : m_next_event; }
+
+      // Run the link and the playback up to the given time.
+      void Run(uint64_t now)
+      {
+         while (NextEvent() <= now)
+         {
+            if (m_next_event <= now && (!m_playing || m_next_event <= m_next_play))
+            {
+               ConnectionEvent(m_next_event);
+               m_next_event += m_options.interval;
+            }
+            else
+            {
+               Play(m_next_play);
+               m_next_play += m_period;
+            }
+         }
+      }
+
+   private:
+      // Hand the controller whatever there are credits for.
+      void Flush()
+      {
+         while (!m_kernel.empty() && m_controller.size() + m_held.size() < DEVICE_FRAMES)
+         {
+            m_controller.push_back(m_kernel.front());
+            m_kernel.pop_front();
+         }
+      }
+
+      void ConnectionEvent(uint64_t now)
+      {
+         std::bernoulli_distribution lost(m_options.loss);
+         for (size_t i = 0; i < PACKETS_PER_EVENT && !m_controller.empty(); ++i)
+         {
+            // The link layer retries until it gets through, and nothing
+            // behind it can go first.
+            if (lost(m_rng))
+            {
+               ++m_result.retransmits;
+               break;
+            }
+            m_held.push_back(m_controller.front());
+            m_controller.pop_front();
+         }
+         if (!m_playing && !m_held.empty())
+         {
+            m_playing = true;
+            m_idle = 0;
+            m_next_play = now;
+         }
+      }
+
+      void Play(uint64_t now)
+      {
+         if (m_held.empty())
+         {
+            ++m_result.dropouts;
+            if (++m_idle >= IDLE_SLOTS)
+               m_playing = false;
+            return;
+         }
+         m_idle = 0;
+         uint32_t frame = m_held.front();
+         m_held.pop_front();
+         Flush();
+         ++m_result.played;
+         if (frame == 0)
+         {
+            ++m_result.silence;
+            return;
+         }
+         if (frame > m_last + 1)
+            m_result.skipped += frame - m_last - 1;
+         m_last = std::max(m_last, frame);
+         if (frame < m_produced.size())
+            m_result.latency.push_back(now - m_produced[frame]);
+      }
+
+      const Options& m_options;
+      const std::vector<uint64_t>& m_produced;
+      Result& m_result;
+      std::mt19937 m_rng;
+      const uint64_t m_period;
+
+      std::deque<uint32_t> m_kernel;
+      std::deque<uint32_t> m_controller;
+      std::deque<uint32_t> m_held;
+      uint64_t m_next_event;
+      uint64_t m_next_play = 0;
+      bool m_playing = false;
+      size_t m_idle = 0;
+      uint32_t m_last = 0;
+   };
+
+   // One buffer from pipewire.
+   struct Arrival
+   {
+      uint64_t time;
+      size_t samples;
+   };
+
+   std::vector<Arrival> ReadTrace(const std::string& filename)
+   {
+      std::ifstream in(filename);
+      if (!in)
+         throw std::runtime_error("Unable to open " + filename);
+      std::vector<Arrival> trace;
+      std::string line;
+      while (std::getline(in, line))
+      {
+         if (line.empty() || line[0] == '#')
+            continue;
+         std::istringstream fields(line);
+         uint64_t us;
+         size_t samples;
+         if (!(fields >> us >> samples))
+            throw std::runtime_error("Bad trace line: " + line);
+         trace.push_back(Arrival{us * 1000, samples});
+      }
+      if (trace.empty())
+         throw std::runtime_error(filename + " has no buffers in it");
+      uint64_t base = trace.front().time;
+      for (auto& a: trace)
+         a.time = a.time - base + START;
+      return trace;
+   }
+
+   // A graph running the given quantum at the given rate, resampled to the
+   // stream's 16kHz, with each wakeup up to `jitter` ns late.
+   std::vector<Arrival> SynthesizeTrace(uint64_t seconds, size_t quantum, uint64_t rate, uint64_t jitter, unsigned seed)
+   {
+      std::mt19937 rng(seed);
+      std::uniform_int_distribution<uint64_t> late(0, jitter);
+      std::vector<Arrival> trace;
+      uint64_t end = seconds * 1000000000;
+      uint64_t resampled = 0;
+      uint64_t last = 0;
+      for (uint64_t i = 0; i * quantum * 1000000000 / rate < end; ++i)
+      {
+         uint64_t t = START + i * quantum * 1000000000 / rate + late(rng);
+         last = std::max(last, t);
+         uint64_t total = (i + 1) * quantum * STREAM_RATE / rate;
+         trace.push_back(Arrival{last, (size_t)(total - resampled)});
+         resampled = total;
+      }
+      return trace;
+   }
+
+   Result Simulate(asha::Config::BufferAlgorithmEnum algorithm, const std::string& name,
+                   const std::vector<Arrival>& trace, const Options& options)
+   {
+      Result result;
+      result.name = name;
+      // When each frame was finished, by frame number.
+      std::vector<uint64_t> produced(1);
+
+      asha::SimClock clock(trace.front().time);
+      auto device = std::make_shared<SimDevice>(options, produced, result);
+      asha::Config::SetConfigItem("buffer_algorithm", algorithm);
+      auto buffer = asha::Buffer::Create(device, clock);
+      // Only the threaded buffer does anything outside of SendBuffer().
+      size_t threads = algorithm == asha::Config::THREADED ? 1 : 0;
+      pw::Packetizer packetizer(buffer);
+
+      buffer->StreamStart();
+      clock.AdvanceTo(trace.front().time, threads);
+
+      std::vector<int16_t> left;
+      std::vector<int16_t> right;
+      uint64_t samples = 0;
+      for (size_t i = 0; i < trace.size(); )
+      {
+         uint64_t t = std::min({ trace[i].time, device->NextEvent(), clock.NextDeadline() });
+         device->Run(t);
+         clock.AdvanceTo(t, threads);
+         for (; i < trace.size() && trace[i].time <= t; ++i)
+         {
+            left.resize(trace[i].samples);
+            right.resize(trace[i].samples);
+            for (size_t j = 0; j < trace[i].samples; ++j)
+            {
+               uint32_t frame = (samples + j) / RawS16::SAMPLE_COUNT + 1;
+               left[j] = (int16_t)(frame & 0xffff);
+               right[j] = (int16_t)(frame >> 16);
+            }
+            samples += trace[i].samples;
+            while (produced.size() <= samples / RawS16::SAMPLE_COUNT)
+               produced.push_back(t);
+            packetizer.Push(left.data(), right.data(), trace[i].samples);
+         }
+      }
+
+      clock.Release();
+      buffer.reset();
+      return result;
+   }
+
+   void PrintTable(std::vector<Result>& results)
+   {
+      char line[256];
+      snprintf(line, sizeof(line), "%-10s %8s %8s %8s %8s %8s %8s %8s %8s",
+         "algorithm", "played", "dropout", "silence", "skipped", "retrans", "p50 ms", "p99 ms", "max ms");
+      std::cout << line << "\n";
+      for (auto& r: results)
+      {
+         snprintf(line, sizeof(line), "%-10s %8zu %8zu %8zu %8zu %8zu %8.1f %8.1f %8.1f",
+            r.name.c_str(), r.played, r.dropouts, r.silence, r.skipped, r.retransmits,
+            r.Percentile(0.5) / 1e6, r.Percentile(0.99) / 1e6, r.Percentile(1.0) / 1e6);
+         std::cout << line << "\n";
+      }
+   }
+
+   template <typename T>
+   T ExtraNumber(const std::string& name, T def)
+   {
+      const std::string& value = asha::Config::Extra(name);
+      if (value.empty())
+         return def;
+      try
+      {
+         return std::is_floating_point<T>::value ? (T)std::stod(value) : (T)std::stoull(value);
+      }
+      catch (const std::exception&)
+      {
+         asha::Config::HelpAndExit("--" + name + " must be a number");
+      }
+      return def;
+   }
+}
+
+int main(int argc, char** argv)
+{
+   asha::Config::SetHelpDescription("Replays pipewire buffer timing through the buffer algorithms, against a simulated device.");
+   asha::Config::AddExtraStringOption("trace", "File of \"<us> <samples>\" lines, one per pipewire buffer at 16kHz");
+   asha::Config::AddExtraStringOption("seconds", "Length of the synthetic trace [default: 60]");
+   asha::Config::AddExtraStringOption("quantum", "Synthetic graph quantum [default: 1024]");
+   asha::Config::AddExtraStringOption("rate", "Synthetic graph rate [default: 48000]");
+   asha::Config::AddExtraStringOption("jitter", "Synthetic wakeups are up to this many us late [default: 2000]");
+   asha::Config::AddExtraStringOption("drift", "How much faster than the device the producer runs, in ppm [default: 0]");
+   asha::Config::AddExtraStringOption("loss", "Percent of packets that need retransmitting [default: 1]");
+   asha::Config::AddExtraStringOption("seed", "Random seed [default: 1]");
+   asha::Config::AddExtraFlagOption("selected", "Only simulate the --buffer_algorithm, rather than all of them");
+   asha::Config::ReadArgs(argc, argv);
+
+   Options options;
+   options.interval = asha::Config::Interval() * 1250000ull;
+   options.drift = ExtraNumber<double>("drift", 0);
+   options.loss = ExtraNumber<double>("loss", 1) / 100;
+   options.seed = ExtraNumber<unsigned>("seed", 1);
+   if (options.loss < 0 || options.loss >= 1)
+      asha::Config::HelpAndExit("--loss must be from 0 to less than 100");
+
+   std::vector<Arrival> trace;
+   try
+   {
+      if (!asha::Config::Extra("trace").empty())
+         trace = ReadTrace(asha::Config::Extra("trace"));
+      else
+      {
+         uint64_t rate = ExtraNumber<uint64_t>("rate", 48000);
+         size_t quantum = ExtraNumber<size_t>("quantum", 1024);
+         if (rate == 0 || quantum == 0)
+            asha::Config::HelpAndExit("--rate and --quantum must be more than 0");
+         trace = SynthesizeTrace(ExtraNumber<uint64_t>("seconds", 60), quantum, rate,
+                                 ExtraNumber<uint64_t>("jitter", 2000) * 1000, options.seed);
+      }
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << e.what() << '\n';
+      return 1;
+   }
+   if (trace.empty())
+      asha::Config::HelpAndExit("The trace is empty");
+
+   struct Algorithm { asha::Config::BufferAlgorithmEnum value; const char* name; };
+   std::vector<Algorithm> algorithms = {
+      { asha::Config::NONE, "none" },
+      { asha::Config::THREADED, "threaded" },
+      { asha::Config::POLL4, "poll4" },
+      { asha::Config::POLL8, "poll8" },
+      { asha::Config::TIMED, "timed" },
+      { asha::Config::CREDIT, "credit" },
+   };
+   static_assert(asha::Config::BUFFER_ALGORITHM_ENUM_SIZE == 6, "Add the new algorithm to buffer_sim");
+   if (asha::Config::ExtraBool("selected"))
+   {
+      auto selected = asha::Config::BufferAlgorithm();
+      algorithms.erase(std::remove_if(algorithms.begin(), algorithms.end(),
+         [selected](const Algorithm& a) { return a.value != selected; }), algorithms.end());
+   }
+
+   uint64_t duration = trace.back().time - trace.front().time;
+   printf("%zu buffers over %.1f s, %.0f ppm drift, %.1f%% loss, %.2f ms interval\n",
+      trace.size(), duration / 1e9, options.drift, options.loss * 100, options.interval / 1e6);
+
+   std::vector<Result> results;
+   for (auto& a: algorithms)
+      results.push_back(Simulate(a.value, a.name, trace, options));
+   PrintTable(results);
+   return 0;
+}
@@ -0,0 +1,214 @@
+// Micro-benchmark for the G.722 encoder.
+//
+// Encodes each input in 320 sample frames, the same way Device::SendAudio
+// does, and reports the best time per frame over several passes, for both the
+// generic g722_encode() and the specialized asha::G722Encoder. Inputs are
+// raw mono s16le files at 16 kHz (sounds/make_raw_files.sh makes some). With
+// no arguments it synthesizes speech, music and noise instead.
+//
+// The build makes two copies: g722_bench with the current quantizer, and
+// g722_bench_linear with the original linear QUANTL scan. Every checksum
+// printed for an input should match.
+
+#include "g722_enc_dec.h"
+#include "../asha/G722Encoder.hh"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+   constexpr size_t FRAME_SAMPLES = 320;
+   constexpr size_t RATE = 16000;
+   constexpr size_t PASSES = 7;
+
+   struct Input
+   {
+      std::string name;
+      std::vector<int16_t> samples;
+   };
+
+   int16_t Clip(double v)
+   {
+      if (v > 32767) return 32767;
+      if (v < -32768) return -32768;
+      return (int16_t)v;
+   }
+
+   // Glottal pulses through a few formant resonators, with a syllable
+   // envelope and pauses. Crude, but it has the spectral tilt and the
+   // loud/quiet alternation of real speech.
+   std::vector<int16_t> Speech(size_t seconds)
+   {
+      std::mt19937 rng(1);
+      std::normal_distribution<double> noise(0, 1);
+      std::vector<int16_t> ret(seconds * RATE);
+      const double formants[3][2] = {{700, 130}, {1220, 70}, {2600, 160}};
+      double y[3][2] = {};
+      double phase = 0;
+      for (size_t i = 0; i < ret.size(); ++i)
+      {
+         double t = (double)i / RATE;
+         double f0 = 110 + 30 * std::sin(2 * M_PI * 0.7 * t);
+         phase += f0 / RATE;
+         double excite = 0;
+         if (phase >= 1)
+         {
+            phase -= 1;
+            excite = 1;
+         }
+         excite += 0.02 * noise(rng);
+         double out = 0;
+         for (size_t f = 0; f < 3; ++f)
+         {
+            double r = std::exp(-M_PI * formants[f][1] / RATE);
+            double c = 2 * r * std::cos(2 * M_PI * formants[f][0] / RATE);
+            double v = excite + c * y[f][0] - r * r * y[f][1];
+            y[f][1] = y[f][0];
+            y[f][0] = v;
+            out += v;
+         }
+         double syllable = std::sin(M_PI * std::fmod(t * 4, 1.0));
+         bool pause = std::fmod(t, 3.0) > 2.4;
+         ret[i] = Clip(pause ? 30 * noise(rng) : 1500 * out * syllable);
+      }
+      return ret;
+   }
+
+   // A few chords with harmonics, changing every half second.
+   std::vector<int16_t> Music(size_t seconds)
+   {
+      const double chords[4][3] = {
+         {261.6, 329.6, 392.0},
+         {220.0, 261.6, 329.6},
+         {174.6, 220.0, 261.6},
+         {196.0, 246.9, 293.7},
+      };
+      std::vector<int16_t> ret(seconds * RATE);
+      for (size_t i = 0; i < ret.size(); ++i)
+      {
+         double t = (double)i / RATE;
+         const double* chord = chords[(size_t)(t * 2) % 4];
+         double decay = std::exp(-3 * std::fmod(t, 0.5));
+         double v = 0;
+         for (size_t n = 0; n < 3; ++n)
+            for (size_t h = 1; h <= 6; ++h)
+               v += std::sin(2 * M_PI * chord[n] * h * t) / h;
+         ret[i] = Clip(3000 * v * decay);
+      }
+      return ret;
+   }
+
+   std::vector<int16_t> Noise(size_t seconds)
+   {
+      std::mt19937 rng(2);
+      std::uniform_int_distribution<int> d(-32768, 32767);
+      std::vector<int16_t> ret(seconds * RATE);
+      for (auto& s: ret)
+         s = d(rng);
+      return ret;
+   }
+
+   std::vector<int16_t> ReadRaw(const std::string& path)
+   {
+      std::ifstream in(path, std::ios::binary);
+      if (!in)
+         throw std::runtime_error("Unable to read " + path);
+      std::vector<int16_t> ret;
+      int16_t buf[FRAME_SAMPLES];
+      while (in.read((char*)buf, sizeof(buf)))
+         ret.insert(ret.end(), buf, buf + FRAME_SAMPLES);
+      return ret;
+   }
+
+   uint64_t Fnv1a(uint64_t h, const uint8_t* data, size_t len)
+   {
+      for (size_t i = 0; i < len; ++i)
+      {
+         h ^= data[i];
+         h *= 0x100000001b3ull;
+      }
+      return h;
+   }
+}
+
+int main(int argc, char** argv)
+{
+   std::vector<Input> inputs;
+   for (int i = 1; i < argc; ++i)
+      inputs.push_back({argv[i], ReadRaw(argv[i])});
+   if (inputs.empty())
+   {
+      inputs.push_back({"speech", Speech(20)});
+      inputs.push_back({"music", Music(20)});
+      inputs.push_back({"noise", Noise(20)});
+   }
+
+#ifdef G722_LINEAR_QUANTL
+   std::cout << "Quantizer: linear scan\n";
+#else
+   std::cout << "Quantizer: branch free\n";
+#endif
+
+   for (auto& input: inputs)
+   {
+      size_t frames = input.samples.size() / FRAME_SAMPLES;
+      if (frames == 0)
+      {
+         std::cout << input.name << ": too short\n";
+         continue;
+      }
+
+      // Runs encode over every frame PASSES times, and returns the best time
+      // per frame and the checksum of the output.
+      auto run = [&](const std::function<void()>& reset,
+                     const std::function<size_t(uint8_t*, const int16_t*)>& encode)
+      {
+         uint8_t out[FRAME_SAMPLES / 2];
+         double best = INFINITY;
+         uint64_t checksum = 0;
+         for (size_t pass = 0; pass < PASSES; ++pass)
+         {
+            reset();
+            checksum = 0xcbf29ce484222325ull;
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t f = 0; f < frames; ++f)
+            {
+               size_t len = encode(out, &input.samples[f * FRAME_SAMPLES]);
+               checksum = Fnv1a(checksum, out, len);
+            }
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() < best)
+               best = elapsed.count();
+         }
+         return std::make_pair(best / frames, checksum);
+      };
+
+      g722_encode_state_t state{};
+      auto generic = run(
+         [&]() { g722_encode_init(&state, 64000, G722_PACKED); },
+         [&](uint8_t* out, const int16_t* in) { return (size_t)g722_encode(&state, out, in, FRAME_SAMPLES); });
+
+      asha::G722Encoder encoder;
+      auto specialized = run(
+         [&]() { encoder.Reset(); },
+         [&](uint8_t* out, const int16_t* in) { return encoder.Encode(out, in, FRAME_SAMPLES); });
+
+      char line[256];
+      snprintf(line, sizeof(line), "%-12s %6zu frames  generic %7.0f ns/frame  specialized %7.0f ns/frame  checksum %016llx%s",
+         input.name.c_str(), frames, generic.first, specialized.first, (unsigned long long)generic.second,
+         generic.second == specialized.second ? "" : "  MISMATCH");
+      std::cout << line << "\n";
+   }
+   return 0;
+}
@@ -95,8 +95,11 @@ typedef struct _g722_encode_state_t
     /*! 6 for 48000kbps, 7 for 56000kbps, or 8 for 64000kbps. */
     int bits_per_sample;
 
-    /*! Signal history for the QMF */
-    int x[24];
+    /*! Signal history for the QMF. Every sample is stored twice, 24 entries
+        apart, so the most recent 24 samples are always contiguous starting at
+        x[x_pos] and the history never has to be shuffled down. */
+    int16_t x[48];
+    int x_pos;
 
     g722_band_t band[2];
 
@@ -106,6 +109,13 @@ typedef struct _g722_encode_state_t
     int out_bits;
 } g722_encode_state_t;
 
+/*! A pair of encoders, run in lockstep by g722_encode_stereo() */
+typedef struct
+{
+    g722_encode_state_t left;
+    g722_encode_state_t right;
+} g722_encode_stereo_state_t;
+
 typedef struct
 {
     /*! TRUE if the operating in the special ITU test mode, with the band split filters
@@ -120,8 +130,9 @@ typedef struct
     /*! TRUE if offset binary for a 12-bit DAC */
     int dac_pcm;
 
-    /*! Signal history for the QMF */
-    int x[24];
+    /*! Signal history for the QMF, stored twice over like the encoder's */
+    int16_t x[48];
+    int x_pos;
 
     g722_band_t band[2];
     
@@ -139,8 +150,19 @@ g722_encode_state_t *g722_encode_init(g722_encode_state_t *s, unsigned int rate,
 int g722_encode_release(g722_encode_state_t *s);
 int g722_encode(g722_encode_state_t *s, uint8_t g722_data[], const int16_t amp[], int len);
 
+/*! Encode two channels in one pass. The output is identical to calling
+    g722_encode() on each channel separately. Returns the number of bytes
+    written to each of g722_left and g722_right. */
+g722_encode_stereo_state_t *g722_encode_stereo_init(g722_encode_stereo_state_t *s, unsigned int rate, int options);
+int g722_encode_stereo(g722_encode_stereo_state_t *s,
+                       uint8_t g722_left[], uint8_t g722_right[],
+                       const int16_t amp_left[], const int16_t amp_right[], int len);
+
 g722_decode_state_t *g722_decode_init(g722_decode_state_t *s, unsigned int rate, int options);
 int g722_decode_release(g722_decode_state_t *s);
+/*! aGain is a Q16 multiplier applied to every output sample. Q16 can't
+    express unity, so 0xFFFF is taken as exactly unity and leaves the samples
+    untouched. Returns the number of samples written. */
 uint32_t g722_decode(g722_decode_state_t *s, int16_t amp[], const uint8_t g722_data[], int len, uint16_t aGain);
 
 #ifdef __cplusplus
@@ -31,7 +31,8 @@
 #include <stdint.h>
 
 #include "g722_enc_dec.h"
-
+#include "g722_qmf.h"
+#include "g722_quantl.h"
 
 
 #if !defined(FALSE)
@@ -213,13 +214,6 @@ int16_t limitValues (int16_t rl)
 /*- End of function --------------------------------------------------------*/
 #endif
 
-static int16_t q6[32] =
-{
-       0,   35,   72,  110,  150,  190,  233,  276,
-     323,  370,  422,  473,  530,  587,  650,  714,
-     786,  858,  940, 1023, 1121, 1219, 1339, 1458,
-    1612, 1765, 1980, 2195, 2557, 2919,    0,    0
-};
 static int16_t iln[32] =
 {
      0, 63, 62, 31, 30, 29, 28, 27,
@@ -261,17 +255,48 @@ static int16_t qm2[4] =
 {
     -7408,  -1616,   7408,   1616
 };
-static int16_t qmf_coeffs[12] =
-{
-       3,  -11,   12,   32, -210,  951, 3876, -805,  362, -156,   53,  -11,
-};
 static int16_t ihn[3] = {0, 1, 0};
 static int16_t ihp[3] = {0, 3, 2};
 static int16_t wh[3] = {0, -214, 798};
 static int16_t rh2[4] = {2, 1, 2, 1};
 
-int g722_encode(g722_encode_state_t *s, uint8_t g722_data[],
-                       const int16_t amp[], int len)
+/* Push a sample pair into the QMF history, and return the window holding the
+   newest 24 samples */
+static __inline const int16_t *qmf_push(g722_encode_state_t *s, int16_t a, int16_t b)
+{
+    /* Store the new pair in both copies of the history, rather than shuffling
+       the buffer down */
+    s->x[s->x_pos] = s->x[s->x_pos + 24] = a;
+    s->x[s->x_pos + 1] = s->x[s->x_pos + 25] = b;
+    s->x_pos += 2;
+    if (s->x_pos >= 24)
+        s->x_pos = 0;
+    return &s->x[s->x_pos];
+}
+/*- End of function --------------------------------------------------------*/
+
+/* Turn the QMF sum and difference into the low and high band inputs */
+static __inline void qmf_split(int sum, int diff, int *xlow, int *xhigh)
+{
+    /* We shift by 12 to allow for the QMF filters (DC gain = 4096), plus 1
+       to allow for us summing two filters, plus 1 to allow for the 15 bit
+       input to the G.722 algorithm. */
+    *xlow = sum >> 14;
+    *xhigh = diff >> 14;
+
+#ifdef RUN_LIKE_REFERENCE_G722
+    /* The following lines are only used to verify bit-exactness
+     * with reference implementation of G.722. Higher precision
+     * is achieved without limiting the values.
+     */
+    *xlow = limitValues(*xlow);
+    *xhigh = limitValues(*xhigh);
+#endif
+}
+/*- End of function --------------------------------------------------------*/
+
+/* ADPCM encode one low band and one high band sample, returning the code */
+static __inline int encode_bands(g722_encode_state_t *s, int xlow, int xhigh)
 {
     int dlow;
     int dhigh;
@@ -286,17 +311,117 @@ int g722_encode(g722_encode_state_t *s, uint8_t g722_data[],
     int eh;
     int mih;
     int i;
+    int ihigh;
+    int ilow;
+    int code;
+
+    /* Block 1L, SUBTRA */
+    el = saturate(xlow - s->band[0].s);
+
+    /* Block 1L, QUANTL */
+    wd = (el >= 0)  ?  el  :  -(el + 1);
+
+    i = quantl(wd, s->band[0].det);
+    ilow = (el < 0)  ?  iln[i]  :  ilp[i];
+
+    /* Block 2L, INVQAL */
+    ril = ilow >> 2;
+    wd2 = qm4[ril];
+    dlow = (s->band[0].det*wd2) >> 15;
+
+    /* Block 3L, LOGSCL */
+    il4 = rl42[ril];
+    wd = (s->band[0].nb*127) >> 7;
+    s->band[0].nb = wd + wl[il4];
+    if (s->band[0].nb < 0)
+        s->band[0].nb = 0;
+    else if (s->band[0].nb > 18432)
+        s->band[0].nb = 18432;
+
+    /* Block 3L, SCALEL */
+    wd1 = (s->band[0].nb >> 6) & 31;
+    wd2 = 8 - (s->band[0].nb >> 11);
+    wd3 = (wd2 < 0)  ?  (ilb[wd1] << -wd2)  :  (ilb[wd1] >> wd2);
+    s->band[0].det = wd3 << 2;
+
+    block4(&s->band[0], dlow);
+    {
+        int nb;
+
+        /* Block 1H, SUBTRA */
+        eh = saturate(xhigh - s->band[1].s);
+
+        /* Block 1H, QUANTH */
+        wd = (eh >= 0)  ?  eh  :  -(eh + 1);
+        wd1 = (564*s->band[1].det) >> 12;
+        mih = (wd >= wd1)  ?  2  :  1;
+        ihigh = (eh < 0)  ?  ihn[mih]  :  ihp[mih];
+
+        /* Block 2H, INVQAH */
+        wd2 = qm2[ihigh];
+        dhigh = (s->band[1].det*wd2) >> 15;
+
+        /* Block 3H, LOGSCH */
+        ih2 = rh2[ihigh];
+        wd = (s->band[1].nb*127) >> 7;
+
+        nb = wd + wh[ih2];
+        if (nb < 0)
+            nb = 0;
+        else if (nb > 22528)
+            nb = 22528;
+        s->band[1].nb = nb;
+
+        /* Block 3H, SCALEH */
+        wd1 = (s->band[1].nb >> 6) & 31;
+        wd2 = 10 - (s->band[1].nb >> 11);
+        wd3 = (wd2 < 0)  ?  (ilb[wd1] << -wd2)  :  (ilb[wd1] >> wd2);
+        s->band[1].det = wd3 << 2;
+
+        block4(&s->band[1], dhigh);
+#if   BITS_PER_SAMPLE == 8
+        code = ((ihigh << 6) | ilow);
+#elif BITS_PER_SAMPLE == 7
+        code = ((ihigh << 6) | ilow) >> 1;
+#elif BITS_PER_SAMPLE == 6
+        code = ((ihigh << 6) | ilow) >> 2;
+#endif
+    }
+    return code;
+}
+/*- End of function --------------------------------------------------------*/
+
+static __inline int put_code(g722_encode_state_t *s, uint8_t g722_data[], int g722_bytes, int code)
+{
+#if PACKED_OUTPUT == 1
+    /* Pack the code bits */
+    s->out_buffer |= (code << s->out_bits);
+    s->out_bits += s->bits_per_sample;
+    if (s->out_bits >= 8)
+    {
+        g722_data[g722_bytes++] = (uint8_t) (s->out_buffer & 0xFF);
+        s->out_bits -= 8;
+        s->out_buffer >>= 8;
+    }
+#else
+    (void) s;
+    g722_data[g722_bytes++] = (uint8_t) code;
+#endif
+    return g722_bytes;
+}
+/*- End of function --------------------------------------------------------*/
+
+int g722_encode(g722_encode_state_t *s, uint8_t g722_data[],
+                       const int16_t amp[], int len)
+{
     int j;
     /* Low and high band PCM from the QMF */
     int xlow;
     int xhigh;
     int g722_bytes;
-    /* Even and odd tap accumulators */
-    int sumeven;
-    int sumodd;
-    int ihigh;
-    int ilow;
-    int code;
+    /* Sum and difference of the even and odd tap accumulators */
+    int sum;
+    int diff;
 
     g722_bytes = 0;
     xhigh = 0;
@@ -309,130 +434,67 @@ int g722_encode(g722_encode_state_t *s, uint8_t g722_data[],
         }
         else
         {
-            {
-                /* Apply the transmit QMF */
-                /* Shuffle the buffer down */
-                for (i = 0;  i < 22;  i++)
-                    s->x[i] = s->x[i + 2];
-                //TODO: if len is odd, then this can be a buffer overrun
-                s->x[22] = amp[j++];
-                s->x[23] = amp[j++];
-    
-                /* Discard every other QMF output */
-                sumeven = 0;
-                sumodd = 0;
-                for (i = 0;  i < 12;  i++)
-                {
-                    sumodd += s->x[2*i]*qmf_coeffs[i];
-                    sumeven += s->x[2*i + 1]*qmf_coeffs[11 - i];
-                }
-                /* We shift by 12 to allow for the QMF filters (DC gain = 4096), plus 1
-                   to allow for us summing two filters, plus 1 to allow for the 15 bit
-                   input to the G.722 algorithm. */
-                xlow = (sumeven + sumodd) >> 14;
-                xhigh = (sumeven - sumodd) >> 14;
-
-#ifdef RUN_LIKE_REFERENCE_G722
-                /* The following lines are only used to verify bit-exactness
-                 * with reference implementation of G.722. Higher precision
-                 * is achieved without limiting the values.
-                 */
-                xlow = limitValues(xlow);
-                xhigh = limitValues(xhigh);
-#endif
-            }
+            /* Apply the transmit QMF */
+            //TODO: if len is odd, then this can be a buffer overrun
+            qmf_dot(qmf_push(s, amp[j], amp[j + 1]), &sum, &diff);
+            j += 2;
+            /* Discard every other QMF output */
+            qmf_split(sum, diff, &xlow, &xhigh);
         }
-        /* Block 1L, SUBTRA */
-        el = saturate(xlow - s->band[0].s);
+        g722_bytes = put_code(s, g722_data, g722_bytes, encode_bands(s, xlow, xhigh));
+    }
+    return g722_bytes;
+}
+/*- End of function --------------------------------------------------------*/
+
+g722_encode_stereo_state_t *g722_encode_stereo_init(g722_encode_stereo_state_t *s,
+                                                    unsigned int rate, int options)
+{
+    if (s == NULL)
+        return NULL;
+    g722_encode_init(&s->left, rate, options);
+    g722_encode_init(&s->right, rate, options);
+    return s;
+}
+/*- End of function --------------------------------------------------------*/
 
-        /* Block 1L, QUANTL */
-        wd = (el >= 0)  ?  el  :  -(el + 1);
+int g722_encode_stereo(g722_encode_stereo_state_t *s,
+                       uint8_t g722_left[], uint8_t g722_right[],
+                       const int16_t amp_left[], const int16_t amp_right[], int len)
+{
+    int j;
+    int xlow[2];
+    int xhigh[2];
+    int sum[2];
+    int diff[2];
+    int code[2];
+    int g722_bytes;
 
-        for (i = 1;  i < 30;  i++)
-        {
-            wd1 = (q6[i]*s->band[0].det) >> 12;
-            if (wd < wd1)
-                break;
-        }
-        ilow = (el < 0)  ?  iln[i]  :  ilp[i];
-
-        /* Block 2L, INVQAL */
-        ril = ilow >> 2;
-        wd2 = qm4[ril];
-        dlow = (s->band[0].det*wd2) >> 15;
-
-        /* Block 3L, LOGSCL */
-        il4 = rl42[ril];
-        wd = (s->band[0].nb*127) >> 7;
-        s->band[0].nb = wd + wl[il4];
-        if (s->band[0].nb < 0)
-            s->band[0].nb = 0;
-        else if (s->band[0].nb > 18432)
-            s->band[0].nb = 18432;
-
-        /* Block 3L, SCALEL */
-        wd1 = (s->band[0].nb >> 6) & 31;
-        wd2 = 8 - (s->band[0].nb >> 11);
-        wd3 = (wd2 < 0)  ?  (ilb[wd1] << -wd2)  :  (ilb[wd1] >> wd2);
-        s->band[0].det = wd3 << 2;
+    if (s->left.itu_test_mode  ||  s->right.itu_test_mode)
+    {
+        g722_encode(&s->right, g722_right, amp_right, len);
+        return g722_encode(&s->left, g722_left, amp_left, len);
+    }
 
-        block4(&s->band[0], dlow);
-        {
-	    int nb;
-
-            /* Block 1H, SUBTRA */
-            eh = saturate(xhigh - s->band[1].s);
-
-            /* Block 1H, QUANTH */
-            wd = (eh >= 0)  ?  eh  :  -(eh + 1);
-            wd1 = (564*s->band[1].det) >> 12;
-            mih = (wd >= wd1)  ?  2  :  1;
-            ihigh = (eh < 0)  ?  ihn[mih]  :  ihp[mih];
-
-            /* Block 2H, INVQAH */
-            wd2 = qm2[ihigh];
-            dhigh = (s->band[1].det*wd2) >> 15;
-
-            /* Block 3H, LOGSCH */
-            ih2 = rh2[ihigh];
-            wd = (s->band[1].nb*127) >> 7;
-
-            nb = wd + wh[ih2];
-            if (nb < 0)
-                nb = 0;
-            else if (nb > 22528)
-                nb = 22528;
-	    s->band[1].nb = nb;
-
-            /* Block 3H, SCALEH */
-            wd1 = (s->band[1].nb >> 6) & 31;
-            wd2 = 10 - (s->band[1].nb >> 11);
-            wd3 = (wd2 < 0)  ?  (ilb[wd1] << -wd2)  :  (ilb[wd1] >> wd2);
-            s->band[1].det = wd3 << 2;
-
-            block4(&s->band[1], dhigh);
-#if   BITS_PER_SAMPLE == 8
-            code = ((ihigh << 6) | ilow);
-#elif BITS_PER_SAMPLE == 7
-            code = ((ihigh << 6) | ilow) >> 1;
-#elif BITS_PER_SAMPLE == 6
-            code = ((ihigh << 6) | ilow) >> 2;
-#endif
-        }
+    /* The two channels share nothing, so interleaving them gives the CPU two
+       independent dependency chains to work on, and lets the QMF for both run
+       in the same vector registers. The per channel arithmetic is exactly
+       what g722_encode() does. */
+    g722_bytes = 0;
+    //TODO: if len is odd, then this can be a buffer overrun
+    for (j = 0;  j < len;  j += 2)
+    {
+        qmf_dot2(qmf_push(&s->left, amp_left[j], amp_left[j + 1]),
+                 qmf_push(&s->right, amp_right[j], amp_right[j + 1]),
+                 &sum[0], &diff[0], &sum[1], &diff[1]);
+        qmf_split(sum[0], diff[0], &xlow[0], &xhigh[0]);
+        qmf_split(sum[1], diff[1], &xlow[1], &xhigh[1]);
 
-#if PACKED_OUTPUT == 1
-            /* Pack the code bits */
-            s->out_buffer |= (code << s->out_bits);
-            s->out_bits += s->bits_per_sample;
-            if (s->out_bits >= 8)
-            {
-                g722_data[g722_bytes++] = (uint8_t) (s->out_buffer & 0xFF);
-                s->out_bits -= 8;
-                s->out_buffer >>= 8;
-            }
-#else
-            g722_data[g722_bytes++] = (uint8_t) code;
-#endif
+        code[0] = encode_bands(&s->left, xlow[0], xhigh[0]);
+        code[1] = encode_bands(&s->right, xlow[1], xhigh[1]);
+
+        put_code(&s->right, g722_right, g722_bytes, code[1]);
+        g722_bytes = put_code(&s->left, g722_left, g722_bytes, code[0]);
     }
     return g722_bytes;
 }
@@ -0,0 +1,159 @@
+/*
+ * g722_qmf.h - The G.722 QMF filter kernels, shared by the encoder and
+ * decoder.
+ *
+ * The filter arithmetic comes from the SpanDSP G.722 codec, written by Steve
+ * Underwood <steveu@coppice.org> and placed in the public domain.
+ */
+
+/*! \file */
+
+#if !defined(_G722_QMF_H_)
+#define _G722_QMF_H_
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* The 12 QMF coefficients
+       3,  -11,   12,   32, -210,  951, 3876, -805,  362, -156,   53,  -11
+   laid out against the 24 sample QMF window, so the even and odd taps become a
+   single dot product. Window entry 2*i pairs with coefficient i (the odd sum),
+   and entry 2*i + 1 with coefficient 11 - i (the even sum). qmf_diff[] has the
+   odd taps negated, giving sumeven - sumodd. */
+static const int16_t qmf_sum[24] =
+{
+       3,  -11,  -11,   53,   12, -156,   32,  362,
+    -210, -805,  951, 3876, 3876,  951, -805, -210,
+     362,   32, -156,   12,   53,  -11,  -11,    3
+};
+static const int16_t qmf_diff[24] =
+{
+      -3,  -11,   11,   53,  -12, -156,  -32,  362,
+     210, -805, -951, 3876,-3876,  951,  805, -210,
+    -362,   32,  156,   12,  -53,  -11,   11,    3
+};
+
+/* Run both halves of the QMF over the 24 sample window w[], oldest sample
+   first. Each coefficient appears twice across the 24 taps, so the largest
+   possible sum is 32768*2*6482 = 424804352, well inside the 32 bit lanes,
+   and the result is the same whatever order the taps are accumulated in. */
+static __inline void qmf_dot(const int16_t w[24], int *sum, int *diff)
+{
+#if defined(__SSE2__)
+    __m128i w0 = _mm_loadu_si128((const __m128i *) &w[0]);
+    __m128i w1 = _mm_loadu_si128((const __m128i *) &w[8]);
+    __m128i w2 = _mm_loadu_si128((const __m128i *) &w[16]);
+    __m128i vs;
+    __m128i vd;
+
+    vs = _mm_madd_epi16(w0, _mm_loadu_si128((const __m128i *) &qmf_sum[0]));
+    vs = _mm_add_epi32(vs, _mm_madd_epi16(w1, _mm_loadu_si128((const __m128i *) &qmf_sum[8])));
+    vs = _mm_add_epi32(vs, _mm_madd_epi16(w2, _mm_loadu_si128((const __m128i *) &qmf_sum[16])));
+    vd = _mm_madd_epi16(w0, _mm_loadu_si128((const __m128i *) &qmf_diff[0]));
+    vd = _mm_add_epi32(vd, _mm_madd_epi16(w1, _mm_loadu_si128((const __m128i *) &qmf_diff[8])));
+    vd = _mm_add_epi32(vd, _mm_madd_epi16(w2, _mm_loadu_si128((const __m128i *) &qmf_diff[16])));
+
+    /* Reduce both accumulators together: {s0+s2, d0+d2, s1+s3, d1+d3} */
+    vs = _mm_add_epi32(_mm_unpacklo_epi32(vs, vd), _mm_unpackhi_epi32(vs, vd));
+    vs = _mm_add_epi32(vs, _mm_unpackhi_epi64(vs, vs));
+    *sum = _mm_cvtsi128_si32(vs);
+    *diff = _mm_cvtsi128_si32(_mm_srli_si128(vs, 4));
+#elif defined(__ARM_NEON)
+    int32x4_t vs;
+    int32x4_t vd;
+    int i;
+
+    vs = vdupq_n_s32(0);
+    vd = vdupq_n_s32(0);
+    for (i = 0;  i < 24;  i += 8)
+    {
+        int16x8_t wv = vld1q_s16(&w[i]);
+        int16x8_t cs = vld1q_s16(&qmf_sum[i]);
+        int16x8_t cd = vld1q_s16(&qmf_diff[i]);
+
+        vs = vmlal_s16(vs, vget_low_s16(wv), vget_low_s16(cs));
+        vs = vmlal_s16(vs, vget_high_s16(wv), vget_high_s16(cs));
+        vd = vmlal_s16(vd, vget_low_s16(wv), vget_low_s16(cd));
+        vd = vmlal_s16(vd, vget_high_s16(wv), vget_high_s16(cd));
+    }
+#if defined(__aarch64__)
+    *sum = vaddvq_s32(vs);
+    *diff = vaddvq_s32(vd);
+#else
+    {
+        int32x2_t r = vpadd_s32(vpadd_s32(vget_low_s32(vs), vget_high_s32(vs)),
+                                vpadd_s32(vget_low_s32(vd), vget_high_s32(vd)));
+        *sum = vget_lane_s32(r, 0);
+        *diff = vget_lane_s32(r, 1);
+    }
+#endif
+#else
+    int i;
+    int vs;
+    int vd;
+
+    vs = 0;
+    vd = 0;
+    for (i = 0;  i < 24;  i++)
+    {
+        vs += w[i]*qmf_sum[i];
+        vd += w[i]*qmf_diff[i];
+    }
+    *sum = vs;
+    *diff = vd;
+#endif
+}
+/*- End of function --------------------------------------------------------*/
+
+#if defined(__SSE2__)
+/* qmf_dot() for two windows at once, sharing the final reduction */
+static __inline void qmf_dot2(const int16_t wa[24], const int16_t wb[24],
+                              int *suma, int *diffa, int *sumb, int *diffb)
+{
+    __m128i as = _mm_setzero_si128();
+    __m128i ad = _mm_setzero_si128();
+    __m128i bs = _mm_setzero_si128();
+    __m128i bd = _mm_setzero_si128();
+    __m128i t0;
+    __m128i t1;
+    int i;
+
+    for (i = 0;  i < 24;  i += 8)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *) &wa[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i *) &wb[i]);
+        __m128i cs = _mm_loadu_si128((const __m128i *) &qmf_sum[i]);
+        __m128i cd = _mm_loadu_si128((const __m128i *) &qmf_diff[i]);
+
+        as = _mm_add_epi32(as, _mm_madd_epi16(va, cs));
+        ad = _mm_add_epi32(ad, _mm_madd_epi16(va, cd));
+        bs = _mm_add_epi32(bs, _mm_madd_epi16(vb, cs));
+        bd = _mm_add_epi32(bd, _mm_madd_epi16(vb, cd));
+    }
+
+    /* Transpose and add, leaving {as, ad, bs, bd} */
+    t0 = _mm_add_epi32(_mm_unpacklo_epi32(as, ad), _mm_unpackhi_epi32(as, ad));
+    t1 = _mm_add_epi32(_mm_unpacklo_epi32(bs, bd), _mm_unpackhi_epi32(bs, bd));
+    t0 = _mm_add_epi32(_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1));
+    *suma = _mm_cvtsi128_si32(t0);
+    *diffa = _mm_cvtsi128_si32(_mm_srli_si128(t0, 4));
+    *sumb = _mm_cvtsi128_si32(_mm_srli_si128(t0, 8));
+    *diffb = _mm_cvtsi128_si32(_mm_srli_si128(t0, 12));
+}
+#else
+static __inline void qmf_dot2(const int16_t wa[24], const int16_t wb[24],
+                              int *suma, int *diffa, int *sumb, int *diffb)
+{
+    qmf_dot(wa, suma, diffa);
+    qmf_dot(wb, sumb, diffb);
+}
+#endif
+/*- End of function --------------------------------------------------------*/
+
+#endif
+/*- End of file ------------------------------------------------------------*/
@@ -0,0 +1,115 @@
+/*
+ * g722_quantl.h - The G.722 low band quantizer, shared by the C and C++
+ * encoders.
+ *
+ * The quantizer comes from the SpanDSP G.722 codec, written by Steve
+ * Underwood <steveu@coppice.org> and placed in the public domain.
+ */
+
+/*! \file */
+
+#if !defined(_G722_QUANTL_H_)
+#define _G722_QUANTL_H_
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Entries 30 and 31 are never reached by the reference scan. The branch free
+   searches in quantl() can read them, so they repeat entry 29 to keep the
+   table sorted. */
+static const int16_t q6[32] =
+{
+       0,   35,   72,  110,  150,  190,  233,  276,
+     323,  370,  422,  473,  530,  587,  650,  714,
+     786,  858,  940, 1023, 1121, 1219, 1339, 1458,
+    1612, 1765, 1980, 2195, 2557, 2919, 2919, 2919
+};
+
+/* Block 1L, QUANTL: find the first i in 1..29 where wd < (q6[i]*det) >> 12,
+   or 30 if there isn't one. */
+static __inline int quantl(int wd, int det)
+{
+#if defined(G722_LINEAR_QUANTL)
+    /* The reference scan, kept for benchmarking */
+    int i;
+
+    for (i = 1;  i < 30;  i++)
+    {
+        if (wd < ((q6[i]*det) >> 12))
+            break;
+    }
+    return i;
+#elif defined(__SSE2__)
+    /* Compare wd against all the thresholds at once. det < 32768 and
+       q6[i] < 4096, so each threshold fits in 15 bits, and can be put together
+       from the high and low halves of the 16 bit products. */
+    __m128i vdet = _mm_set1_epi16((int16_t) det);
+    __m128i vwd = _mm_set1_epi16((int16_t) wd);
+    __m128i lt[4];
+    unsigned int bits;
+    int k;
+
+    for (k = 0;  k < 4;  k++)
+    {
+        __m128i q = _mm_loadu_si128((const __m128i *) &q6[8*k]);
+        __m128i t = _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(q, vdet), 4),
+                                 _mm_srli_epi16(_mm_mullo_epi16(q, vdet), 12));
+
+        lt[k] = _mm_cmplt_epi16(vwd, t);
+    }
+    bits = (unsigned int) _mm_movemask_epi8(_mm_packs_epi16(lt[0], lt[1]))
+         | ((unsigned int) _mm_movemask_epi8(_mm_packs_epi16(lt[2], lt[3])) << 16);
+    /* The thresholds never decrease, and entry 0 is always passed, so the
+       index we want is the number of passes before the first failure.
+       Pretend entry 30 always fails. */
+    return __builtin_ctz(bits | (1u << 30));
+#elif defined(__ARM_NEON)
+    /* As above, but count the passes directly. Entries 30 and 31 repeat
+       entry 29, so the count only exceeds 30 when that is the answer anyway. */
+    int16x4_t vdet = vdup_n_s16((int16_t) det);
+    int16x8_t vwd = vdupq_n_s16((int16_t) wd);
+    uint16x8_t count = vdupq_n_u16(0);
+    int i;
+    int k;
+
+    for (k = 0;  k < 32;  k += 8)
+    {
+        int16x8_t q = vld1q_s16(&q6[k]);
+        int16x8_t t = vcombine_s16(vshrn_n_s32(vmull_s16(vget_low_s16(q), vdet), 12),
+                                   vshrn_n_s32(vmull_s16(vget_high_s16(q), vdet), 12));
+
+        count = vsubq_u16(count, vcgeq_s16(vwd, t));
+    }
+#if defined(__aarch64__)
+    i = vaddvq_u16(count);
+#else
+    {
+        uint64x2_t c = vpaddlq_u32(vpaddlq_u16(count));
+        i = (int) (vgetq_lane_u64(c, 0) + vgetq_lane_u64(c, 1));
+    }
+#endif
+    return (i < 30)  ?  i  :  30;
+#else
+    /* The thresholds never decrease with i, so count the ones at or below wd
+       with a fixed five step binary search, using masks rather than branches. */
+    int i;
+
+    i = 0;
+    i += 16 & -(wd >= ((q6[i + 16]*det) >> 12));
+    i += 8 & -(wd >= ((q6[i + 8]*det) >> 12));
+    i += 4 & -(wd >= ((q6[i + 4]*det) >> 12));
+    i += 2 & -(wd >= ((q6[i + 2]*det) >> 12));
+    i += 1 & -(wd >= ((q6[i + 1]*det) >> 12));
+    /* The padding only matches once entry 29 has too */
+    return (i < 29)  ?  i + 1  :  30;
+#endif
+}
+/*- End of function --------------------------------------------------------*/
+
+#endif
+/*- End of file ------------------------------------------------------------*/
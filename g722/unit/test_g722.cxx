@@ -0,0 +1,329 @@
+#include "../../asha/unit/unit_test.hh"
+
+#include "../g722_enc_dec.h"
+#include "../../asha/G722Encoder.hh"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Encoder/decoder conformance test. Every optimization to the codec has to
+// keep these hashes unchanged.
+//
+// The test signals are synthesized with integer arithmetic only, so they are
+// identical on every platform. Raw mono s16le files at 16 kHz (for instance
+// from sounds/make_raw_files.sh) can be passed on the command line for an
+// extra round trip SNR check on real audio.
+
+namespace
+{
+   constexpr size_t RATE = 16000;
+   constexpr size_t FRAME_SAMPLES = 320;
+   constexpr uint16_t UNITY_GAIN = 0xFFFF;
+
+   int16_t Clip(int64_t v)
+   {
+      if (v > 32767) return 32767;
+      if (v < -32768) return -32768;
+      return (int16_t)v;
+   }
+
+   // Sine oscillator using the y[n] = 2cos(w)y[n-1] - y[n-2] recurrence in
+   // Q30 fixed point. The coefficient is worked out with integer math too.
+   class Tone
+   {
+   public:
+      Tone(uint32_t freq, int32_t amplitude)
+      {
+         // 2cos(w) from a few terms of the Taylor series, with w in Q30.
+         int64_t w = (int64_t)freq * 6746518852ll / RATE; // 2*pi in Q30
+         int64_t w2 = (w * w) >> 30;
+         int64_t c = (1ll << 30) - w2 / 2 + ((w2 * w2) >> 30) / 24 - ((((w2 * w2) >> 30) * w2) >> 30) / 720;
+         m_coeff = 2 * c;
+         m_y1 = 0;
+         m_y2 = -((int64_t)amplitude * (w - ((w * w2) >> 30) / 6) >> 30);
+      }
+      int32_t Next()
+      {
+         int64_t y = ((m_coeff * m_y1) >> 30) - m_y2;
+         m_y2 = m_y1;
+         m_y1 = y;
+         return (int32_t)y;
+      }
+   private:
+      int64_t m_coeff;
+      int64_t m_y1;
+      int64_t m_y2;
+   };
+
+   class Lcg
+   {
+   public:
+      int32_t Next()
+      {
+         m_state = m_state * 1103515245u + 12345u;
+         return (int32_t)(m_state >> 16) - 32768;
+      }
+   private:
+      uint32_t m_state = 1;
+   };
+
+   // Pulse train through two resonators, chopped into syllables and pauses.
+   std::vector<int16_t> Speech()
+   {
+      std::vector<int16_t> ret(4 * RATE);
+      Lcg noise;
+      // Two pole resonators at roughly 700 Hz and 1200 Hz, Q14.
+      const int32_t a[2][2] = {{29150, -15100}, {26030, -15570}};
+      int32_t y[2][2] = {};
+      size_t period = 130;
+      size_t next_pulse = 0;
+      for (size_t i = 0; i < ret.size(); ++i)
+      {
+         int32_t excite = noise.Next() >> 9;
+         if (i == next_pulse)
+         {
+            excite += 500;
+            period = 120 + (i / 1000) % 40;
+            next_pulse += period;
+         }
+         int32_t out = 0;
+         for (size_t f = 0; f < 2; ++f)
+         {
+            int32_t v = excite + ((a[f][0] * y[f][0] + a[f][1] * y[f][1]) >> 14);
+            v = Clip(v);
+            y[f][1] = y[f][0];
+            y[f][0] = v;
+            out += v;
+         }
+         size_t pos = i % (RATE / 4);
+         int32_t envelope = pos < RATE / 8 ? pos : RATE / 4 - pos; // 0..2000
+         if (i % (3 * RATE) > 2 * RATE + RATE / 2)
+            ret[i] = Clip(noise.Next() >> 10);
+         else
+            ret[i] = Clip((int64_t)out * envelope / 700);
+      }
+      return ret;
+   }
+
+   // A chord with some harmonics and a repeating decay.
+   std::vector<int16_t> Music()
+   {
+      std::vector<int16_t> ret(4 * RATE);
+      std::vector<Tone> tones;
+      for (uint32_t f: {262, 330, 392})
+         for (uint32_t h = 1; h <= 4; ++h)
+            tones.emplace_back(f * h, 4000 / h);
+      for (size_t i = 0; i < ret.size(); ++i)
+      {
+         int64_t v = 0;
+         for (auto& t: tones)
+            v += t.Next();
+         const int64_t half = RATE / 2;
+         int64_t decay = half - (int64_t)(i % half);
+         ret[i] = Clip(v * decay / half);
+      }
+      return ret;
+   }
+
+   std::vector<int16_t> Noise()
+   {
+      std::vector<int16_t> ret(4 * RATE);
+      Lcg lcg;
+      for (auto& s: ret)
+         s = Clip(lcg.Next());
+      return ret;
+   }
+
+   std::vector<int16_t> Square()
+   {
+      std::vector<int16_t> ret(4 * RATE);
+      for (size_t i = 0; i < ret.size(); ++i)
+         ret[i] = (i / 8) % 2 ? 32767 : -32768;
+      return ret;
+   }
+
+   std::vector<int16_t> Silence()
+   {
+      return std::vector<int16_t>(4 * RATE);
+   }
+
+   uint64_t Fnv1a(const uint8_t* data, size_t len)
+   {
+      uint64_t h = 0xcbf29ce484222325ull;
+      for (size_t i = 0; i < len; ++i)
+      {
+         h ^= data[i];
+         h *= 0x100000001b3ull;
+      }
+      return h;
+   }
+
+   uint64_t Fnv1a(const std::vector<int16_t>& samples)
+   {
+      // Hash little endian bytes, whatever the host order is.
+      std::vector<uint8_t> bytes;
+      for (int16_t s: samples)
+      {
+         bytes.push_back((uint16_t)s & 0xFF);
+         bytes.push_back((uint16_t)s >> 8);
+      }
+      return Fnv1a(bytes.data(), bytes.size());
+   }
+
+   std::string Hex(uint64_t v)
+   {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "0x%016llx", (unsigned long long)v);
+      return buf;
+   }
+
+   // Encode in 20ms frames, the way Device::SendAudio does.
+   std::vector<uint8_t> Encode(const std::vector<int16_t>& pcm)
+   {
+      g722_encode_state_t state{};
+      g722_encode_init(&state, 64000, G722_PACKED);
+      std::vector<uint8_t> ret(pcm.size() / 2);
+      for (size_t i = 0; i + FRAME_SAMPLES <= pcm.size(); i += FRAME_SAMPLES)
+         g722_encode(&state, &ret[i / 2], &pcm[i], FRAME_SAMPLES);
+      return ret;
+   }
+
+   std::vector<uint8_t> EncodeSpecialized(const std::vector<int16_t>& pcm)
+   {
+      asha::G722Encoder encoder;
+      std::vector<uint8_t> ret(pcm.size() / 2);
+      for (size_t i = 0; i + FRAME_SAMPLES <= pcm.size(); i += FRAME_SAMPLES)
+         encoder.Encode(&ret[i / 2], &pcm[i], FRAME_SAMPLES);
+      return ret;
+   }
+
+   std::vector<int16_t> Decode(const std::vector<uint8_t>& g722)
+   {
+      g722_decode_state_t state{};
+      g722_decode_init(&state, 64000, G722_PACKED);
+      std::vector<int16_t> ret(g722.size() * 2);
+      for (size_t i = 0; i + FRAME_SAMPLES / 2 <= g722.size(); i += FRAME_SAMPLES / 2)
+      {
+         uint32_t n = g722_decode(&state, &ret[i * 2], &g722[i], FRAME_SAMPLES / 2, UNITY_GAIN);
+         ASSERT_TRUE(n == FRAME_SAMPLES) << n;
+      }
+      return ret;
+   }
+
+   // The QMF pair delays the signal, so try a range of alignments and use
+   // the best one.
+   double Snr(const std::vector<int16_t>& in, const std::vector<int16_t>& out)
+   {
+      double best = -INFINITY;
+      for (size_t delay = 0; delay < 64; ++delay)
+      {
+         double signal = 0;
+         double noise = 0;
+         for (size_t i = 0; i + delay < out.size() && i < in.size(); ++i)
+         {
+            double e = (double)in[i] - out[i + delay];
+            signal += (double)in[i] * in[i];
+            noise += e * e;
+         }
+         if (noise == 0)
+            return INFINITY;
+         best = std::max(best, 10 * std::log10(signal / noise));
+      }
+      return best;
+   }
+}
+
+class test_g722
+{
+public:
+   void test_Golden(const char* name,
+                    const std::vector<int16_t>& pcm,
+                    uint64_t encoded_hash,
+                    uint64_t decoded_hash,
+                    double min_snr)
+   {
+      auto g722 = Encode(pcm);
+      auto decoded = Decode(g722);
+
+      uint64_t eh = Fnv1a(g722.data(), g722.size());
+      uint64_t dh = Fnv1a(decoded);
+      std::cout << name << ": encoded " << Hex(eh) << " decoded " << Hex(dh);
+      if (min_snr > -INFINITY)
+      {
+         std::cout << " snr " << Snr(pcm, decoded) << " dB";
+      }
+      std::cout << "\n";
+
+      ASSERT_TRUE(eh == encoded_hash) << name << " encoded hash " << Hex(eh) << " expected " << Hex(encoded_hash);
+      ASSERT_TRUE(EncodeSpecialized(pcm) == g722) << name << " G722Encoder differs from g722_encode";
+      ASSERT_TRUE(dh == decoded_hash) << name << " decoded hash " << Hex(dh) << " expected " << Hex(decoded_hash);
+      if (min_snr > -INFINITY)
+      {
+         ASSERT_TRUE(Snr(pcm, decoded) >= min_snr) << name << " snr " << Snr(pcm, decoded);
+      }
+   }
+
+   void test_Stereo()
+   {
+      auto left = Speech();
+      auto right = Music();
+
+      g722_encode_stereo_state_t stereo{};
+      g722_encode_stereo_init(&stereo, 64000, G722_PACKED);
+      std::vector<uint8_t> l(left.size() / 2);
+      std::vector<uint8_t> r(right.size() / 2);
+      for (size_t i = 0; i + FRAME_SAMPLES <= left.size(); i += FRAME_SAMPLES)
+      {
+         int n = g722_encode_stereo(&stereo, &l[i / 2], &r[i / 2], &left[i], &right[i], FRAME_SAMPLES);
+         ASSERT_TRUE(n == FRAME_SAMPLES / 2) << n;
+      }
+      ASSERT_TRUE(l == Encode(left)) << "Stereo left differs from mono encode";
+      ASSERT_TRUE(r == Encode(right)) << "Stereo right differs from mono encode";
+
+      asha::G722Encoder encoder_left;
+      asha::G722Encoder encoder_right;
+      for (size_t i = 0; i + FRAME_SAMPLES <= left.size(); i += FRAME_SAMPLES)
+      {
+         size_t n = asha::G722Encoder::EncodeStereo(encoder_left, encoder_right, &l[i / 2], &r[i / 2],
+                                                    &left[i], &right[i], FRAME_SAMPLES);
+         ASSERT_TRUE(n == FRAME_SAMPLES / 2) << n;
+      }
+      ASSERT_TRUE(l == Encode(left)) << "G722Encoder stereo left differs from mono encode";
+      ASSERT_TRUE(r == Encode(right)) << "G722Encoder stereo right differs from mono encode";
+   }
+
+   void test_File(const std::string& path)
+   {
+      std::ifstream in(path, std::ios::binary);
+      ASSERT_TRUE(in) << "Unable to read " << path;
+      std::vector<int16_t> pcm;
+      int16_t buf[FRAME_SAMPLES];
+      while (in.read((char*)buf, sizeof(buf)))
+         pcm.insert(pcm.end(), buf, buf + FRAME_SAMPLES);
+
+      double snr = Snr(pcm, Decode(Encode(pcm)));
+      std::cout << path << ": snr " << snr << " dB\n";
+      ASSERT_TRUE(snr >= 20) << path << " snr " << snr;
+   }
+};
+
+int main(int argc, char** argv)
+{
+   test_g722().test_Golden("speech",  Speech(),  0x3ae8076bfdcabdd4ull, 0xfd292840878a9291ull, 22);
+   test_g722().test_Golden("music",   Music(),   0x14e13b4c80e19f22ull, 0x202448c745d00fceull, 22);
+   test_g722().test_Golden("noise",   Noise(),   0x05c98a60a9bdaad0ull, 0x4323479b19534021ull, 5);
+   test_g722().test_Golden("square",  Square(),  0x24408ad9d7ab4759ull, 0xa7b8b67babb84882ull, -INFINITY);
+   test_g722().test_Golden("silence", Silence(), 0xe404bd594fa3d8cdull, 0x5687ec910ea281bfull, -INFINITY);
+   test_g722().test_Stereo();
+
+   for (int i = 1; i < argc; ++i)
+      test_g722().test_File(argv[i]);
+
+   std::cout << "All test passed\n";
+
+   return 0;
+}
@@ -82,6 +82,9 @@ MainWindow::MainWindow()
       m_left.UpdateDevice(nullptr);
       m_right.UpdateDevice(nullptr);
    });
+
+   if (asha::Config::MetricsInterval())
+      m_metrics.reset(new asha::Metrics(m_asha));
 }
 
 MainWindow::~MainWindow()
@@ -11,6 +11,9 @@
 
 #include "../asha/Asha.hh"
 #include "../asha/BluetoothMonitor.hh"
+#include "../asha/Metrics.hh"
+
+#include <memory>
 
 class MainWindow : public Gtk::Window
 {
@@ -34,4 +37,5 @@ private:
    DeviceWidget m_right;
 
    asha::Asha m_asha;
+   std::unique_ptr<asha::Metrics> m_metrics;
 };
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include "asha/Asha.hh"
 #include "asha/BluetoothMonitor.hh"
 #include "asha/Config.hh"
+#include "asha/FlightRecorder.hh"
 #include "asha/GattProfile.hh"
+#include "asha/Metrics.hh"
 
 #include <glib-2.0/glib.h>
 #include <glib-2.0/glib-unix.h>
@@ -37,20 +39,53 @@ int main(int argc, char** argv)
    if (asha::Config::Reconnect())
       profile.reset(new asha::GattProfile);
 
+   std::unique_ptr<asha::Metrics> metrics;
+   if (asha::Config::MetricsInterval())
+      metrics.reset(new asha::Metrics(a));
+
+   std::unique_ptr<asha::FlightRecorder> recorder;
+   if (asha::Config::FlightRecorderSize())
+   {
+      recorder.reset(new asha::FlightRecorder(asha::Config::FlightRecorderSize() * 1024,
+         [&a]() { return a.Stats().ring_dropped; }));
+      if (!recorder->Start())
+         recorder.reset();
+   }
+
    static size_t dropped = 0;
    static size_t failed = 0;
    static size_t silence = 0;
+   // The histograms as of the last line, so the percentiles in it cover
+   // just that second.
+   static asha::Histogram occupancy;
+   static asha::Histogram lateness;
+   static asha::Histogram left;
+   static asha::Histogram right;
+   static asha::FrameTiming trace;
 
    guint stat_timer = g_timeout_add(1000, [](void* userdata)->gboolean {
       auto& a = *(asha::Asha*)userdata;
       if (a.HasDevice())
       {
-         size_t new_dropped = a.RingDropped();
-         size_t new_failed = a.FailedWrites();
-         size_t new_silence = a.Silence();
-
-         std::cout << "Ring Occupancy: " << a.Occupancy()
-                  << " High: " << a.OccupancyHigh()
+         auto stats = a.Stats();
+         size_t new_dropped = stats.ring_dropped;
+         size_t new_failed = stats.failed_writes;
+         size_t new_silence = stats.silence;
+         auto new_left = a.LeftQueue();
+         auto new_right = a.RightQueue();
+         auto new_trace = a.Timing();
+         auto depth = stats.occupancy_depth.Since(occupancy);
+         auto late = stats.lateness.Since(lateness);
+         auto left_queue = new_left.Since(left);
+         auto right_queue = new_right.Since(right);
+         auto timing = new_trace.Since(trace);
+
+         std::cout << "Ring Occupancy: " << stats.occupancy
+                  << " High: " << stats.high_occupancy
+                  << " p99: " << depth.Percentile(0.99)
+                  << " Device Queue: " << a.DeviceQueued()
+                  << " p99 L/R: " << left_queue.Percentile(0.99)
+                  << "/" << right_queue.Percentile(0.99)
                   << " Ring Dropped: " << new_dropped - dropped
                   << " Total: " << new_dropped
                   << " Adapter Dropped: " << new_failed - failed
@@ -58,11 +93,29 @@ int main(int argc, char** argv)
                   << " Silence: " << new_silence - silence
                   << " Total: " << new_silence
                   << " Rssi: " << a.LeftRssi() << ", " << a.RightRssi()
+                  << " Late p50/p99/max: " << late.Percentile(0.5)
+                  << "/" << late.Percentile(0.99)
+                  << "/" << stats.lateness.Max() << " us"
+                  << " Trace p99 ring/encode/send/total: " << timing.ring.Percentile(0.99)
+                  << "/" << timing.encode.Percentile(0.99)
+                  << "/" << timing.send.Percentile(0.99)
+                  << "/" << timing.total.Percentile(0.99) << " us"
+                  << " Gaps: " << timing.Gaps()
+                  << " Total: " << new_trace.Gaps()
+                  << " Ear p50/p99: " << a.EarLatency(timing.total, 0.5) / 1000000
+                  << "/" << a.EarLatency(timing.total, 0.99) / 1000000 << " ms"
+                  << " Run: " << a.EarLatency(new_trace.total, 0.5) / 1000000
+                  << "/" << a.EarLatency(new_trace.total, 0.99) / 1000000 << " ms"
                   << '\n';
 
          dropped = new_dropped;
          failed = new_failed;
          silence = new_silence;
+         occupancy = stats.occupancy_depth;
+         lateness = stats.lateness;
+         left = new_left;
+         right = new_right;
+         trace = new_trace;
       }
       return G_SOURCE_CONTINUE;
    }, &a);
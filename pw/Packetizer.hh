@@ -0,0 +1,80 @@
+#pragma once
+
+#include "../asha/AudioPacket.hh"
+#include "../asha/BufferInterface.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace pw
+{
+
+// Pipewire hands us buffers of whatever size the graph quantum is. We ask for
+// one frame per quantum, but can't count on getting it. Collect
+// the planar samples straight into the buffer's RawS16 slots, and commit each
+// slot once it is full.
+//
+// Each slot is stamped with the time its first samples were pushed, and
+// numbered, so that it can be traced to the sockets.
+//
+// Kept apart from Stream so that it can be benchmarked without pipewire.
+class Packetizer
+{
+public:
+   Packetizer(const std::shared_ptr<BufferInterface>& buffer): m_buffer{buffer} {}
+
+   // Drop any partially filled frame. A claimed slot is kept for the next
+   // one.
+   void Reset() { m_samples_used = 0; }
+
+   // Samples in the partly filled frame.
+   size_t Pending() const { return m_samples_used; }
+
+   // stamp is when pipewire handed over the samples, or 0 to not trace them.
+   void Push(const int16_t* left, const int16_t* right, size_t samples, uint64_t stamp = 0)
+   {
+      while (samples > 0)
+      {
+         // If the buffer is full, the samples for this frame are dropped,
+         // but we keep counting them so that frames stay aligned.
+         if (m_samples_used == 0)
+         {
+            if (!m_slot)
+               m_slot = m_buffer->NextBuffer();
+            if (m_slot)
+            {
+               m_slot->stamp = stamp;
+               m_slot->seq = m_seq;
+            }
+         }
+
+         size_t samples_to_copy = std::min(RawS16::SAMPLE_COUNT - m_samples_used, samples);
+         if (m_slot)
+         {
+            memcpy(m_slot->l + m_samples_used, left, samples_to_copy * 2);
+            memcpy(m_slot->r + m_samples_used, right, samples_to_copy * 2);
+         }
+         m_samples_used += samples_to_copy;
+         samples -= samples_to_copy;
+         left += samples_to_copy;
+         right += samples_to_copy;
+         if (m_samples_used >= RawS16::SAMPLE_COUNT)
+         {
+            if (m_slot)
+               m_buffer->SendBuffer();
+            m_slot = nullptr;
+            m_samples_used = 0;
+            ++m_seq;
+         }
+      }
+   }
+
+private:
+   std::shared_ptr<BufferInterface> m_buffer;
+   RawS16* m_slot = nullptr;
+   size_t m_samples_used = 0;
+   uint32_t m_seq = 1;
+};
+
+}
@@ -1,12 +1,17 @@
 #include "Stream.hh"
 #include "Thread.hh"
+#include "../asha/Now.hh"
+#include "../asha/RtLog.hh"
 
 #include <pipewire/impl.h>
 #include <spa/monitor/device.h>
 #include <spa/monitor/event.h>
 #include <spa/monitor/utils.h>
 #include <spa/param/audio/format-utils.h>
+#include <spa/param/latency-utils.h>
+#include <spa/node/io.h>
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
@@ -45,13 +50,14 @@ Stream::Stream(
    EventCallback on_disconnect,
    EventCallback on_start,
    EventCallback on_stop,
-   DataCallback on_data):
+   const std::shared_ptr<BufferInterface>& buffer):
       m_thread{Thread::Get()},
       m_connect_cb{on_connect},
       m_disconnect_cb{on_disconnect},
       m_start_cb{on_start},
       m_stop_cb{on_stop},
-      m_data_cb{on_data}
+      m_buffer{buffer},
+      m_packetizer{buffer}
 {
    auto lock = m_thread->Lock();
    // Stream objects will create nodes that will auto-convert to the given
@@ -61,6 +67,7 @@ Stream::Stream(
    m_info.position[0] = SPA_AUDIO_CHANNEL_FL;
    m_info.position[1] = SPA_AUDIO_CHANNEL_FR;
    m_info.rate = 16000;
+   ResetRate();
 
    m_stream = pw_stream_new(m_thread->Core(), "ASHA Device",
       pw_properties_new(
@@ -68,6 +75,11 @@ Stream::Stream(
 	      PW_KEY_NODE_DESCRIPTION, alias.c_str(),
          PW_KEY_NODE_VIRTUAL, "false",
 	      PW_KEY_MEDIA_CLASS, "Audio/Sink",
+         // Ask for a quantum of exactly one ASHA frame, so each process call
+         // fills one packet. The graph may still pick something else if
+         // another node needs it, and the Packetizer copes with that.
+         PW_KEY_NODE_LATENCY, "320/16000",
+         PW_KEY_NODE_RATE, "1/16000",
       nullptr)
    );
    if (m_stream == nullptr)
@@ -95,12 +107,18 @@ Stream::Stream(
          case PW_STREAM_STATE_CONNECTING:  self->m_connect_cb();    break;
          case PW_STREAM_STATE_PAUSED:      self->m_stop_cb();       break;
          case PW_STREAM_STATE_STREAMING:
-            self->m_samples_used = 0;
+            self->m_packetizer.Reset();
+            self->ResetRate();
             self->m_start_cb();
             break;
          default: break;
          }
       },
+      .io_changed = [](void* d, uint32_t id, void* area, uint32_t size) {
+         auto* self = (Stream*)d;
+         if (id == SPA_IO_RateMatch)
+            self->m_rate_match = (spa_io_rate_match*)area;
+      },
       // .param_changed = [](void *data, uint32_t id, const struct spa_pod *param) { /* TODO: Define parameters, like volume? */ },
       .process = [](void* d) { ((Stream*)d)->Process(); }, // Called from its own thread.
    };
@@ -137,6 +155,26 @@ Stream::~Stream()
 }
 
 
+void Stream::SetLatency(uint64_t ns)
+{
+   auto lock = m_thread->Lock();
+   if (!m_stream)
+      return;
+
+   spa_latency_info info = SPA_LATENCY_INFO(SPA_DIRECTION_INPUT);
+   info.min_ns = ns;
+   info.max_ns = ns;
+
+   spa_pod_builder builder;
+   uint8_t buffer[256];
+   spa_pod_builder_init(&builder, buffer, sizeof(buffer));
+   const struct spa_pod* params[1] = {
+      spa_latency_build(&builder, SPA_PARAM_Latency, &info)
+   };
+   pw_stream_update_params(m_stream, params, 1);
+}
+
+
 void Stream::Process()
 {
    // Called from a new thread that seems created just for the stream
@@ -144,6 +182,7 @@ void Stream::Process()
    struct pw_buffer* in;
    while ((in = pw_stream_dequeue_buffer(m_stream)))
    {
+      uint64_t stamp = Now();
       uint32_t left = in->buffer->n_datas >= 1 ? in->buffer->datas[0].chunk->size : 0;
       uint32_t right = in->buffer->n_datas >= 2 ? in->buffer->datas[1].chunk->size : 0;
       // printf("Received %d channels of sound data (%d, %d). \n", in->buffer->n_datas, left/2, right/2);
@@ -159,40 +198,47 @@ void Stream::Process()
          assert(lsize == rsize);
          if (lsize == rsize)
          {
-            size_t samples = left / 2;
-            size_t offset = 0;
-            do
-            {
-               size_t samples_needed = RawS16::SAMPLE_COUNT - m_samples_used;
-               size_t samples_to_copy = std::min(samples_needed, samples);
-               memcpy(m_samples.l + m_samples_used, SPA_PTROFF(l.data, loffs, int16_t) + offset, samples_to_copy * 2);
-               memcpy(m_samples.r + m_samples_used, SPA_PTROFF(r.data, loffs, int16_t) + offset, samples_to_copy * 2);
-               m_samples_used += samples_to_copy;
-               samples -= samples_to_copy;
-               offset += samples_to_copy;
-               if (m_samples_used >= RawS16::SAMPLE_COUNT)
-               {
-                  m_data_cb(m_samples);
-                  m_samples_used = 0;
-               }
-               else
-               {
-                  break;
-               }
-            }
-            while (samples > 0);
+            m_packetizer.Push(SPA_PTROFF(l.data, loffs, int16_t), SPA_PTROFF(r.data, roffs, int16_t), lsize / 2, stamp);
          }
          else
          {
-            printf("lsize was not rsize... dropping audio frame");
+            asha::RtLog::Warning("lsize was not rsize... dropping audio frame");
          }
       }
       else
       {
-         printf("Different number of samples from left and right. Dropping audio frame.");
+         asha::RtLog::Warning("Different number of samples from left and right. Dropping audio frame.");
       }
 
       // Place the buffer back so that it can be reused.
       pw_stream_queue_buffer(m_stream, in);
    }
+   UpdateRate();
+}
+
+
+void Stream::ResetRate()
+{
+   spa_dll_init(&m_dll);
+   spa_dll_set_bw(&m_dll, SPA_DLL_BW_MIN, RawS16::SAMPLE_COUNT, m_info.rate);
+}
+
+
+void Stream::UpdateRate()
+{
+   // Same approach as module-pulse-tunnel: feed the distance from the target
+   // fill level into a DLL, and let its output nudge the resampler.
+   size_t target = m_buffer->QueueTarget();
+   if (!m_rate_match || target == 0)
+      return;
+
+   // The queue only moves a whole frame at a time, which the DLL averages
+   // out. Clamp to a frame so that a startup burst doesn't swing it.
+   static constexpr double MAX_ERROR = RawS16::SAMPLE_COUNT;
+   double queued = m_buffer->Queued() * RawS16::SAMPLE_COUNT + m_packetizer.Pending();
+   double error = std::clamp(target * RawS16::SAMPLE_COUNT - queued, -MAX_ERROR, MAX_ERROR);
+   double corr = spa_dll_update(&m_dll, error);
+
+   m_rate_match->rate = 1.0 / corr;
+   SPA_FLAG_SET(m_rate_match->flags, SPA_IO_RATE_MATCH_FLAG_ACTIVE);
 }
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "../asha/AudioPacket.hh"
+#include "../asha/BufferInterface.hh"
+#include "Packetizer.hh"
 
 #include <spa/param/audio/raw.h>
+#include <spa/utils/dll.h>
 #include <spa/utils/hook.h>
 
 #include <memory>
@@ -13,6 +16,7 @@
 struct spa_hook;
 struct pw_core;
 struct pw_stream;
+struct spa_io_rate_match;
 
 namespace pw
 {
@@ -24,7 +28,6 @@ class Thread;
 class Stream
 {
 public:
-   typedef std::function<void(RawS16&)> DataCallback;
    typedef std::function<void(void)> EventCallback;
 
    Stream(const std::string& name, const std::string& alias,
@@ -32,12 +35,17 @@ public:
       EventCallback on_disconnect,  // When the node is disconnected from the graph.
       EventCallback on_start,       // When sound data will start playing.
       EventCallback on_stop,        // When sound data has stopped.
-      DataCallback on_data          // Will get called with audio data.
+      const std::shared_ptr<BufferInterface>& buffer // Audio data is written here.
    );
    ~Stream();
 
+   // Tell the graph how long after we receive audio it will be heard.
+   void SetLatency(uint64_t ns);
+
 private:
    void Process();
+   void ResetRate();
+   void UpdateRate();
 
    std::shared_ptr<Thread> m_thread;
    
@@ -52,10 +60,16 @@ private:
    EventCallback m_disconnect_cb;
    EventCallback m_start_cb;
    EventCallback m_stop_cb;
-   DataCallback m_data_cb;
 
-   RawS16 m_samples;
-   size_t m_samples_used = 0;
+   std::shared_ptr<BufferInterface> m_buffer;
+   Packetizer m_packetizer;
+
+   // Steers the resampler in front of us so that the buffer neither runs
+   // dry nor overflows when the graph clock drifts from the hearing
+   // devices. Pipewire owns m_rate_match, and only provides it when there
+   // is a resampler.
+   struct spa_io_rate_match* m_rate_match = nullptr;
+   struct spa_dll m_dll{};
 
    double m_prev_stamp = 0;
    size_t m_count = 0;
@@ -15,6 +15,8 @@
 #include <dirent.h>
 #include <sys/stat.h>
 
+#include "g722/g722_enc_dec.h"
+
 // No ntoh64 on my box :(
 template <typename T>
 inline T NetSwap(T v)
@@ -1455,6 +1457,7 @@ int main(int argc, char** argv)
 {
    std::string snoop_filename;
    bool extract_audio = false;
+   bool decode_audio = false;
    for (int i = 1; i < argc; ++i)
    {
       std::string k = argv[i];
@@ -1473,6 +1476,10 @@ int main(int argc, char** argv)
       {
          extract_audio = true;
       }
+      else if (k == "--decode")
+      {
+         decode_audio = true;
+      }
       else
       {
          std::cout << "Usage: " << argv[0] << " [opts] capture.snoop\n"
@@ -1484,6 +1491,7 @@ int main(int argc, char** argv)
                    << "                        during a previous connection or dump file if the pairing\n"
                    << "                        is not part of the snoop file.\n"
                    << "   --extract            Extract audio into <cid>_<connid>.g722 files\n"
+                   << "   --decode             Decode audio into <cid>_<connid>.s16le files\n"
                    << "\n"
                    << "Parsed characteristics are cached in ~/.local/share/snoop_analyze/cache/ to be\n"
                    << "used in the future. These characteristics can also be manually copied by the\n"
@@ -1546,6 +1554,8 @@ int main(int argc, char** argv)
       uint64_t expected_stamp = 0;
 
       std::unique_ptr<std::ofstream> outfile;
+      std::unique_ptr<std::ofstream> pcmfile;
+      std::unique_ptr<g722_decode_state_t> decoder;
    };
    std::map<std::pair<uint16_t, StreamCids>, StreamInfo> asha_streams;
    uint64_t frame_idx = 0;
@@ -1787,6 +1797,20 @@ int main(int argc, char** argv)
             // First byte is sequence number. Skip it.
             itinfo->second.outfile->write((const char*)data + 1, len - 1);
          }
+         if (len > 1 && decode_audio)
+         {
+            auto& stream = itinfo->second;
+            if (!stream.decoder)
+            {
+               std::string filename = Hex(connection) + "_" + Hex(info.cids.tx) + ".s16le";
+               stream.pcmfile = std::make_unique<std::ofstream>(filename, std::ios::binary);
+               stream.decoder = std::make_unique<g722_decode_state_t>();
+               g722_decode_init(stream.decoder.get(), 64000, G722_PACKED);
+            }
+            std::vector<int16_t> pcm((len - 1) * 2);
+            uint32_t samples = g722_decode(stream.decoder.get(), pcm.data(), data + 1, len - 1, 0xFFFF);
+            stream.pcmfile->write((const char*)pcm.data(), samples * sizeof(int16_t));
+         }
 
          itinfo->second.credits = info.tx_credits;
          std::cout << Idx() << (rx ? " >> " : " << ") << Hex(connection);
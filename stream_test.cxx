@@ -170,18 +170,29 @@ protected:
          uint64_t t = Now();
          if (next < t)
          {
-            size_t new_dropped = buffer->RingDropped();
-            size_t new_failed = buffer->FailedWrites();
-            size_t new_silence = buffer->Silence();
-            std::cout << "Ring Occupancy: " << buffer->Occupancy()
-                << " High: " << buffer->OccupancyHigh()
+            auto stats = buffer->Stats();
+            size_t new_dropped = stats.ring_dropped;
+            size_t new_failed = stats.failed_writes;
+            size_t new_silence = stats.silence;
+            std::cout << "Ring Occupancy: " << stats.occupancy
+                << " High: " << stats.high_occupancy
+                << " p99: " << stats.occupancy_depth.Percentile(0.99)
+                << " Device Queue: " << buffer->DeviceQueued()
                 << " Ring Dropped: " << new_dropped - dropped
                 << " Total: " << new_dropped
                 << " Adapter Dropped: " << new_failed - failed
                 << " Total: " << new_failed
                 << " Silence: " << new_silence - silence
                 << " Total: " << new_silence
+                << " Late p50/p99/max: " << stats.lateness.Percentile(0.5)
+                << "/" << stats.lateness.Percentile(0.99)
+                << "/" << stats.lateness.Max() << " us"
+                << " Trace p50/p99: " << m_device->Timing().total.Percentile(0.5)
+                << "/" << m_device->Timing().total.Percentile(0.99) << " us"
                 << '\n';
+            dropped = new_dropped;
+            failed = new_failed;
+            silence = new_silence;
             next = t + 10 * 1000000000ull;
          }
 
@@ -191,6 +202,7 @@ protected:
             if (!samples)
                break;
 
+            samples->stamp = t;
             if (!m_data_left.empty())
                memcpy(samples->l, m_data_left.data() + m_data_offset, MIN_SAMPLES_BYTES);
             if (!m_data_right.empty())